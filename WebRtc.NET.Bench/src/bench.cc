@@ -0,0 +1,165 @@
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include <windows.h>
+#include <psapi.h>
+#include <tlhelp32.h>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/base/timeutils.h"
+
+#include "internals.h"
+
+namespace Bench
+{
+	static int64_t FileTimeToMicros(const FILETIME & t)
+	{
+		ULARGE_INTEGER u;
+		u.LowPart = t.dwLowDateTime;
+		u.HighPart = t.dwHighDateTime;
+		return static_cast<int64_t>(u.QuadPart / 10);
+	}
+
+	static int CountThreads()
+	{
+		int count = 0;
+		DWORD pid = ::GetCurrentProcessId();
+
+		HANDLE snapshot = ::CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+		if (snapshot == INVALID_HANDLE_VALUE)
+			return -1;
+
+		THREADENTRY32 te;
+		te.dwSize = sizeof(te);
+		if (::Thread32First(snapshot, &te))
+		{
+			do
+			{
+				if (te.th32OwnerProcessID == pid)
+				{
+					count++;
+				}
+			} while (::Thread32Next(snapshot, &te));
+		}
+		::CloseHandle(snapshot);
+		return count;
+	}
+
+	ProcessSample SampleProcess()
+	{
+		ProcessSample s;
+		s.wall_us = rtc::TimeMicros();
+		s.cpu_us = 0;
+		s.private_bytes = 0;
+
+		FILETIME creation, exit, kernel, user;
+		if (::GetProcessTimes(::GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		{
+			s.cpu_us = FileTimeToMicros(kernel) + FileTimeToMicros(user);
+		}
+
+		PROCESS_MEMORY_COUNTERS_EX mem;
+		if (::GetProcessMemoryInfo(::GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&mem), sizeof(mem)))
+		{
+			s.private_bytes = mem.PrivateUsage;
+		}
+
+		s.threads = CountThreads();
+		return s;
+	}
+
+	double Percentile(std::vector<double> & values, double p)
+	{
+		if (values.empty())
+			return 0;
+
+		std::sort(values.begin(), values.end());
+		size_t i = static_cast<size_t>(p / 100.0 * (values.size() - 1) + 0.5);
+		return values[std::min(i, values.size() - 1)];
+	}
+
+	static int FindArg(int argc, char * argv[], const char * name)
+	{
+		for (int i = 2; i < argc - 1; i++)
+		{
+			if (strcmp(argv[i], name) == 0)
+			{
+				return i + 1;
+			}
+		}
+		return -1;
+	}
+
+	int IntArg(int argc, char * argv[], const char * name, int def)
+	{
+		int i = FindArg(argc, argv, name);
+		return i < 0 ? def : atoi(argv[i]);
+	}
+
+	std::string StringArg(int argc, char * argv[], const char * name, const std::string & def)
+	{
+		int i = FindArg(argc, argv, name);
+		return i < 0 ? def : std::string(argv[i]);
+	}
+}
+
+static void Usage()
+{
+	fprintf(stderr,
+			"usage: WebRtc.NET.Bench <mode> [options]\n"
+			"\n"
+			"  loopback   N sender/receiver Conductor pairs in one process\n"
+			"    --pairs N        number of pairs (1)\n"
+			"    --width W        frame width (640)\n"
+			"    --height H       frame height (360)\n"
+			"    --fps F          capture fps (30)\n"
+			"    --duration S     run time in seconds (30)\n"
+			"    --interval S     report interval in seconds (5)\n"
+			"    --trace FILE     write per-stage frame events as Chrome trace JSON\n"
+			"\n"
+			"  codec      VP8 encode/decode sweep, one result per configuration\n"
+			"    --resolutions L  WxH list (320x180,640x360,1280x720,1920x1080)\n"
+			"    --simulcast L    stream count list (1,3)\n"
+			"    --complexity L   0 normal, 1 high, 2 higher, 3 max (0,2)\n"
+			"    --cores L        encoder thread count list (1,4)\n"
+			"    --frames N       frames per configuration (300)\n"
+			"    --fps F          nominal frame rate (30)\n"
+			"    --bitrate K      total target kbps, 0 for 0.05 bpp per stream (0)\n"
+			"\n"
+			"Results are written to stdout as one JSON object per line.\n");
+}
+
+int main(int argc, char * argv[])
+{
+	if (argc < 2)
+	{
+		Usage();
+		return 1;
+	}
+
+	rtc::LogMessage::LogToDebug(rtc::LS_ERROR);
+
+	int ret = 1;
+	Native::InitializeSSL();
+	{
+		if (strcmp(argv[1], "loopback") == 0)
+		{
+			ret = Bench::RunLoopback(argc, argv);
+		}
+		else if (strcmp(argv[1], "codec") == 0)
+		{
+			ret = Bench::RunCodec(argc, argv);
+		}
+		else
+		{
+			Usage();
+		}
+	}
+	Native::CleanupSSL();
+	return ret;
+}
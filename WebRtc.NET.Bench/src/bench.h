@@ -0,0 +1,33 @@
+
+#ifndef WEBRTC_NET_BENCH_H_
+#define WEBRTC_NET_BENCH_H_
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace Bench
+{
+	// process wide resource usage at one point in time
+	struct ProcessSample
+	{
+		int64_t wall_us;
+		int64_t cpu_us;
+		int64_t private_bytes;
+		int threads;
+	};
+
+	ProcessSample SampleProcess();
+
+	// |p| in [0..100], sorts |values|
+	double Percentile(std::vector<double> & values, double p);
+
+	int IntArg(int argc, char * argv[], const char * name, int def);
+	std::string StringArg(int argc, char * argv[], const char * name, const std::string & def);
+
+	int RunLoopback(int argc, char * argv[]);
+	int RunCodec(int argc, char * argv[]);
+}
+
+#endif  // WEBRTC_NET_BENCH_H_
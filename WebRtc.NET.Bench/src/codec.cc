@@ -0,0 +1,422 @@
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <memory>
+
+#include "yuvframegenerator.h"
+
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/common_video/libyuv/include/webrtc_libyuv.h"
+#include "webrtc/modules/video_coding/codecs/vp8/temporal_layers.h"
+#include "webrtc/modules/video_coding/codecs/vp8/vp8_impl.h"
+#include "webrtc/modules/video_coding/include/video_codec_interface.h"
+#include "webrtc/modules/video_coding/utility/simulcast_rate_allocator.h"
+
+namespace Bench
+{
+	const int kRtpTicksPerSecond = 90000;
+
+	// default target, bits per pixel at the configured fps
+	const double kDefaultBitsPerPixel = 0.05;
+
+	struct CodecConfig
+	{
+		int width;
+		int height;
+		int streams;
+		int complexity;
+		int cores;
+		int fps;
+		int frames;
+		int bitrate_kbps;
+	};
+
+	struct StreamResult
+	{
+		StreamResult() : width(0), height(0), target_kbps(0), bytes(0), frames(0), key_frames(0), psnr_sum(0), psnr_min(0), decoded(0)
+		{
+		}
+
+		int width;
+		int height;
+		uint32_t target_kbps;
+		int64_t bytes;
+		int frames;
+		int key_frames;
+		double psnr_sum;
+		double psnr_min;
+		int decoded;
+	};
+
+	// Owns a copy of one encoded layer, the encoder reuses its buffers.
+	struct EncodedFrame
+	{
+		EncodedFrame(int stream, const webrtc::EncodedImage & image) :
+			stream(stream),
+			data(image._buffer, image._buffer + image._length),
+			image(image)
+		{
+			this->image._buffer = data.data();
+			this->image._size = data.size();
+		}
+
+		int stream;
+		std::vector<uint8_t> data;
+		webrtc::EncodedImage image;
+	};
+
+	class EncodedCollector : public webrtc::EncodedImageCallback
+	{
+	public:
+		virtual Result OnEncodedImage(const webrtc::EncodedImage & image,
+									  const webrtc::CodecSpecificInfo * info,
+									  const webrtc::RTPFragmentationHeader * fragmentation) override
+		{
+			int stream = info ? info->codecSpecific.VP8.simulcastIdx : 0;
+			frames.push_back(std::unique_ptr<EncodedFrame>(new EncodedFrame(stream, image)));
+			return Result(Result::OK);
+		}
+
+		std::vector<std::unique_ptr<EncodedFrame>> frames;
+	};
+
+	class DecodedCollector : public webrtc::DecodedImageCallback
+	{
+	public:
+		DecodedCollector() : result(nullptr)
+		{
+		}
+
+		// kept for Measure, PSNR is not part of the decode time
+		virtual int32_t Decoded(webrtc::VideoFrame & frame) override
+		{
+			frames.push_back(frame.video_frame_buffer());
+			return WEBRTC_VIDEO_CODEC_OK;
+		}
+
+		void Measure()
+		{
+			for (auto & f : frames)
+			{
+				double psnr = webrtc::I420PSNR(*reference, *f);
+				result->psnr_sum += psnr;
+				result->psnr_min = result->decoded == 0 ? psnr : std::min(result->psnr_min, psnr);
+				result->decoded++;
+			}
+			frames.clear();
+		}
+
+		// reference picture at the resolution of the stream being decoded
+		rtc::scoped_refptr<webrtc::I420Buffer> reference;
+		StreamResult * result;
+		std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>> frames;
+	};
+
+	static void SetupCodec(const CodecConfig & c, webrtc::TemporalLayersFactory * tl_factory, webrtc::VideoCodec * codec)
+	{
+		codec->codecType = webrtc::kVideoCodecVP8;
+		codec->width = c.width;
+		codec->height = c.height;
+		codec->maxFramerate = c.fps;
+		codec->qpMax = 56;
+
+		*codec->VP8() = webrtc::VideoEncoder::GetDefaultVp8Settings();
+		codec->VP8()->complexity = static_cast<webrtc::VideoCodecComplexity>(c.complexity);
+		codec->VP8()->numberOfTemporalLayers = 1;
+		codec->VP8()->automaticResizeOn = false;
+		codec->VP8()->tl_factory = tl_factory;
+
+		// lowest resolution first, each layer halves the previous one
+		uint32_t total_kbps = 0;
+		for (int i = 0; i < c.streams; i++)
+		{
+			int shift = c.streams - 1 - i;
+			webrtc::SimulcastStream & s = codec->simulcastStream[i];
+			s.width = c.width >> shift;
+			s.height = c.height >> shift;
+			s.numberOfTemporalLayers = 1;
+			s.targetBitrate = std::max(30, static_cast<int>(kDefaultBitsPerPixel * s.width * s.height * c.fps / 1000));
+			s.maxBitrate = s.targetBitrate * 3 / 2;
+			s.minBitrate = s.targetBitrate / 4;
+			s.qpMax = codec->qpMax;
+			total_kbps += s.targetBitrate;
+		}
+		codec->numberOfSimulcastStreams = c.streams > 1 ? c.streams : 0;
+
+		if (c.bitrate_kbps > 0)
+		{
+			total_kbps = c.bitrate_kbps;
+		}
+		codec->startBitrate = total_kbps;
+		codec->targetBitrate = total_kbps;
+		codec->minBitrate = codec->simulcastStream[0].minBitrate;
+		codec->maxBitrate = total_kbps * 3 / 2;
+	}
+
+	static void Print(const CodecConfig & c, const std::vector<StreamResult> & streams,
+					  double encode_s, double decode_s, int dropped,
+					  std::vector<double> & encode_ms, std::vector<double> & decode_ms)
+	{
+		const double media_s = static_cast<double>(c.frames) / c.fps;
+
+		uint32_t target_kbps = 0;
+		int64_t bytes = 0;
+		for (const StreamResult & s : streams)
+		{
+			target_kbps += s.target_kbps;
+			bytes += s.bytes;
+		}
+		const double actual_kbps = bytes * 8 / media_s / 1000;
+		const StreamResult & top = streams.back();
+
+		printf("{\"type\":\"codec\",\"width\":%d,\"height\":%d,\"streams\":%d,\"complexity\":%d,\"cores\":%d,\"fps\":%d,\"frames\":%d,"
+			   "\"encode_fps\":%.1f,\"decode_fps\":%.1f,\"dropped\":%d,"
+			   "\"target_kbps\":%u,\"actual_kbps\":%.1f,\"bitrate_accuracy\":%.3f,"
+			   "\"psnr_db\":%.2f,\"psnr_db_min\":%.2f,"
+			   "\"encode_ms_p50\":%.3f,\"encode_ms_p99\":%.3f,\"decode_ms_p50\":%.3f,\"decode_ms_p99\":%.3f,\"layers\":[",
+			   c.width, c.height, c.streams, c.complexity, c.cores, c.fps, c.frames,
+			   encode_s > 0 ? c.frames / encode_s : 0,
+			   decode_s > 0 ? c.frames / decode_s : 0,
+			   dropped,
+			   target_kbps,
+			   actual_kbps,
+			   target_kbps > 0 ? actual_kbps / target_kbps : 0,
+			   top.decoded > 0 ? top.psnr_sum / top.decoded : 0,
+			   top.psnr_min,
+			   Percentile(encode_ms, 50),
+			   Percentile(encode_ms, 99),
+			   Percentile(decode_ms, 50),
+			   Percentile(decode_ms, 99));
+
+		for (size_t i = 0; i < streams.size(); i++)
+		{
+			const StreamResult & s = streams[i];
+			printf("%s{\"width\":%d,\"height\":%d,\"frames\":%d,\"key_frames\":%d,\"target_kbps\":%u,\"actual_kbps\":%.1f,\"psnr_db\":%.2f}",
+				   i > 0 ? "," : "",
+				   s.width, s.height, s.frames, s.key_frames, s.target_kbps,
+				   s.bytes * 8 / media_s / 1000,
+				   s.decoded > 0 ? s.psnr_sum / s.decoded : 0);
+		}
+		printf("]}\n");
+		fflush(stdout);
+	}
+
+	static bool RunCodecConfig(const CodecConfig & c)
+	{
+		webrtc::TemporalLayersFactory tl_factory;
+		webrtc::VideoCodec codec;
+		SetupCodec(c, &tl_factory, &codec);
+
+		EncodedCollector encoded;
+		webrtc::VP8EncoderImpl encoder;
+		encoder.RegisterEncodeCompleteCallback(&encoded);
+		if (encoder.InitEncode(&codec, c.cores, 1200) != WEBRTC_VIDEO_CODEC_OK)
+		{
+			fprintf(stderr, "InitEncode failed for %dx%d, %d streams\n", c.width, c.height, c.streams);
+			return false;
+		}
+
+		webrtc::SimulcastRateAllocator allocator(codec, nullptr);
+		webrtc::BitrateAllocation allocation = allocator.GetAllocation(codec.startBitrate * 1000, c.fps);
+		encoder.SetRateAllocation(allocation, c.fps);
+
+		std::vector<StreamResult> results(c.streams);
+		std::vector<DecodedCollector> decoded(c.streams);
+		std::vector<std::unique_ptr<webrtc::VP8DecoderImpl>> decoders;
+		for (int i = 0; i < c.streams; i++)
+		{
+			const int w = c.streams > 1 ? codec.simulcastStream[i].width : c.width;
+			const int h = c.streams > 1 ? codec.simulcastStream[i].height : c.height;
+
+			results[i].width = w;
+			results[i].height = h;
+			results[i].target_kbps = allocation.GetSpatialLayerSum(i) / 1000;
+
+			decoded[i].result = &results[i];
+			decoded[i].reference = webrtc::I420Buffer::Create(w, h);
+
+			webrtc::VideoCodec settings;
+			settings.codecType = webrtc::kVideoCodecVP8;
+			settings.width = w;
+			settings.height = h;
+
+			decoders.push_back(std::unique_ptr<webrtc::VP8DecoderImpl>(new webrtc::VP8DecoderImpl()));
+			decoders.back()->RegisterDecodeCompleteCallback(&decoded[i]);
+			if (decoders.back()->InitDecode(&settings, 1) != WEBRTC_VIDEO_CODEC_OK)
+			{
+				fprintf(stderr, "InitDecode failed for %dx%d\n", w, h);
+				return false;
+			}
+		}
+
+		const bool barcode = c.width >= 160 && c.height >= 100;
+		Native::YuvFrameGenerator generator(c.width, c.height, barcode);
+		rtc::scoped_refptr<webrtc::I420Buffer> input = webrtc::I420Buffer::Create(c.width, c.height);
+
+		std::vector<double> encode_ms;
+		std::vector<double> decode_ms;
+		int64_t encode_ns = 0;
+		int64_t decode_ns = 0;
+		int dropped = 0;
+
+		for (int n = 0; n < c.frames; n++)
+		{
+			generator.GenerateNextFrame(input.get(), barcode ? n : -1);
+
+			const uint32_t rtp = static_cast<uint32_t>(static_cast<int64_t>(n) * kRtpTicksPerSecond / c.fps);
+			webrtc::VideoFrame frame(input, rtp, 0, webrtc::kVideoRotation_0);
+
+			std::vector<webrtc::FrameType> types(c.streams, n == 0 ? webrtc::kVideoFrameKey : webrtc::kVideoFrameDelta);
+
+			int64_t t0 = rtc::TimeNanos();
+			encoder.Encode(frame, nullptr, &types);
+			int64_t t1 = rtc::TimeNanos();
+
+			encode_ns += t1 - t0;
+			encode_ms.push_back((t1 - t0) / 1e6);
+
+			if (encoded.frames.empty())
+			{
+				dropped++;
+				continue;
+			}
+
+			for (int i = 0; i < c.streams; i++)
+			{
+				if (c.streams > 1)
+				{
+					decoded[i].reference->ScaleFrom(*input);
+				}
+				else
+				{
+					decoded[i].reference = input;
+				}
+			}
+
+			t0 = rtc::TimeNanos();
+			for (auto & e : encoded.frames)
+			{
+				StreamResult & r = results[e->stream];
+				r.bytes += e->image._length;
+				r.frames++;
+				if (e->image._frameType == webrtc::kVideoFrameKey)
+				{
+					r.key_frames++;
+				}
+				decoders[e->stream]->Decode(e->image, false, nullptr, nullptr, 0);
+			}
+			t1 = rtc::TimeNanos();
+
+			decode_ns += t1 - t0;
+			decode_ms.push_back((t1 - t0) / 1e6);
+			encoded.frames.clear();
+
+			for (auto & d : decoded)
+			{
+				d.Measure();
+			}
+		}
+
+		for (auto & d : decoders)
+		{
+			d->Release();
+		}
+		encoder.Release();
+
+		Print(c, results, encode_ns / 1e9, decode_ns / 1e9, dropped, encode_ms, decode_ms);
+		return true;
+	}
+
+	static std::vector<std::string> Split(const std::string & s, char separator)
+	{
+		std::vector<std::string> items;
+		size_t start = 0;
+		while (start <= s.size())
+		{
+			size_t end = s.find(separator, start);
+			if (end == std::string::npos)
+			{
+				end = s.size();
+			}
+			if (end > start)
+			{
+				items.push_back(s.substr(start, end - start));
+			}
+			start = end + 1;
+		}
+		return items;
+	}
+
+	static std::vector<int> IntList(int argc, char * argv[], const char * name, const char * def)
+	{
+		std::vector<int> values;
+		for (const std::string & s : Split(StringArg(argc, argv, name, def), ','))
+		{
+			values.push_back(atoi(s.c_str()));
+		}
+		return values;
+	}
+
+	int RunCodec(int argc, char * argv[])
+	{
+		std::vector<std::pair<int, int>> resolutions;
+		for (const std::string & r : Split(StringArg(argc, argv, "--resolutions", "320x180,640x360,1280x720,1920x1080"), ','))
+		{
+			int w = 0, h = 0;
+			if (sscanf(r.c_str(), "%dx%d", &w, &h) != 2 || w < 2 || h < 2)
+			{
+				fprintf(stderr, "invalid resolution %s\n", r.c_str());
+				return 1;
+			}
+			resolutions.push_back(std::make_pair(w, h));
+		}
+
+		const std::vector<int> simulcast = IntList(argc, argv, "--simulcast", "1,3");
+		const std::vector<int> complexity = IntList(argc, argv, "--complexity", "0,2");
+		const std::vector<int> cores = IntList(argc, argv, "--cores", "1,4");
+
+		CodecConfig c;
+		c.fps = IntArg(argc, argv, "--fps", 30);
+		c.frames = IntArg(argc, argv, "--frames", 300);
+		c.bitrate_kbps = IntArg(argc, argv, "--bitrate", 0);
+
+		if (c.fps < 1 || c.frames < 1)
+		{
+			fprintf(stderr, "invalid arguments\n");
+			return 1;
+		}
+
+		bool ok = true;
+		for (const auto & r : resolutions)
+		{
+			for (int streams : simulcast)
+			{
+				// every layer has to keep the aspect ratio exactly
+				const int shift = streams - 1;
+				if (streams < 1 || streams > webrtc::kMaxSimulcastStreams ||
+					(r.first >> shift) << shift != r.first || (r.second >> shift) << shift != r.second)
+				{
+					continue;
+				}
+				for (int cx : complexity)
+				{
+					for (int n : cores)
+					{
+						c.width = r.first;
+						c.height = r.second;
+						c.streams = streams;
+						c.complexity = std::min(std::max(cx, 0), static_cast<int>(webrtc::kComplexityMax));
+						c.cores = std::max(n, 1);
+
+						ok &= RunCodecConfig(c);
+					}
+				}
+			}
+		}
+		return ok ? 0 : 1;
+	}
+}
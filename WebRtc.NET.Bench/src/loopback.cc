@@ -0,0 +1,408 @@
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <memory>
+
+#include "defaults.h"
+#include "conductor.h"
+#include "trace.h"
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/logging.h"
+#include "webrtc/base/refcount.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/system_wrappers/include/clock.h"
+
+namespace Bench
+{
+	struct LoopbackOptions
+	{
+		int pairs;
+		int width;
+		int height;
+		int fps;
+		int duration;
+		int interval;
+		std::string trace;
+	};
+
+	// Keeps the counters of the last completed legacy GetStats call.
+	class StatsCallback : public webrtc::StatsObserver
+	{
+	public:
+		StatsCallback() : pending(false), frames_encoded(0), frames_decoded(0)
+		{
+		}
+
+		virtual void OnComplete(const webrtc::StatsReports & reports) override
+		{
+			int64_t encoded = 0;
+			int64_t decoded = 0;
+			for (const webrtc::StatsReport * r : reports)
+			{
+				if (r->type() == webrtc::StatsReport::kStatsReportTypeSsrc)
+				{
+					encoded += Value(r, webrtc::StatsReport::kStatsValueNameFramesEncoded);
+					decoded += Value(r, webrtc::StatsReport::kStatsValueNameFramesDecoded);
+				}
+			}
+			frames_encoded = encoded;
+			frames_decoded = decoded;
+			pending = false;
+		}
+
+		bool pending;
+		int64_t frames_encoded;
+		int64_t frames_decoded;
+
+	private:
+
+		static int64_t Value(const webrtc::StatsReport * r, webrtc::StatsReport::StatsValueName name)
+		{
+			const webrtc::StatsReport::Value * v = r->FindValue(name);
+			return v ? _atoi64(v->ToString().c_str()) : 0;
+		}
+	};
+
+	// One side of a loopback pair, signaling goes straight to |remote_|.
+	class Peer : public Native::Conductor,
+		public rtc::VideoSinkInterface<webrtc::VideoFrame>
+	{
+	public:
+		Peer(const LoopbackOptions & o) :
+			remote_(nullptr),
+			frames_rendered_(0)
+		{
+			width_ = o.width;
+			height_ = o.height;
+			caputureFps = o.fps;
+			barcodeEnabled = true;
+			loopbackEnabled = true;
+
+			stats_ = new rtc::RefCountedObject<StatsCallback>();
+		}
+
+		virtual ~Peer()
+		{
+			if (remote_track_)
+			{
+				remote_track_->RemoveSink(this);
+				remote_track_ = nullptr;
+			}
+		}
+
+		void Connect(Peer * remote)
+		{
+			remote_ = remote;
+		}
+
+		void RequestStats()
+		{
+			if (!stats_->pending)
+			{
+				stats_->pending = GetStats(stats_);
+			}
+		}
+
+		const StatsCallback & Stats() const
+		{
+			return *stats_;
+		}
+
+		// frames rendered so far, latency samples since the last call
+		int64_t TakeRendered(std::vector<double> & latency_ms)
+		{
+			rtc::CritScope lock(&crit_);
+			latency_ms.insert(latency_ms.end(), latency_ms_.begin(), latency_ms_.end());
+			latency_ms_.clear();
+			return frames_rendered_;
+		}
+
+		// VideoSinkInterface implementation
+		virtual void OnFrame(const webrtc::VideoFrame & frame) override
+		{
+			// Sender and receiver share the clock, so the NTP capture time
+			// recovered from RTCP gives the end-to-end latency directly.
+			int64_t latency = -1;
+			if (frame.ntp_time_ms() > 0)
+			{
+				latency = webrtc::Clock::GetRealTimeClock()->CurrentNtpInMilliseconds() - frame.ntp_time_ms();
+			}
+
+			rtc::CritScope lock(&crit_);
+			frames_rendered_++;
+			if (latency >= 0)
+			{
+				latency_ms_.push_back(static_cast<double>(latency));
+			}
+		}
+
+	protected:
+
+		virtual void OnSuccess(webrtc::SessionDescriptionInterface * desc) override
+		{
+			Conductor::OnSuccess(desc);
+
+			std::string sdp;
+			desc->ToString(&sdp);
+
+			if (desc->type() == webrtc::SessionDescriptionInterface::kOffer)
+			{
+				remote_->OnOfferRequest(sdp);
+			}
+			else
+			{
+				remote_->OnOfferReply(desc->type(), sdp);
+			}
+			remote_->FlushCandidates();
+		}
+
+		virtual void OnIceCandidate(const webrtc::IceCandidateInterface * candidate) override
+		{
+			std::string sdp;
+			if (!candidate->ToString(&sdp))
+				return;
+
+			remote_->pending_candidates_.push_back(Candidate(candidate->sdp_mid(), candidate->sdp_mline_index(), sdp));
+			remote_->FlushCandidates();
+		}
+
+		virtual void OnAddStream(rtc::scoped_refptr<webrtc::MediaStreamInterface> stream) override
+		{
+			Conductor::OnAddStream(stream);
+
+			webrtc::VideoTrackVector tracks = stream->GetVideoTracks();
+			if (!tracks.empty())
+			{
+				remote_track_ = tracks[0];
+				remote_track_->AddOrUpdateSink(this, rtc::VideoSinkWants());
+			}
+		}
+
+	private:
+
+		struct Candidate
+		{
+			Candidate(const std::string & mid, int index, const std::string & sdp) :
+				mid(mid), index(index), sdp(sdp)
+			{
+			}
+			std::string mid;
+			int index;
+			std::string sdp;
+		};
+
+		// candidates are only accepted once the remote description is set
+		void FlushCandidates()
+		{
+			while (!pending_candidates_.empty())
+			{
+				const Candidate & c = pending_candidates_.front();
+				if (!AddIceCandidate(c.mid, c.index, c.sdp))
+					break;
+
+				pending_candidates_.erase(pending_candidates_.begin());
+			}
+		}
+
+		Peer * remote_;
+		std::vector<Candidate> pending_candidates_;
+		rtc::scoped_refptr<StatsCallback> stats_;
+		rtc::scoped_refptr<webrtc::VideoTrackInterface> remote_track_;
+
+		rtc::CriticalSection crit_;
+		int64_t frames_rendered_;
+		std::vector<double> latency_ms_;
+	};
+
+	// totals over all pairs at one point in time
+	struct LoopbackSample
+	{
+		ProcessSample process;
+		int64_t frames_encoded;
+		int64_t frames_decoded;
+		int64_t frames_rendered;
+		int connected;
+		std::vector<double> latency_ms;
+	};
+
+	static LoopbackSample Sample(std::vector<std::unique_ptr<Peer>> & senders, std::vector<std::unique_ptr<Peer>> & receivers)
+	{
+		LoopbackSample s;
+		s.frames_encoded = 0;
+		s.frames_decoded = 0;
+		s.frames_rendered = 0;
+		s.connected = 0;
+
+		for (auto & p : senders)
+		{
+			s.frames_encoded += p->Stats().frames_encoded;
+			p->RequestStats();
+		}
+		for (auto & p : receivers)
+		{
+			s.frames_decoded += p->Stats().frames_decoded;
+			p->RequestStats();
+
+			int64_t rendered = p->TakeRendered(s.latency_ms);
+			s.frames_rendered += rendered;
+			if (rendered > 0)
+			{
+				s.connected++;
+			}
+		}
+		s.process = SampleProcess();
+		return s;
+	}
+
+	static void Report(const char * type, const LoopbackOptions & o, const ProcessSample & base,
+					   const LoopbackSample & from, const LoopbackSample & to, std::vector<double> & latency_ms)
+	{
+		const double seconds = (to.process.wall_us - from.process.wall_us) / 1e6;
+		const double streams = o.pairs;
+		const double cpu = 100.0 * (to.process.cpu_us - from.process.cpu_us) / (to.process.wall_us - from.process.wall_us);
+
+		printf("{\"type\":\"%s\",\"elapsed_s\":%.2f,\"pairs\":%d,\"connected\":%d,\"width\":%d,\"height\":%d,\"fps\":%d,"
+			   "\"encode_fps\":%.2f,\"decode_fps\":%.2f,\"render_fps\":%.2f,"
+			   "\"latency_ms_p50\":%.1f,\"latency_ms_p99\":%.1f,\"latency_samples\":%u,"
+			   "\"cpu_percent\":%.1f,\"cpu_percent_per_stream\":%.2f,"
+			   "\"memory_kb_per_connection\":%.0f,\"threads\":%d,\"threads_per_connection\":%.2f}\n",
+			   type,
+			   (to.process.wall_us - base.wall_us) / 1e6,
+			   o.pairs,
+			   to.connected,
+			   o.width,
+			   o.height,
+			   o.fps,
+			   (to.frames_encoded - from.frames_encoded) / seconds / streams,
+			   (to.frames_decoded - from.frames_decoded) / seconds / streams,
+			   (to.frames_rendered - from.frames_rendered) / seconds / streams,
+			   Percentile(latency_ms, 50),
+			   Percentile(latency_ms, 99),
+			   static_cast<unsigned>(latency_ms.size()),
+			   cpu,
+			   cpu / streams,
+			   (to.process.private_bytes - base.private_bytes) / 1024.0 / streams,
+			   to.process.threads,
+			   (to.process.threads - base.threads) / streams);
+		fflush(stdout);
+	}
+
+	int RunLoopback(int argc, char * argv[])
+	{
+		LoopbackOptions o;
+		o.pairs = IntArg(argc, argv, "--pairs", 1);
+		o.width = IntArg(argc, argv, "--width", 640);
+		o.height = IntArg(argc, argv, "--height", 360);
+		o.fps = IntArg(argc, argv, "--fps", 30);
+		o.duration = IntArg(argc, argv, "--duration", 30);
+		o.interval = IntArg(argc, argv, "--interval", 5);
+		o.trace = StringArg(argc, argv, "--trace", "");
+
+		if (o.pairs < 1 || o.fps < 1 || o.interval < 1)
+		{
+			fprintf(stderr, "invalid arguments\n");
+			return 1;
+		}
+
+		Native::TraceEnable(!o.trace.empty());
+
+		const ProcessSample base = SampleProcess();
+
+		std::vector<std::unique_ptr<Peer>> senders;
+		std::vector<std::unique_ptr<Peer>> receivers;
+		for (int i = 0; i < o.pairs; i++)
+		{
+			std::unique_ptr<Peer> s(new Peer(o));
+			std::unique_ptr<Peer> r(new Peer(o));
+			s->Connect(r.get());
+			r->Connect(s.get());
+
+			if (!s->InitializePeerConnection() || !r->InitializePeerConnection())
+			{
+				fprintf(stderr, "failed to initialize pair %d\n", i);
+				return 1;
+			}
+			s->CreateOffer();
+
+			senders.push_back(std::move(s));
+			receivers.push_back(std::move(r));
+		}
+
+		// Senders run on this thread, which is also the signaling thread of
+		// every Conductor, so frames are pushed between message batches.
+		const int64_t frame_interval_us = rtc::kNumMicrosecsPerSec / o.fps;
+		const int64_t report_interval_us = o.interval * rtc::kNumMicrosecsPerSec;
+		const int64_t start_us = rtc::TimeMicros();
+		const int64_t end_us = start_us + o.duration * rtc::kNumMicrosecsPerSec;
+
+		int64_t next_frame_us = start_us;
+		int64_t next_report_us = start_us + report_interval_us;
+
+		LoopbackSample last = Sample(senders, receivers);
+		LoopbackSample first = last;
+		std::vector<double> run_latency_ms;
+		bool warm = false;
+
+		for (int64_t now = rtc::TimeMicros(); now < end_us; now = rtc::TimeMicros())
+		{
+			if (now >= next_frame_us)
+			{
+				for (auto & s : senders)
+				{
+					s->PushFrame();
+				}
+				next_frame_us += frame_interval_us;
+				if (next_frame_us < now)
+				{
+					// can't keep up, don't burst
+					next_frame_us = now + frame_interval_us;
+				}
+			}
+
+			if (now >= next_report_us)
+			{
+				LoopbackSample s = Sample(senders, receivers);
+				std::vector<double> latency_ms = s.latency_ms;
+				Report("interval", o, base, last, s, latency_ms);
+
+				// the first interval covers connection setup, keep it out of the summary
+				if (warm)
+				{
+					run_latency_ms.insert(run_latency_ms.end(), s.latency_ms.begin(), s.latency_ms.end());
+				}
+				else
+				{
+					first = s;
+					warm = true;
+				}
+				last = s;
+				next_report_us += report_interval_us;
+			}
+
+			int64_t wait_us = std::min(next_frame_us, next_report_us) - rtc::TimeMicros();
+			senders[0]->ProcessMessages(static_cast<int>(std::max<int64_t>(wait_us / rtc::kNumMicrosecsPerMillisec, 0)));
+		}
+
+		if (warm && last.process.wall_us > first.process.wall_us)
+		{
+			Report("summary", o, base, first, last, run_latency_ms);
+		}
+
+		if (!o.trace.empty())
+		{
+			Native::TraceEnable(false);
+			if (!Native::TraceDumpFile(o.trace))
+			{
+				fprintf(stderr, "failed to write %s\n", o.trace.c_str());
+			}
+		}
+
+		receivers.clear();
+		senders.clear();
+		return 0;
+	}
+}
@@ -57,7 +57,7 @@ namespace WebRtc.NET.Demo
 
         byte[] bgrBuffremote;
         Bitmap remoteImg;
-        public unsafe void OnRenderRemote(byte* yuv, uint w, uint h)
+        public unsafe void OnRenderRemote(byte* yuv, uint w, uint h, long renderTimeMs, long ntpTimeMs)
         {
             lock (pictureBoxRemote)
             {
@@ -100,7 +100,7 @@ namespace WebRtc.NET.Demo
         readonly TurboJpegEncoder encoderLocal = TurboJpegEncoder.CreateEncoder();
         byte[] bgrBufflocal;
         Bitmap localImg;
-        public unsafe void OnRenderLocal(byte* yuv, uint w, uint h)
+        public unsafe void OnRenderLocal(byte* yuv, uint w, uint h, long renderTimeMs, long ntpTimeMs)
         {
             lock (pictureBoxLocal)
             {
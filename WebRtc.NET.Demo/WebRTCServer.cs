@@ -276,14 +276,14 @@ namespace WebRtc.NET.Demo
 
                                         unsafe
                                         {
-                                            session.WebRtc.OnRenderRemote += delegate (byte* frame_buffer, uint w, uint h)
+                                            session.WebRtc.OnRenderRemote += delegate (byte* frame_buffer, uint w, uint h, long renderTimeMs, long ntpTimeMs)
                                             {
-                                                OnRenderRemote(frame_buffer, w, h);
+                                                OnRenderRemote(frame_buffer, w, h, renderTimeMs, ntpTimeMs);
                                             };
 
-                                            session.WebRtc.OnRenderLocal += delegate (byte* frame_buffer, uint w, uint h)
+                                            session.WebRtc.OnRenderLocal += delegate (byte* frame_buffer, uint w, uint h, long renderTimeMs, long ntpTimeMs)
                                             {
-                                                OnRenderLocal(frame_buffer, w, h);
+                                                OnRenderLocal(frame_buffer, w, h, renderTimeMs, ntpTimeMs);
                                             };
                                         }
 
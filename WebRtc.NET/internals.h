@@ -14,6 +14,7 @@ namespace Internal
 
 namespace Native
 {
+	// default of VideoEncoding::quality_scaler
 	extern bool CFG_quality_scaler_enabled_;
 
 	void InitializeSSL();
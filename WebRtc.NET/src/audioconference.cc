@@ -0,0 +1,367 @@
+
+#include "defaults.h"
+#include "conductor.h"
+#include "audioconference.h"
+
+#include <algorithm>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/base/safe_conversions.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/typedefs.h"
+
+#if defined(WEBRTC_ARCH_X86_FAMILY)
+#include <emmintrin.h>
+#endif
+
+namespace Native
+{
+	namespace
+	{
+		// smoothing of the speech level per 10 ms, about 100 ms to settle
+		const float kLevelDecay = 0.8f;
+
+		// mean square of about -50 dBFS, quieter is never mixed
+		const float kSilenceLevel = 100.0f * 100.0f;
+
+		// whoever is mixed wins ties by 3 dB, the set doesn't flap
+		const float kMixedBonus = 2.0f;
+
+		// suspended or starved, start over instead of bursting to catch up
+		const int64_t kMaxLagMs = 100;
+
+		float Energy(const int16_t * x, size_t n)
+		{
+			int64_t e = 0;
+			for (size_t i = 0; i < n; ++i)
+			{
+				e += x[i] * x[i];
+			}
+			return n ? static_cast<float>(e) / n : 0.0f;
+		}
+
+		// in place, from gain |from| to |to| over the frame
+		void Ramp(int16_t * x, size_t n, float from, float to)
+		{
+			const float step = (to - from) / n;
+			for (size_t i = 0; i < n; ++i)
+			{
+				x[i] = static_cast<int16_t>(x[i] * (from + step * (i + 1)));
+			}
+		}
+
+		// sum += x
+		void Accumulate(int32_t * sum, const int16_t * x, size_t n)
+		{
+			size_t i = 0;
+#if defined(WEBRTC_ARCH_X86_FAMILY)
+			for (; i + 8 <= n; i += 8)
+			{
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+				__m128i * s = reinterpret_cast<__m128i*>(sum + i);
+				_mm_storeu_si128(s, _mm_add_epi32(_mm_loadu_si128(s), _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)));
+				_mm_storeu_si128(s + 1, _mm_add_epi32(_mm_loadu_si128(s + 1), _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)));
+			}
+#endif
+			for (; i < n; ++i)
+			{
+				sum[i] += x[i];
+			}
+		}
+
+		// out = saturated sum - own, |own| null when not mixed
+		void MinusOne(const int32_t * sum, const int16_t * own, int16_t * out, size_t n)
+		{
+			size_t i = 0;
+#if defined(WEBRTC_ARCH_X86_FAMILY)
+			for (; i + 8 <= n; i += 8)
+			{
+				__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + i));
+				__m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + i + 4));
+				if (own)
+				{
+					const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(own + i));
+					lo = _mm_sub_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+					hi = _mm_sub_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+				}
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(lo, hi));
+			}
+#endif
+			for (; i < n; ++i)
+			{
+				out[i] = rtc::saturated_cast<int16_t>(sum[i] - (own ? own[i] : 0));
+			}
+		}
+	}
+
+	// Sink on one remote audio track, the audio thread of its Conductor
+	// writes, the mixer thread reads.
+	class AudioConference::Participant : public webrtc::AudioTrackSinkInterface
+	{
+	public:
+		Participant(int id, Conductor * con, int sample_rate, size_t frame_samples) :
+			id(id),
+			con(con),
+			frame(frame_samples),
+			level(0),
+			gain(0),
+			mixed(false),
+			sample_rate_(sample_rate),
+			ring_(2 * sample_rate * kMaxQueueMs / 1000)
+		{
+		}
+
+		void OnData(const void * audio_data,
+					int bits_per_sample,
+					int sample_rate,
+					size_t number_of_channels,
+					size_t number_of_frames) override
+		{
+			if (bits_per_sample != 16 || number_of_channels == 0)
+				return;
+
+			const int16_t * in = static_cast<const int16_t*>(audio_data);
+			if (number_of_channels > 1)
+			{
+				mono_.resize(number_of_frames);
+				for (size_t i = 0; i < number_of_frames; ++i)
+				{
+					int sum = 0;
+					for (size_t c = 0; c < number_of_channels; ++c)
+					{
+						sum += in[i * number_of_channels + c];
+					}
+					mono_[i] = static_cast<int16_t>(sum / static_cast<int>(number_of_channels));
+				}
+				in = mono_.data();
+			}
+
+			if (sample_rate != sample_rate_)
+			{
+				// PushResampler takes exactly 10 ms
+				if (number_of_frames * 100 != static_cast<size_t>(sample_rate) ||
+					resampler_.InitializeIfNeeded(sample_rate, sample_rate_, 1) != 0)
+					return;
+
+				resampled_.resize(frame.size());
+				const int n = resampler_.Resample(in, number_of_frames, resampled_.data(), resampled_.size());
+				if (n < 0)
+					return;
+
+				in = resampled_.data();
+				number_of_frames = n;
+			}
+			ring_.Write(in, number_of_frames);
+		}
+
+		// mixer thread, false when no whole frame is queued
+		bool Read()
+		{
+			const size_t n = frame.size();
+			while (ring_.Available() > static_cast<size_t>(sample_rate_ * kMaxQueueMs / 1000) + n)
+			{
+				ring_.Read(frame.data(), n);
+			}
+
+			if (ring_.Available() < n)
+				return false;
+
+			ring_.Read(frame.data(), n);
+			return true;
+		}
+
+		const int id;
+		Conductor * const con;
+
+		// mixer thread
+		std::vector<int16_t> frame;
+		float level;
+		float gain;
+		bool mixed;
+
+	private:
+		const int sample_rate_;
+		SampleRing ring_;
+
+		// audio thread
+		webrtc::PushResampler<int16_t> resampler_;
+		std::vector<int16_t> mono_;
+		std::vector<int16_t> resampled_;
+	};
+
+	AudioConference::AudioConference(int sample_rate, int speakers) :
+		sample_rate_(sample_rate),
+		frame_samples_(sample_rate * kFrameMs / 1000),
+		speakers_(std::max(speakers, 1)),
+		thread_(&AudioConference::Run, this, "audio_conference"),
+		stop_(true, false),
+		next_tick_ms_(0),
+		next_id_(1),
+		sum_(frame_samples_),
+		out_(2 * frame_samples_)
+	{
+	}
+
+	AudioConference::~AudioConference()
+	{
+		Stop();
+
+		for (auto & it : participants_)
+		{
+			it.second->con->RemoveRemoteAudioSink(it.second.get());
+		}
+	}
+
+	bool AudioConference::Start()
+	{
+		if (thread_.IsRunning())
+			return true;
+
+		stop_.Reset();
+		next_tick_ms_ = rtc::TimeMillis();
+		thread_.Start();
+		if (!thread_.SetPriority(rtc::kRealtimePriority))
+		{
+			LOG(LS_WARNING) << "AudioConference runs without real-time priority";
+		}
+		return true;
+	}
+
+	void AudioConference::Stop()
+	{
+		if (!thread_.IsRunning())
+			return;
+
+		stop_.Set();
+		thread_.Stop();
+	}
+
+	int AudioConference::Join(Conductor * con)
+	{
+		if (con->PushAudioRate() != sample_rate_ || con->PushAudioChannels() > 2)
+		{
+			LOG(LS_ERROR) << "AudioConference needs push audio at " << sample_rate_ << " Hz";
+			return -1;
+		}
+
+		Participant * p;
+		int id;
+		{
+			rtc::CritScope lock(&crit_);
+			id = next_id_++;
+			p = new Participant(id, con, sample_rate_, frame_samples_);
+			participants_[id].reset(p);
+		}
+		con->AddRemoteAudioSink(p);
+		return id;
+	}
+
+	void AudioConference::Leave(int participant)
+	{
+		std::unique_ptr<Participant> p;
+		{
+			rtc::CritScope lock(&crit_);
+			auto it = participants_.find(participant);
+			if (it == participants_.end())
+				return;
+
+			p = std::move(it->second);
+			participants_.erase(it);
+		}
+
+		// no OnData once this returns
+		p->con->RemoveRemoteAudioSink(p.get());
+	}
+
+	std::vector<int> AudioConference::Speakers()
+	{
+		rtc::CritScope lock(&crit_);
+		return speaking_;
+	}
+
+	bool AudioConference::Run(void * obj)
+	{
+		AudioConference * self = static_cast<AudioConference*>(obj);
+
+		const int64_t wait = self->next_tick_ms_ - rtc::TimeMillis();
+		if (wait > 0 && self->stop_.Wait(static_cast<int>(wait)))
+			return false;
+
+		if (-wait > kMaxLagMs)
+		{
+			self->next_tick_ms_ = rtc::TimeMillis();
+		}
+		self->next_tick_ms_ += kFrameMs;
+
+		self->Mix();
+		return !self->stop_.Wait(0);
+	}
+
+	void AudioConference::Mix()
+	{
+		rtc::CritScope lock(&crit_);
+
+		active_.clear();
+		for (auto & it : participants_)
+		{
+			Participant * p = it.second.get();
+			if (p->Read())
+			{
+				p->level = kLevelDecay * p->level + (1.0f - kLevelDecay) * Energy(p->frame.data(), frame_samples_);
+			}
+			else
+			{
+				std::fill(p->frame.begin(), p->frame.end(), 0);
+				p->level *= kLevelDecay;
+			}
+			active_.push_back(p);
+		}
+
+		const size_t n = std::min(speakers_, active_.size());
+		std::partial_sort(active_.begin(), active_.begin() + n, active_.end(), [](const Participant * a, const Participant * b)
+		{
+			return a->level * (a->mixed ? kMixedBonus : 1.0f) > b->level * (b->mixed ? kMixedBonus : 1.0f);
+		});
+
+		// the loudest once, ramped in and out over a frame
+		std::fill(sum_.begin(), sum_.end(), 0);
+		speaking_.clear();
+		for (size_t i = 0; i < active_.size(); ++i)
+		{
+			Participant * p = active_[i];
+			const float target = (i < n && p->level > kSilenceLevel) ? 1.0f : 0.0f;
+			if (target != p->gain)
+			{
+				Ramp(p->frame.data(), frame_samples_, p->gain, target);
+			}
+
+			// what was added is subtracted again below
+			const bool added = target > 0 || p->gain > 0;
+			p->gain = target;
+			p->mixed = added;
+			if (added)
+			{
+				Accumulate(sum_.data(), p->frame.data(), frame_samples_);
+			}
+			if (target > 0)
+			{
+				speaking_.push_back(p->id);
+			}
+		}
+
+		for (Participant * p : active_)
+		{
+			MinusOne(sum_.data(), p->mixed ? p->frame.data() : nullptr, out_.data(), frame_samples_);
+			p->mixed = p->gain > 0;
+
+			if (p->con->PushAudioChannels() == 2)
+			{
+				for (size_t i = frame_samples_; i-- > 0;)
+				{
+					out_[2 * i] = out_[2 * i + 1] = out_[i];
+				}
+			}
+			p->con->PushAudio(out_.data(), frame_samples_);
+		}
+	}
+}
@@ -0,0 +1,81 @@
+
+#ifndef WEBRTC_NET_AUDIOCONFERENCE_H_
+#define WEBRTC_NET_AUDIOCONFERENCE_H_
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/event.h"
+#include "webrtc/base/platform_thread.h"
+
+namespace Native
+{
+	class Conductor;
+
+	// Mixes the remote audio of many Conductors into minus-one feeds: each
+	// participant hears the loudest |speakers| of the others, pushed as its
+	// outgoing audio through PushAudio. The remote tracks queue mono frames
+	// in a SampleRing each and one real-time thread does the rest every
+	// 10 ms, the loudest are summed once and every feed is that sum minus
+	// the participant's own voice, so a room costs O(N) and no thread per
+	// session.
+	class AudioConference
+	{
+	public:
+		// |speakers| mixed at most, mono at |sample_rate|
+		AudioConference(int sample_rate, int speakers);
+		~AudioConference();
+
+		bool Start();
+		void Stop();
+
+		// |con| needs EnablePushAudio at |sample_rate| and must not PushAudio
+		// itself; on its signaling thread. Returns the participant, -1 when
+		// the formats don't match.
+		int Join(Conductor * con);
+
+		// before |con| is deleted, on its signaling thread
+		void Leave(int participant);
+
+		// participants mixed in the last 10 ms
+		std::vector<int> Speakers();
+
+		int sample_rate() const
+		{
+			return sample_rate_;
+		}
+
+		static const int kFrameMs = 10;
+
+		// input queued beyond this is dropped, keeps the delay bounded
+		static const int kMaxQueueMs = 60;
+
+	private:
+		class Participant;
+
+		static bool Run(void * obj);
+		void Mix();
+
+		const int sample_rate_;
+		const size_t frame_samples_;
+		const size_t speakers_;
+
+		rtc::PlatformThread thread_;
+		rtc::Event stop_;
+		int64_t next_tick_ms_;
+
+		rtc::CriticalSection crit_;
+		std::map<int, std::unique_ptr<Participant>> participants_;
+		int next_id_;
+
+		// mixer thread
+		std::vector<Participant*> active_;
+		std::vector<int32_t> sum_;
+		std::vector<int16_t> out_;
+		std::vector<int> speaking_;
+	};
+}
+#endif  // WEBRTC_NET_AUDIOCONFERENCE_H_
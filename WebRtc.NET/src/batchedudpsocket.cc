@@ -0,0 +1,326 @@
+
+#include "batchedudpsocket.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/base/timeutils.h"
+
+#if defined(WEBRTC_POSIX)
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace Native
+{
+	BatchedUdpSocket * BatchedUdpSocket::Create(rtc::Thread * thread, const rtc::SocketAddress & addr, bool share)
+	{
+		SOCKET s = ::socket(addr.family(), SOCK_DGRAM, IPPROTO_UDP);
+		if (s == INVALID_SOCKET)
+			return nullptr;
+
+		int on = 1;
+		if (share)
+		{
+#if defined(WEBRTC_WIN)
+			// nothing spreads datagrams over sockets, one reader hands
+			// them out and the others send on its descriptor
+			setsockopt(s, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, reinterpret_cast<const char*>(&on), sizeof(on));
+#else
+			setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+		}
+
+		sockaddr_storage saddr;
+		size_t len = addr.ToSockAddrStorage(&saddr);
+		if (::bind(s, reinterpret_cast<sockaddr*>(&saddr), static_cast<int>(len)) != 0)
+		{
+			LOG_ERR(LS_ERROR) << "bind " << addr.ToString();
+#if defined(WEBRTC_WIN)
+			closesocket(s);
+#else
+			close(s);
+#endif
+			return nullptr;
+		}
+
+		// the socket server still signals readability
+		rtc::PhysicalSocketServer * ss = static_cast<rtc::PhysicalSocketServer*>(thread->socketserver());
+		return new BatchedUdpSocket(ss->WrapSocket(s), s);
+	}
+
+	BatchedUdpSocket::BatchedUdpSocket(rtc::AsyncSocket * socket, SOCKET fd) :
+		rtc::AsyncUDPSocket(socket),
+		socket_(socket),
+		fd_(fd),
+		recv_buffer_(kBatch * kMaxPacket),
+		send_buffer_(kBatch * kMaxQueued),
+		queued_(0),
+		in_batch_(false),
+		counters_()
+	{
+		// replaces the one datagram per event reader of the base
+		socket_->SignalReadEvent.disconnect(this);
+		socket_->SignalReadEvent.connect(this, &BatchedUdpSocket::OnRead);
+	}
+
+	void BatchedUdpSocket::OnRead(rtc::AsyncSocket * socket)
+	{
+		// the first one through the wrapper, which rearms the read event
+		int64_t timestamp = -1;
+		int len = socket_->RecvFrom(RecvSlot(0), kMaxPacket, &recv_[0].addr, &timestamp);
+		if (len < 0)
+		{
+			// UDP errors are not fatal, ICMP unreachable on Windows for one
+			LOG(LS_VERBOSE) << "BatchedUdpSocket[" << GetLocalAddress().ToSensitiveString() << "] receive failed with error " << socket_->GetError();
+			return;
+		}
+		recv_[0].size = len;
+
+		const size_t count = Drain(1);
+		const rtc::PacketTime time(timestamp, 0);
+
+		counters_.packets_received += count;
+		for (size_t i = 0; i < count; ++i)
+		{
+			counters_.bytes_received += recv_[i].size;
+		}
+
+		in_batch_ = true;
+		for (size_t i = 0; i < count; ++i)
+		{
+			SignalReadPacket(this, RecvSlot(i), recv_[i].size, recv_[i].addr, time);
+		}
+		in_batch_ = false;
+
+		Flush();
+	}
+
+	// reads what is already queued in the socket into slots |first|..kBatch
+	size_t BatchedUdpSocket::Drain(size_t first)
+	{
+#if defined(WEBRTC_LINUX)
+		mmsghdr msgs[kBatch];
+		iovec iov[kBatch];
+		sockaddr_storage addrs[kBatch];
+
+		const size_t want = kBatch - first;
+		memset(msgs, 0, sizeof(mmsghdr) * want);
+		for (size_t i = 0; i < want; ++i)
+		{
+			iov[i].iov_base = RecvSlot(first + i);
+			iov[i].iov_len = kMaxPacket;
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		int n = recvmmsg(fd_, msgs, static_cast<unsigned int>(want), MSG_DONTWAIT, nullptr);
+		if (n <= 0)
+			return first;
+
+		for (int i = 0; i < n; ++i)
+		{
+			recv_[first + i].size = msgs[i].msg_len;
+			rtc::SocketAddressFromSockAddrStorage(addrs[i], &recv_[first + i].addr);
+		}
+		return first + n;
+#else
+		size_t n = first;
+		while (n < kBatch)
+		{
+			sockaddr_storage addr;
+			socklen_t addr_len = sizeof(addr);
+			int len = ::recvfrom(fd_, RecvSlot(n), static_cast<int>(kMaxPacket), 0, reinterpret_cast<sockaddr*>(&addr), &addr_len);
+			if (len < 0)
+				break;
+
+			recv_[n].size = len;
+			rtc::SocketAddressFromSockAddrStorage(addr, &recv_[n].addr);
+			++n;
+		}
+		return n;
+#endif
+	}
+
+	int BatchedUdpSocket::SendTo(const void * pv, size_t cb, const rtc::SocketAddress & addr, const rtc::PacketOptions & options)
+	{
+		if (!in_batch_ || cb > kMaxQueued)
+		{
+			// keeps the order
+			Flush();
+			int ret = AsyncUDPSocket::SendTo(pv, cb, addr, options);
+			if (ret < 0)
+			{
+				++counters_.drops;
+			}
+			else
+			{
+				++counters_.packets_sent;
+				counters_.bytes_sent += cb;
+			}
+			return ret;
+		}
+
+		if (queued_ == kBatch)
+		{
+			Flush();
+		}
+
+		Queued & q = send_[queued_];
+		memcpy(&send_buffer_[queued_ * kMaxQueued], pv, cb);
+		q.size = cb;
+		q.addr_len = static_cast<int>(addr.ToSockAddrStorage(&q.addr));
+		q.packet_id = options.packet_id;
+		++queued_;
+		return static_cast<int>(cb);
+	}
+
+	void BatchedUdpSocket::Flush()
+	{
+		if (queued_ == 0)
+			return;
+
+		size_t sent = 0;
+#if defined(WEBRTC_LINUX)
+		mmsghdr msgs[kBatch];
+		iovec iov[kBatch];
+
+		memset(msgs, 0, sizeof(mmsghdr) * queued_);
+		for (size_t i = 0; i < queued_; ++i)
+		{
+			iov[i].iov_base = &send_buffer_[i * kMaxQueued];
+			iov[i].iov_len = send_[i].size;
+			msgs[i].msg_hdr.msg_name = &send_[i].addr;
+			msgs[i].msg_hdr.msg_namelen = send_[i].addr_len;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		while (sent < queued_)
+		{
+			int n = sendmmsg(fd_, msgs + sent, static_cast<unsigned int>(queued_ - sent), 0);
+			if (n <= 0)
+				break;
+			for (int i = 0; i < n; ++i)
+			{
+				counters_.bytes_sent += send_[sent + i].size;
+			}
+			sent += n;
+		}
+#else
+		for (size_t i = 0; i < queued_; ++i)
+		{
+			int n = ::sendto(fd_, &send_buffer_[i * kMaxQueued], static_cast<int>(send_[i].size), 0,
+				reinterpret_cast<const sockaddr*>(&send_[i].addr), send_[i].addr_len);
+			if (n >= 0)
+			{
+				++sent;
+				counters_.bytes_sent += send_[i].size;
+			}
+		}
+#endif
+		counters_.packets_sent += sent;
+		counters_.drops += queued_ - sent;
+		if (sent < queued_)
+		{
+			LOG(LS_WARNING) << "BatchedUdpSocket[" << GetLocalAddress().ToSensitiveString() << "] dropped " << queued_ - sent << " datagrams";
+		}
+
+		const int64_t now = rtc::TimeMillis();
+		for (size_t i = 0; i < queued_; ++i)
+		{
+			SignalSentPacket(this, rtc::SentPacket(send_[i].packet_id, now));
+		}
+		queued_ = 0;
+	}
+
+	UdpSendSocket::UdpSendSocket(SOCKET fd, const rtc::SocketAddress & local) :
+		fd_(fd),
+		local_(local),
+		error_(0),
+		counters_()
+	{
+	}
+
+	rtc::SocketAddress UdpSendSocket::GetLocalAddress() const
+	{
+		return local_;
+	}
+
+	rtc::SocketAddress UdpSendSocket::GetRemoteAddress() const
+	{
+		return rtc::SocketAddress();
+	}
+
+	int UdpSendSocket::Send(const void * pv, size_t cb, const rtc::PacketOptions & options)
+	{
+		error_ = ENOTCONN;
+		return -1;
+	}
+
+	int UdpSendSocket::SendTo(const void * pv, size_t cb, const rtc::SocketAddress & addr, const rtc::PacketOptions & options)
+	{
+		sockaddr_storage saddr;
+		size_t len = addr.ToSockAddrStorage(&saddr);
+		int n = ::sendto(fd_, static_cast<const char*>(pv), static_cast<int>(cb), 0,
+			reinterpret_cast<const sockaddr*>(&saddr), static_cast<int>(len));
+		if (n < 0)
+		{
+#if defined(WEBRTC_WIN)
+			error_ = WSAGetLastError();
+#else
+			error_ = errno;
+#endif
+			++counters_.drops;
+			return n;
+		}
+
+		++counters_.packets_sent;
+		counters_.bytes_sent += cb;
+		SignalSentPacket(this, rtc::SentPacket(options.packet_id, rtc::TimeMillis()));
+		return n;
+	}
+
+	int UdpSendSocket::Close()
+	{
+		// the descriptor belongs to the reader
+		return 0;
+	}
+
+	rtc::AsyncPacketSocket::State UdpSendSocket::GetState() const
+	{
+		return STATE_BOUND;
+	}
+
+	int UdpSendSocket::GetOption(rtc::Socket::Option opt, int * value)
+	{
+		return -1;
+	}
+
+	int UdpSendSocket::SetOption(rtc::Socket::Option opt, int value)
+	{
+		return -1;
+	}
+
+	int UdpSendSocket::GetError() const
+	{
+		return error_;
+	}
+
+	void UdpSendSocket::SetError(int error)
+	{
+		error_ = error;
+	}
+
+	void BatchedUdpSocket::Counters::Add(const Counters & c)
+	{
+		packets_received += c.packets_received;
+		bytes_received += c.bytes_received;
+		packets_sent += c.packets_sent;
+		bytes_sent += c.bytes_sent;
+		drops += c.drops;
+	}
+}
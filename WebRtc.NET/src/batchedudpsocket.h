@@ -0,0 +1,135 @@
+
+#ifndef WEBRTC_NET_BATCHEDUDPSOCKET_H_
+#define WEBRTC_NET_BATCHEDUDPSOCKET_H_
+#pragma once
+
+#include <vector>
+
+#include "webrtc/base/asyncudpsocket.h"
+#include "webrtc/base/physicalsocketserver.h"
+#include "webrtc/base/thread.h"
+
+namespace Native
+{
+	// AsyncUDPSocket for the embedded servers. A read event drains up to
+	// kBatch datagrams into preallocated buffers (recvmmsg on Linux), and
+	// replies sent while they are dispatched are held and flushed together
+	// once the batch is done (sendmmsg on Linux). Elsewhere the batch is a
+	// recvfrom/sendto loop, which still takes one socket server wakeup per
+	// batch instead of one per datagram.
+	class BatchedUdpSocket : public rtc::AsyncUDPSocket
+	{
+	public:
+		// cumulative, read on the socket thread
+		struct Counters
+		{
+			uint64_t packets_received;
+			uint64_t bytes_received;
+			uint64_t packets_sent;
+			uint64_t bytes_sent;
+			uint64_t drops;
+
+			void Add(const Counters & c);
+		};
+
+		// |thread| must run a PhysicalSocketServer. |share| lets several
+		// sockets bind |addr| with SO_REUSEPORT, see TurnRelay; on Windows
+		// it binds exclusively instead and the other workers send through
+		// UdpSendSocket. nullptr on failure.
+		static BatchedUdpSocket * Create(rtc::Thread * thread, const rtc::SocketAddress & addr, bool share);
+
+		int SendTo(const void * pv, size_t cb, const rtc::SocketAddress & addr, const rtc::PacketOptions & options) override;
+
+		const Counters & counters() const
+		{
+			return counters_;
+		}
+
+		SOCKET fd() const
+		{
+			return fd_;
+		}
+
+		// datagrams per read event
+		static const size_t kBatch = 32;
+
+		// larger replies go out right away, after the queued ones
+		static const size_t kMaxQueued = 2048;
+
+	private:
+		BatchedUdpSocket(rtc::AsyncSocket * socket, SOCKET fd);
+
+		void OnRead(rtc::AsyncSocket * socket);
+		size_t Drain(size_t first);
+		void Flush();
+
+		char * RecvSlot(size_t i)
+		{
+			return &recv_buffer_[i * kMaxPacket];
+		}
+
+		static const size_t kMaxPacket = 64 * 1024;
+
+		struct Received
+		{
+			size_t size;
+			rtc::SocketAddress addr;
+		};
+
+		struct Queued
+		{
+			size_t size;
+			sockaddr_storage addr;
+			int addr_len;
+			int packet_id;
+		};
+
+		// owned by AsyncUDPSocket, |fd_| is its descriptor
+		rtc::AsyncSocket * socket_;
+		SOCKET fd_;
+
+		std::vector<char> recv_buffer_;
+		Received recv_[kBatch];
+
+		std::vector<char> send_buffer_;
+		Queued send_[kBatch];
+		size_t queued_;
+		bool in_batch_;
+
+		Counters counters_;
+	};
+
+	// Send only socket on the descriptor of a BatchedUdpSocket that is
+	// read on another thread. Every send is a plain sendto, which is safe
+	// next to the reader's; the descriptor must outlive this socket.
+	class UdpSendSocket : public rtc::AsyncPacketSocket
+	{
+	public:
+		UdpSendSocket(SOCKET fd, const rtc::SocketAddress & local);
+
+		rtc::SocketAddress GetLocalAddress() const override;
+		rtc::SocketAddress GetRemoteAddress() const override;
+		int Send(const void * pv, size_t cb, const rtc::PacketOptions & options) override;
+		int SendTo(const void * pv, size_t cb, const rtc::SocketAddress & addr, const rtc::PacketOptions & options) override;
+		int Close() override;
+		State GetState() const override;
+		int GetOption(rtc::Socket::Option opt, int * value) override;
+		int SetOption(rtc::Socket::Option opt, int value) override;
+		int GetError() const override;
+		void SetError(int error) override;
+
+		// no receive side
+		const BatchedUdpSocket::Counters & counters() const
+		{
+			return counters_;
+		}
+
+	private:
+		SOCKET fd_;
+		rtc::SocketAddress local_;
+		int error_;
+
+		BatchedUdpSocket::Counters counters_;
+	};
+}
+#endif  // WEBRTC_NET_BATCHEDUDPSOCKET_H_
@@ -2,11 +2,14 @@
 #include "defaults.h"
 #include "conductor.h"
 
+#include <algorithm>
+
 #include "webrtc/api/test/fakeconstraints.h"
 #include "webrtc/video_encoder.h"
 #include "webrtc/modules/video_coding/codecs/vp8/simulcast_encoder_adapter.h"
 #include "webrtc/modules/video_coding/codecs/vp8/include/vp8.h"
 #include "webrtc/modules/video_capture/video_capture_factory.h"
+#include "webrtc/pc/mediasession.h"
 #include "webrtc/media/engine/webrtcvideocapturerfactory.h"
 
 // for servers
@@ -15,7 +18,8 @@
 #include "webrtc/p2p/base/basicpacketsocketfactory.h"
 #include "webrtc/p2p/base/turnserver.h"
 #include "webrtc/base/asyncudpsocket.h"
-#include "webrtc/base/optionsfile.h"
+#include "batchedudpsocket.h"
+#include "turnfastpath.h"
 #include "webrtc/base/stringencode.h"
 #include "webrtc/base/thread.h"
 
@@ -26,35 +30,8 @@ namespace Native
 	const char kStreamLabel[] = "stream_label";
 	const char kSoftware[] = "libjingle TurnServer";
 
-	class TurnFileAuth : public cricket::TurnAuthInterface
-	{
-	public:
-		explicit TurnFileAuth(const std::string& path) : file_(path)
-		{
-		}
-
-		bool Load()
-		{
-			return file_.Load();
-		}
-
-		virtual bool GetKey(const std::string& username, const std::string& realm, std::string* key)
-		{
-			// File is stored as lines of <username>=<HA1>.
-			// Generate HA1 via "echo -n "<username>:<realm>:<password>" | md5sum"
-			std::string hex;
-			bool ret = file_.GetStringValue(username, &hex);
-			if (ret)
-			{
-				char buf[32];
-				size_t len = rtc::hex_decode(buf, sizeof(buf), hex);
-				*key = std::string(buf, len);
-			}
-			return ret;
-		}
-	private:
-		rtc::OptionsFile file_;
-	};
+	// DataChannelInit -1 as reported back by DataChannelInterface
+	const uint16_t kUnsetRetransmit = 0xFFFF;
 
 	Conductor::Conductor()
 	{
@@ -62,17 +39,38 @@ namespace Native
 		onSuccess = nullptr;
 		onFailure = nullptr;
 		onIceCandidate = nullptr;
+		onRenderLocal = nullptr;
+		onRenderRemote = nullptr;
+		onDataMessage = nullptr;
+		onDataBinaryMessage = nullptr;
+		onStats = nullptr;
+		onRemoteAudio = nullptr;
+		onDataBuffer = nullptr;
+		onDataChannel = nullptr;
+		onChannelMessage = nullptr;
+		onChannelStateChange = nullptr;
+		onChannelWritable = nullptr;
+		onChannelBatch = nullptr;
+		onFileOffer = nullptr;
+		onFileProgress = nullptr;
+		onFileComplete = nullptr;
 
 		width_ = 640;
 	    height_ = 360;			
 		caputureFps = 5;
 		audioEnabled = false;
+		SetRemoteAudioFormat(0, 0, 1);
 
 		barcodeEnabled = false;		
+		loopbackEnabled = false;
+		jitterBufferMaxPackets = webrtc::PeerConnectionInterface::RTCConfiguration::kAudioJitterBufferMaxPackets;
+		jitterBufferFastAccelerate = false;
 
 		turnServer = nullptr;
-		data_channel = nullptr;
-		onDataMessage = nullptr;
+		serverMetrics.reset(new ServerMetrics());
+		data_channel_default = 0;
+		data_channel_next = 0;
+		data_buffers = new rtc::RefCountedObject<DataBufferPool>();
 		capturer_internal = nullptr;
 		capturer = nullptr;
 	}
@@ -92,6 +90,10 @@ namespace Native
 			stunServer->disconnect_all();
 		}
 
+		// reads the servers
+		serverMetrics.reset();
+		turnRelay.reset();
+
 		if (turnServer || stunServer)
 		{
 			rtc::Thread::Current()->Quit();
@@ -100,6 +102,9 @@ namespace Native
 
 	void Conductor::DeletePeerConnection()
 	{
+		StopStats();
+		DetachRemoteAudio();
+
 		if (peer_connection_.get())
 		{
 			local_video.reset();
@@ -115,12 +120,15 @@ namespace Native
 		}
 
 		pc_factory_ = nullptr;
-
-		if (data_channel)
-		{
-			data_channel->UnregisterObserver();
-			data_channel = nullptr;
-		}
+		worker_thread.reset();
+		network_thread.reset();
+		encoder_factory.reset();
+
+		file_transfers.clear();
+		data_channel_order.clear();
+		data_channels.clear();
+		closing_data_channels.clear();
+		data_channel_default = 0;
 		serverConfigs.clear();
 
 		capturer_internal = nullptr;
@@ -132,7 +140,20 @@ namespace Native
 		ASSERT(pc_factory_ == nullptr);
 		ASSERT(peer_connection_ == nullptr);
 
-		pc_factory_ = webrtc::CreatePeerConnectionFactory();
+		// the session's own VP8 and VP9 encoders
+		encoder_factory.reset(new SessionEncoderFactory(videoCodecs, videoEncoding.quality_scaler && videoEncoding.ScalesResolution()));
+
+		network_thread = rtc::Thread::CreateWithSocketServer();
+		network_thread->SetName("network_thread", nullptr);
+		network_thread->Start();
+
+		worker_thread = rtc::Thread::Create();
+		worker_thread->SetName("worker_thread", nullptr);
+		worker_thread->Start();
+
+		// a null push_audio takes the default device
+		pc_factory_ = webrtc::CreatePeerConnectionFactory(network_thread.get(), worker_thread.get(), rtc::Thread::Current(),
+														  push_audio.get(), encoder_factory.get(), nullptr);
 
 		if (!pc_factory_)
 		{
@@ -145,6 +166,10 @@ namespace Native
 			//opt.disable_encryption = true;
 			//opt.disable_network_monitor = true;
 			//opt.disable_sctp_data_channels = true;
+			if (loopbackEnabled)
+			{
+				opt.network_ignore_mask = 0;
+			}
 			pc_factory_->SetOptions(opt);
 		}
 
@@ -167,6 +192,8 @@ namespace Native
 		config.disable_ipv6 = true;
 		config.enable_dtls_srtp = rtc::Optional<bool>(dtls);
 		config.rtcp_mux_policy = webrtc::PeerConnectionInterface::kRtcpMuxPolicyRequire;
+		config.audio_jitter_buffer_max_packets = jitterBufferMaxPackets;
+		config.audio_jitter_buffer_fast_accelerate = jitterBufferFastAccelerate;
 
 		for each (auto server in serverConfigs)
 		{
@@ -181,6 +208,8 @@ namespace Native
 		constraints.SetMandatoryUseRtpMux(true);
 		constraints.AddMandatory(webrtc::MediaConstraintsInterface::kVoiceActivityDetection, "false");
 		constraints.AddMandatory(webrtc::MediaConstraintsInterface::kEnableIPv6, "false");
+		constraints.AddOptional(webrtc::MediaConstraintsInterface::kCpuOveruseDetection,
+								videoEncoding.ScalesResolution() ? "true" : "false");
 
 		peer_connection_ = pc_factory_->CreatePeerConnection(config, &constraints, NULL, NULL, this);
 		return peer_connection_ != nullptr;
@@ -216,9 +245,80 @@ namespace Native
 			LOG(WARNING) << "Can't parse received session description message. " << "SdpParseError was: " << error.description;
 			return;
 		}
+		ApplyOpusConfig(session_description);
+		videoCodecs.Apply(session_description->description());
+		videoEncoding.ApplyBitrates(session_description->description());
 		peer_connection_->SetRemoteDescription(this, session_description);
 	}
 
+	bool Conductor::SetVideoEncoding(const VideoEncoding & encoding)
+	{
+		videoEncoding = encoding;
+
+		const bool scaler = encoding.quality_scaler && encoding.ScalesResolution();
+		if (encoder_factory)
+		{
+			encoder_factory->set_quality_scaler(scaler);
+		}
+
+		if (capturer)
+		{
+			capturer->SetOutputLimits(encoding.max_width, encoding.max_height, encoding.max_fps, encoding.ScalesResolution());
+		}
+		return ApplyVideoSender();
+	}
+
+	bool Conductor::ApplyVideoSender()
+	{
+		if (!peer_connection_)
+			return true;
+
+		const int max_bitrate_bps = videoEncoding.max_bitrate_bps > 0 ? videoEncoding.max_bitrate_bps : -1;
+		for (const auto & sender : peer_connection_->GetSenders())
+		{
+			if (sender->media_type() != cricket::MEDIA_TYPE_VIDEO)
+				continue;
+
+			// no encodings before the first negotiation, then this runs again
+			webrtc::RtpParameters parameters = sender->GetParameters();
+			bool changed = false;
+			for (auto & encoding : parameters.encodings)
+			{
+				changed |= encoding.max_bitrate_bps != max_bitrate_bps;
+				encoding.max_bitrate_bps = max_bitrate_bps;
+			}
+
+			if (changed && !sender->SetParameters(parameters))
+			{
+				LOG(LS_WARNING) << "Failed to set video sender parameters";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// what the remote asks us to send is what we want to send
+	void Conductor::ApplyOpusConfig(webrtc::SessionDescriptionInterface * desc)
+	{
+		if (!desc->description())
+			return;
+
+		cricket::ContentInfo * content = cricket::GetFirstAudioContent(desc->description()->contents());
+		if (!content || !content->description)
+			return;
+
+		auto audio = static_cast<cricket::AudioContentDescription*>(content->description);
+		cricket::AudioCodecs codecs = audio->codecs();
+		for (auto & codec : codecs)
+		{
+			if (cricket::CodecNamesEq(codec.name, cricket::kOpusCodecName))
+			{
+				opusConfig.ToCodec(&codec);
+			}
+		}
+		audio->set_codecs(codecs);
+	}
+
 	void Conductor::OnOfferRequest(std::string sdp)
 	{
 		if (!peer_connection_)
@@ -231,6 +331,9 @@ namespace Native
 			LOG(WARNING) << "Can't parse received session description message. " << "SdpParseError was: " << error.description;
 			return;
 		}
+		ApplyOpusConfig(session_description);
+		videoCodecs.Apply(session_description->description());
+		videoEncoding.ApplyBitrates(session_description->description());
 		peer_connection_->SetRemoteDescription(this, session_description);
 
 		webrtc::PeerConnectionInterface::RTCOfferAnswerOptions o;
@@ -264,6 +367,38 @@ namespace Native
 		return true;
 	}
 
+	bool Conductor::StartStats(int interval_ms)
+	{
+		if (!peer_connection_)
+			return false;
+
+		if (!stats_)
+		{
+			stats_ = new rtc::RefCountedObject<StatsCollector>(*this, peer_connection_);
+		}
+		stats_->Start(interval_ms);
+		return true;
+	}
+
+	void Conductor::StopStats()
+	{
+		if (stats_)
+		{
+			stats_->Stop();
+			stats_ = nullptr;
+		}
+	}
+
+	bool Conductor::LastStats(SessionStats & stats)
+	{
+		if (!stats_)
+		{
+			ResetSessionStats(stats);
+			return false;
+		}
+		return stats_->Last(stats);
+	}
+
 	// ...
 
 	std::vector<std::string> Conductor::GetVideoDevices()
@@ -304,6 +439,70 @@ namespace Native
 		return false;
 	}
 
+	void Conductor::EnablePushAudio(int sample_rate, size_t channels)
+	{
+		ASSERT(pc_factory_ == nullptr);
+
+		// 10 ms frames of at least one sample, mono or stereo
+		if (sample_rate < 8000 || sample_rate > 48000 || channels < 1 || channels > 2)
+		{
+			LOG(LS_ERROR) << "Push audio can't be " << sample_rate << " Hz, " << channels << " channels";
+			return;
+		}
+
+		push_audio = new rtc::RefCountedObject<PushAudioDevice>(sample_rate, channels);
+		audioEnabled = true;
+	}
+
+	size_t Conductor::PushAudio(const int16_t * samples, size_t frames)
+	{
+		if (!push_audio)
+			return 0;
+
+		return push_audio->Push(samples, frames);
+	}
+
+	void Conductor::SetRemoteAudioFormat(int sample_rate, size_t channels, int batch_frames)
+	{
+		remoteAudioFormat.sample_rate = sample_rate;
+		remoteAudioFormat.channels = channels;
+		remoteAudioFormat.batch_frames = std::max(batch_frames, 1);
+	}
+
+	void Conductor::AddRemoteAudioSink(webrtc::AudioTrackSinkInterface * sink)
+	{
+		remote_audio_sinks.push_back(sink);
+		if (remote_audio_track)
+		{
+			remote_audio_track->AddSink(sink);
+		}
+	}
+
+	void Conductor::RemoveRemoteAudioSink(webrtc::AudioTrackSinkInterface * sink)
+	{
+		auto it = std::find(remote_audio_sinks.begin(), remote_audio_sinks.end(), sink);
+		if (it == remote_audio_sinks.end())
+			return;
+
+		remote_audio_sinks.erase(it);
+		if (remote_audio_track)
+		{
+			remote_audio_track->RemoveSink(sink);
+		}
+	}
+
+	void Conductor::DetachRemoteAudio()
+	{
+		if (!remote_audio_track)
+			return;
+
+		for (auto sink : remote_audio_sinks)
+		{
+			remote_audio_track->RemoveSink(sink);
+		}
+		remote_audio_track = nullptr;
+	}
+
 	void Conductor::AddStreams()
 	{
 		if (active_streams_.find(kStreamLabel) != active_streams_.end())
@@ -317,6 +516,7 @@ namespace Native
 		else
 		{
 			vc = capturer = new Native::YuvFramesCapturer2(*this);
+			capturer->SetOutputLimits(videoEncoding.max_width, videoEncoding.max_height, videoEncoding.max_fps, videoEncoding.ScalesResolution());
 		}
 
 		auto v = pc_factory_->CreateVideoSource(vc);
@@ -330,7 +530,11 @@ namespace Native
 		{
 			if (audioEnabled)
 			{
-				auto a = pc_factory_->CreateAudioSource(NULL);
+				cricket::AudioOptions options;
+				audioProcessing.ToAudioOptions(&options);
+				opusConfig.ToAudioOptions(&options);
+
+				auto a = pc_factory_->CreateAudioSource(options);
 				auto audio_track = pc_factory_->CreateAudioTrack(kAudioLabel, a);
 				stream->AddTrack(audio_track);
 			}
@@ -367,6 +571,13 @@ namespace Native
 			{
 				webrtc::AudioTrackInterface* track = atracks[0];
 				remote_audio.reset(new Native::AudioRenderer(*this, true, track));
+
+				DetachRemoteAudio();
+				remote_audio_track = track;
+				for (auto sink : remote_audio_sinks)
+				{
+					track->AddSink(sink);
+				}
 			}
 		}
 	}
@@ -376,6 +587,7 @@ namespace Native
 		LOG(INFO) << __FUNCTION__ << " " << stream->label();
 		remote_video.reset(nullptr);
 		remote_audio.reset(nullptr);
+		DetachRemoteAudio();
 
 		// lost ownership, do not delete
 		capturer = nullptr;
@@ -404,6 +616,7 @@ namespace Native
 		if (!peer_connection_)
 			return;
 
+		videoCodecs.Apply(desc->description());
 		peer_connection_->SetLocalDescription(this, desc);
 
 		std::string sdp;
@@ -433,62 +646,283 @@ namespace Native
 		}
 	}
 
-	void Conductor::CreateDataChannel(const std::string & label)
+	int Conductor::CreateDataChannel(const std::string & label)
+	{
+		DataChannelConfig config;
+		config.ordered = false;
+		config.maxRetransmits = 1;
+		return CreateDataChannel(label, config);
+	}
+
+	int Conductor::CreateDataChannel(const std::string & label, const DataChannelConfig & config)
 	{
 		if (!peer_connection_)
-			return;
+			return 0;
+
+		if (config.bufferedAmountHigh > DataChannelConfig::kMaxBufferedAmountHigh || config.bufferedAmountLow > config.bufferedAmountHigh)
+		{
+			LOG(LS_ERROR) << "CreateDataChannel watermarks out of range: " << label;
+			return 0;
+		}
 
 		webrtc::DataChannelInit dc_options;
-		//dc_options.id = 1;
-		dc_options.maxRetransmits = 1;
-		dc_options.negotiated = false;
-		dc_options.ordered = false;
-		
-		data_channel = peer_connection_->CreateDataChannel(label, &dc_options);
-		data_channel->RegisterObserver(this);		
+		dc_options.ordered = config.ordered;
+		dc_options.maxRetransmits = config.maxRetransmits;
+		dc_options.maxRetransmitTime = config.maxRetransmitTime;
+		dc_options.negotiated = config.negotiated;
+		dc_options.id = config.id;
+		dc_options.protocol = config.coalesce ? kCoalesceProtocol : config.protocol;
+
+		rtc::scoped_refptr<webrtc::DataChannelInterface> channel = peer_connection_->CreateDataChannel(label, &dc_options);
+		if (!channel)
+		{
+			LOG(LS_ERROR) << "CreateDataChannel failed: " << label;
+			return 0;
+		}
+		return AddDataChannel(channel, config);
 	}
 
 	void Conductor::OnDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel)
 	{
 		LOG(INFO) << __FUNCTION__ << " " << channel->label();
 
-		data_channel = channel.get();
-		data_channel->RegisterObserver(this);
+		DataChannelConfig config;
+		config.ordered = channel->ordered();
+		config.maxRetransmits = channel->maxRetransmits() == kUnsetRetransmit ? -1 : channel->maxRetransmits();
+		config.maxRetransmitTime = channel->maxRetransmitTime() == kUnsetRetransmit ? -1 : channel->maxRetransmitTime();
+		config.negotiated = channel->negotiated();
+		config.id = channel->id();
+		config.protocol = channel->protocol();
+
+		int handle = AddDataChannel(channel, config);
+
+		if (config.protocol == kFileProtocol)
+		{
+			file_transfers[handle].reset(new FileReceiver(*this, GetDataChannel(handle), FileThread(), file_directory));
+			return;
+		}
+
+		if (onDataChannel != nullptr)
+		{
+			onDataChannel(handle, channel->label().c_str());
+		}
 	}
 
-	void Conductor::DataChannelSendText(const std::string & text)
+	int Conductor::AddDataChannel(webrtc::DataChannelInterface * channel, const DataChannelConfig & config)
 	{
-		data_channel->Send(webrtc::DataBuffer(text));
+		int handle = ++data_channel_next;
+		DataChannelHandler * handler = new DataChannelHandler(*this, handle, channel, config);
+		data_channels[handle].reset(handler);
+
+		// after the channels of the same priority
+		auto pos = std::upper_bound(data_channel_order.begin(), data_channel_order.end(), config.priority,
+									[](int priority, const DataChannelHandler * c)
+		{
+			return priority > c->config().priority;
+		});
+		data_channel_order.insert(pos, handler);
+
+		if (data_channel_default == 0 && config.protocol != kFileProtocol)
+		{
+			data_channel_default = handle;
+		}
+		return handle;
 	}
 
-	void Conductor::DataChannelSendData(const webrtc::DataBuffer & data)
+	bool Conductor::CloseDataChannel(int channel)
 	{
-		data_channel->Send(data);
+		auto it = data_channels.find(channel);
+		if (it == data_channels.end())
+			return false;
+
+		// gone for the API, but the handler stays the channel's observer
+		// until kClosed, which may come later from the network; it then
+		// posts ReleaseClosedDataChannel
+		std::unique_ptr<DataChannelHandler> handler = std::move(it->second);
+		data_channels.erase(it);
+		data_channel_order.erase(std::find(data_channel_order.begin(), data_channel_order.end(), handler.get()));
+		if (handler->channel()->state() != webrtc::DataChannelInterface::kClosed)
+		{
+			handler->Close();
+			closing_data_channels.push_back(std::move(handler));
+		}
+
+		if (data_channel_default == channel)
+		{
+			data_channel_default = data_channels.empty() ? 0 : data_channels.begin()->first;
+		}
+		return true;
 	}
 
-	//  A data buffer was successfully received.
-	void Conductor::OnMessage(const webrtc::DataBuffer& buffer)
+	DataChannelHandler * Conductor::GetDataChannel(int channel)
 	{
-		LOG(INFO) << __FUNCTION__;
+		auto it = data_channels.find(channel);
+		return it != data_channels.end() ? it->second.get() : nullptr;
+	}
 
-		if (buffer.binary)
+	int Conductor::FindDataChannel(const std::string & label) const
+	{
+		for (const auto & c : data_channels)
 		{
-			if (onDataBinaryMessage != nullptr)
+			if (c.second->label() == label)
 			{
-				auto * data = buffer.data.data();
-				onDataBinaryMessage(data, buffer.size());
+				return c.first;
 			}
 		}
-		else
+		return 0;
+	}
+
+	bool Conductor::DataChannelSendAsync(int channel, const uint8_t * data, uint32_t size, bool binary)
+	{
+		DataChannelHandler * c = GetDataChannel(channel);
+		if (!c)
+			return false;
+
+		return c->SendAsync(data, size, binary);
+	}
+
+	uint64_t Conductor::DataChannelBufferedAmount(int channel)
+	{
+		DataChannelHandler * c = GetDataChannel(channel);
+		return c ? c->BufferedAmount() : 0;
+	}
+
+	bool Conductor::SetDataChannelBatching(int channel, uint32_t max_bytes, uint32_t max_messages, int delay_ms)
+	{
+		DataChannelHandler * c = GetDataChannel(channel);
+		if (!c)
+			return false;
+
+		c->SetBatching(max_bytes, max_messages, delay_ms);
+		return true;
+	}
+
+	void Conductor::ReleaseClosedDataChannel(DataChannelHandler * handler)
+	{
+		closing_data_channels.erase(std::remove_if(closing_data_channels.begin(), closing_data_channels.end(),
+												   [handler](const std::unique_ptr<DataChannelHandler> & h)
+		{
+			return h.get() == handler;
+		}), closing_data_channels.end());
+	}
+
+	void Conductor::PumpDataChannels()
+	{
+		// a copy, the writable callbacks may close channels
+		const std::vector<DataChannelHandler*> channels = data_channel_order;
+
+		size_t i = 0;
+		while (i < channels.size())
 		{
-			if (onDataMessage != nullptr)
+			// the channels of one priority share what the higher ones leave
+			const int priority = channels[i]->config().priority;
+			bool drained = true;
+			for (; i < channels.size() && channels[i]->config().priority == priority; ++i)
 			{
-				std::string msg(buffer.data.data<char>(), buffer.size());
-				onDataMessage(msg.c_str());
+				drained = channels[i]->Pump() && drained;
 			}
+
+			if (!drained)
+				break;
 		}
 	}
 
+	int Conductor::SendFile(const std::string & path)
+	{
+		return SendFile(path, FileTransferConfig());
+	}
+
+	int Conductor::SendFile(const std::string & path, const FileTransferConfig & config)
+	{
+		if (config.chunkSize == 0 || config.chunkSize > FileTransfer::kMaxChunkSize || config.window < 1)
+			return 0;
+
+		DataChannelConfig dc_config;
+		dc_config.protocol = kFileProtocol;
+
+		size_t slash = path.find_last_of("/\\");
+		int handle = CreateDataChannel(slash == std::string::npos ? path : path.substr(slash + 1), dc_config);
+		if (handle == 0)
+			return 0;
+
+		std::unique_ptr<FileSender> sender(new FileSender(*this, GetDataChannel(handle), FileThread(), config));
+		if (!sender->Open(path))
+		{
+			sender.reset();
+			CloseDataChannel(handle);
+			return 0;
+		}
+		file_transfers[handle] = std::move(sender);
+		return handle;
+	}
+
+	bool Conductor::CancelFile(int transfer)
+	{
+		auto it = file_transfers.find(transfer);
+		if (it == file_transfers.end())
+			return false;
+
+		it->second->Cancel();
+		return true;
+	}
+
+	void Conductor::EndFileTransfer(int transfer, bool close)
+	{
+		file_transfers.erase(transfer);
+		if (close)
+		{
+			CloseDataChannel(transfer);
+		}
+	}
+
+	rtc::Thread * Conductor::FileThread()
+	{
+		if (!file_thread)
+		{
+			file_thread = rtc::Thread::Create();
+			file_thread->SetName("file_transfer", nullptr);
+			file_thread->Start();
+		}
+		return file_thread.get();
+	}
+
+	void Conductor::DataChannelSendText(const std::string & text)
+	{
+		DataChannelSendData(data_channel_default, reinterpret_cast<const uint8_t*>(text.data()), static_cast<uint32_t>(text.size()), false, nullptr, nullptr);
+	}
+
+	void Conductor::DataChannelSendData(const webrtc::DataBuffer & data)
+	{
+		DataChannelHandler * c = GetDataChannel(data_channel_default);
+		if (c)
+		{
+			c->channel()->Send(data);
+		}
+	}
+
+	bool Conductor::DataChannelSendData(const uint8_t * data, uint32_t size, OnDataReleaseCallbackNative release, void * context)
+	{
+		return DataChannelSendData(data_channel_default, data, size, true, release, context);
+	}
+
+	bool Conductor::DataChannelSendData(int channel, const uint8_t * data, uint32_t size, bool binary, OnDataReleaseCallbackNative release, void * context)
+	{
+		// The channel only takes owned buffers, the handler copies once into
+		// a buffer that is unshared again after Send and so gets reused.
+		bool ret = false;
+		DataChannelHandler * c = GetDataChannel(channel);
+		if (c)
+		{
+			ret = c->Send(data, size, binary);
+		}
+
+		if (release != nullptr)
+		{
+			release(context, data, size);
+		}
+		return ret;
+	}
+
 	bool Conductor::RunStunServer(const std::string & bindIp)
 	{
 		rtc::SocketAddress server_addr;
@@ -500,7 +934,7 @@ namespace Native
 
 		rtc::Thread * main = rtc::Thread::Current();
 
-		rtc::AsyncUDPSocket* server_socket = rtc::AsyncUDPSocket::Create(main->socketserver(), server_addr);
+		BatchedUdpSocket * server_socket = BatchedUdpSocket::Create(main, server_addr, false);
 		if (!server_socket)
 		{
 			LOG(LERROR) << "Failed to create a UDP socket" << std::endl;
@@ -508,14 +942,40 @@ namespace Native
 		}
 
 		stunServer.reset(new cricket::StunServer(server_socket));
+		serverMetrics->SetStunSocket(server_socket);
 
 		LOG(INFO) << "Listening at " << server_addr.ToString() << std::endl;
 
 		return true;
 	}
 
+	void Conductor::GetServerStats(ServerStats & stats)
+	{
+		serverMetrics->Snapshot(stats);
+	}
+
+	void Conductor::DumpServerStats(int interval_ms)
+	{
+		serverMetrics->SetDumpInterval(interval_ms);
+	}
+
+	void Conductor::SetTurnSecret(const std::string & secret)
+	{
+		if (!turnAuth)
+		{
+			turnAuth.reset(new TurnCredentials());
+		}
+		turnAuth->SetSecret(secret);
+	}
+
 	bool Conductor::RunTurnServer(const std::string & bindIp, const std::string & ip,
 								  const std::string & realm, const std::string & authFile)
+	{
+		return RunTurnServer(bindIp, ip, realm, authFile, 1);
+	}
+
+	bool Conductor::RunTurnServer(const std::string & bindIp, const std::string & ip,
+								  const std::string & realm, const std::string & authFile, int workers)
 	{
 		rtc::SocketAddress int_addr;
 		if (!int_addr.FromString(bindIp))
@@ -531,21 +991,41 @@ namespace Native
 			return false;
 		}
 
-		rtc::Thread* main = rtc::Thread::Current();
-		rtc::AsyncUDPSocket * int_socket = rtc::AsyncUDPSocket::Create(main->socketserver(), int_addr);
-		if (!int_socket)
+		if (!turnAuth)
 		{
-			LOG(LERROR) << "Failed to create a UDP socket bound at" << int_addr.ToString() << std::endl;
-			return false;
+			turnAuth.reset(new TurnCredentials());
 		}
 
-		TurnFileAuth * auth = new TurnFileAuth(authFile);
-		if (!auth->Load())
+		// may be empty with REST credentials only
+		if (!authFile.empty() && !turnAuth->Watch(authFile))
 		{
 			LOG(LERROR) << "Failed to load auth file " << authFile << std::endl;
 			return false;
 		}
+		cricket::TurnAuthInterface * auth = turnAuth.get();
+
+		if (workers > 1)
+		{
+			turnRelay.reset(new TurnRelay());
+			if (!turnRelay->Start(int_addr, ext_addr, realm, kSoftware, auth, workers))
+				return false;
 
+			serverMetrics->SetTurnRelay(turnRelay.get());
+			return true;
+		}
+
+		rtc::Thread* main = rtc::Thread::Current();
+		BatchedUdpSocket * int_socket = BatchedUdpSocket::Create(main, int_addr, false);
+		if (!int_socket)
+		{
+			LOG(LERROR) << "Failed to create a UDP socket bound at" << int_addr.ToString() << std::endl;
+			return false;
+		}
+
+		// ChannelData skips TurnServer, see TurnFastPath
+		rtc::scoped_refptr<TurnFastPath> fast_path(new rtc::RefCountedObject<TurnFastPath>());
+		TurnInternalSocket * internal = new TurnInternalSocket(int_socket, fast_path);
+		int_socket->SignalReadPacket.connect(internal, &TurnInternalSocket::OnReadPacket);
 
 		auto t = new cricket::TurnServer(main);
 		turnServer.reset(t);
@@ -553,10 +1033,12 @@ namespace Native
 		t->set_realm(realm);
 		t->set_software(kSoftware);
 		t->set_auth_hook(auth);
-		t->AddInternalSocket(int_socket, cricket::PROTO_UDP);
-		t->SetExternalSocketFactory(new rtc::BasicPacketSocketFactory(),
+		t->AddInternalSocket(internal, cricket::PROTO_UDP);
+		t->SetExternalSocketFactory(new TurnRelaySocketFactory(main, fast_path),
 											 rtc::SocketAddress(ext_addr, 0));
 
+		serverMetrics->SetTurnServer(int_socket, fast_path);
+
 		LOG(INFO) << "Listening internally at " << int_addr.ToString() << std::endl;
 
 		return true;
@@ -7,6 +7,16 @@
 #include "webrtc/api/peerconnectioninterface.h"
 
 #include "internals.h"
+#include "stats.h"
+#include "databuffers.h"
+#include "datachannels.h"
+#include "defaults.h"
+#include "filetransfer.h"
+#include "pushaudiodevice.h"
+#include "servermetrics.h"
+#include "turnauth.h"
+#include "turnrelay.h"
+#include "videocodecs.h"
 
 namespace cricket
 {
@@ -20,14 +30,18 @@ namespace Native
 	typedef void(__stdcall *OnSuccessCallbackNative)(const char * type, const char * sdp);
 	typedef void(__stdcall *OnFailureCallbackNative)(const char * error);
 	typedef void(__stdcall *OnIceCandidateCallbackNative)(const char * sdp_mid, int sdp_mline_index, const char * sdp);
-	typedef void(__stdcall *OnRenderCallbackNative)(uint8_t * frame_buffer, uint32_t w, uint32_t h);
+	// |render_time_ms| on rtc::TimeMillis, the capture time for local frames;
+	// |ntp_time_ms| when the sender captured the frame on its NTP clock, 0 for
+	// remote frames until an RTCP sender report arrived
+	typedef void(__stdcall *OnRenderCallbackNative)(uint8_t * frame_buffer, uint32_t w, uint32_t h, int64_t render_time_ms, int64_t ntp_time_ms);
 	typedef void(__stdcall *OnDataMessageCallbackNative)(const char * msg);
 	typedef void(__stdcall *OnDataBinaryMessageCallbackNative)(const uint8_t * msg, uint32_t size);
+	typedef void(__stdcall *OnStatsCallbackNative)(const SessionStats * stats);
+	typedef void(__stdcall *OnRemoteAudioCallbackNative)(const int16_t * data, int sample_rate, uint32_t channels, uint32_t frames, uint32_t timestamp, int64_t ntp_time_ms);
 
 	class Conductor : public webrtc::PeerConnectionObserver,
 		public webrtc::CreateSessionDescriptionObserver,
-		public webrtc::SetSessionDescriptionObserver,
-		public webrtc::DataChannelObserver
+		public webrtc::SetSessionDescriptionObserver
 	{
 	public:
 
@@ -45,24 +59,100 @@ namespace Native
 			return rtc::Thread::Current()->ProcessMessages(delay);
 		}
 
+		bool GetStats(webrtc::StatsObserver * observer)
+		{
+			if (!peer_connection_)
+				return false;
+
+			return peer_connection_->GetStats(observer, nullptr, webrtc::PeerConnectionInterface::kStatsOutputLevelStandard);
+		}
+
+		// periodic SessionStats through onStats, 0 collects once
+		bool StartStats(int interval_ms);
+		void StopStats();
+		bool LastStats(SessionStats & stats);
+
+		// Audio from PushAudio instead of a sound card, see PushAudioDevice.
+		// Before InitializePeerConnection, enables audio. 8 to 48 kHz, mono
+		// or stereo.
+		void EnablePushAudio(int sample_rate, size_t channels);
+
+		// interleaved 16-bit frames, from one thread; returns the frames
+		// taken, fewer when more than PushAudioDevice::kRingMs is queued
+		size_t PushAudio(const int16_t * samples, size_t frames);
+
+		// for the local audio track, before the streams are added
+		void SetAudioProcessing(const AudioProcessingConfig & config)
+		{
+			audioProcessing = config;
+		}
+
+		// video codec order and setup, before InitializePeerConnection
+		void SetVideoCodecPreference(const VideoCodecPreference & preference)
+		{
+			videoCodecs = preference;
+		}
+
+		// bitrate, resolution and framerate of the video sender, any time
+		// on the signaling thread, see VideoEncoding
+		bool SetVideoEncoding(const VideoEncoding & encoding);
+
+		// Opus encoder settings, before the remote description arrives; the
+		// network adaptor config before the streams are added
+		void SetOpusConfig(const OpusConfig & config)
+		{
+			opusConfig = config;
+		}
+
+		// format of onRemoteAudio, for tracks added after the call
+		void SetRemoteAudioFormat(int sample_rate, size_t channels, int batch_frames);
+
+		size_t PushAudioChannels() const
+		{
+			return push_audio ? push_audio->channels() : 1;
+		}
+
+		int PushAudioRate() const
+		{
+			return push_audio ? push_audio->sample_rate() : 0;
+		}
+
+		// sender NTP of the last playout pulled, 0 when not known
+		int64_t PlayoutNtpMs() const
+		{
+			return push_audio ? push_audio->playout_ntp_ms() : 0;
+		}
+
+		// more sinks on the remote audio track, attached when it arrives;
+		// the audio thread calls them until they are removed
+		void AddRemoteAudioSink(webrtc::AudioTrackSinkInterface * sink);
+		void RemoveRemoteAudioSink(webrtc::AudioTrackSinkInterface * sink);
+
 		static std::vector<std::string> GetVideoDevices();
 		bool OpenVideoCaptureDevice(std::string & name);
 		void AddServerConfig(std::string uri, std::string username, std::string password);
 
-		uint8_t * VideoCapturerI420Buffer()
+		// I420 of |width|x|height|, 0 for the size of the last frame; filled
+		// for the next PushFrame, valid until then
+		uint8_t * VideoCapturerI420Buffer(int width = 0, int height = 0)
 		{
 			if (capturer)
 			{
-				return (uint8_t*)capturer->video_buffer->DataY();
+				webrtc::I420Buffer * b = capturer->FrameBuffer(width, height);
+				if (b)
+				{
+					return b->MutableDataY();
+				}
 			}
 			return nullptr;
 		}
 
-		void PushFrame()
+		// |capture_time_us| on the host's clock, 0 for now
+		void PushFrame(int64_t capture_time_us = 0)
 		{
 			if (capturer)
 			{
-				capturer->PushFrame();
+				capturer->PushFrame(capture_time_us);
 			}
 		}
 
@@ -94,10 +184,52 @@ namespace Native
 			}
 		}
 #endif
-		void CreateDataChannel(const std::string & label);
+		// Channel table. Handles are local and never reused, the first
+		// channel created or opened by the remote is the default one used
+		// by the calls without a handle. Returns 0 on failure.
+		int CreateDataChannel(const std::string & label, const DataChannelConfig & config);
+		bool CloseDataChannel(int channel);
+		DataChannelHandler * GetDataChannel(int channel);
+		int FindDataChannel(const std::string & label) const;
+
+		// unordered, one retransmission
+		int CreateDataChannel(const std::string & label);
+
 		void DataChannelSendText(const std::string & text);
 		void DataChannelSendData(const webrtc::DataBuffer & data);
 
+		// Copies |data| once into a reused send buffer, |release| (optional)
+		// runs before returning, the payload belongs to the caller again.
+		bool DataChannelSendData(const uint8_t * data, uint32_t size, OnDataReleaseCallbackNative release, void * context);
+		bool DataChannelSendData(int channel, const uint8_t * data, uint32_t size, bool binary, OnDataReleaseCallbackNative release, void * context);
+
+		// queued with backpressure, see DataChannelHandler::SendAsync
+		bool DataChannelSendAsync(int channel, const uint8_t * data, uint32_t size, bool binary);
+		uint64_t DataChannelBufferedAmount(int channel);
+
+		// see DataChannelConfig::batchBytes, false for an unknown channel
+		bool SetDataChannelBatching(int channel, uint32_t max_bytes, uint32_t max_messages, int delay_ms);
+
+		// drains channel send queues, a priority only once the higher
+		// ones are empty
+		void PumpDataChannels();
+
+		// deletes |handler| after its kClosed if CloseDataChannel dropped
+		// it, one the API still has stays until it is closed
+		void ReleaseClosedDataChannel(DataChannelHandler * handler);
+
+		// Sends |path| (UTF-8) over a new channel, see FileTransfer. Returns the
+		// transfer handle, 0 on failure. The remote writes into its file directory.
+		int SendFile(const std::string & path, const FileTransferConfig & config);
+		int SendFile(const std::string & path);
+		bool CancelFile(int transfer);
+
+		// incoming files are refused while empty
+		void SetFileDirectory(const std::string & directory)
+		{
+			file_directory = directory;
+		}
+
 		OnErrorCallbackNative onError;
 		OnSuccessCallbackNative onSuccess;
 		OnFailureCallbackNative onFailure;
@@ -106,11 +238,43 @@ namespace Native
 		OnRenderCallbackNative onRenderRemote;
 		OnDataMessageCallbackNative onDataMessage;
 		OnDataBinaryMessageCallbackNative onDataBinaryMessage;
+		OnStatsCallbackNative onStats;
+
+		// remote PCM on the audio thread, see AudioRenderer
+		OnRemoteAudioCallbackNative onRemoteAudio;
+
+		// binary messages without a copy, release each with DataBufferRelease,
+		// takes precedence over the message callbacks when set
+		OnChannelBufferCallbackNative onDataBuffer;
+
+		// defaults for every channel, see DataChannelHandler
+		OnDataChannelCallbackNative onDataChannel;
+		OnChannelMessageCallbackNative onChannelMessage;
+		OnChannelStateCallbackNative onChannelStateChange;
+		OnChannelWritableCallbackNative onChannelWritable;
+		OnChannelBatchCallbackNative onChannelBatch;
+
+		OnFileOfferCallbackNative onFileOffer;
+		OnFileProgressCallbackNative onFileProgress;
+		OnFileCompleteCallbackNative onFileComplete;
 
 		bool RunStunServer(const std::string & bindIp);
 		bool RunTurnServer(const std::string & bindIp, const std::string & ip,
 						   const std::string & realm, const std::string & authFile);
 
+		// |workers| threads, each with its own socket and allocations, see TurnRelay
+		bool RunTurnServer(const std::string & bindIp, const std::string & ip,
+						   const std::string & realm, const std::string & authFile, int workers);
+
+		// shared secret of the REST credentials, see TurnCredentials
+		void SetTurnSecret(const std::string & secret);
+
+		// counters of the servers above, see ServerMetrics
+		void GetServerStats(ServerStats & stats);
+
+		// logs a snapshot every |interval_ms|, 0 stops
+		void DumpServerStats(int interval_ms);
+
 	protected:
 
 #pragma region -- SetSessionDescriptionObserver --
@@ -118,6 +282,9 @@ namespace Native
 		virtual void webrtc::SetSessionDescriptionObserver::OnSuccess()
 		{
 			LOG(INFO) << __FUNCTION__;
+
+			// the sender has its encodings once a description is applied
+			ApplyVideoSender();
 		}
 
 #pragma endregion
@@ -166,27 +333,8 @@ namespace Native
 			LOG(INFO) << __FUNCTION__ << " ";
 		}
 
-#pragma endregion
-		
-#pragma region -- DataChannelObserver --
-		
 		virtual void OnDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel);
 
-		// The data channel state have changed.
-		virtual void OnStateChange()
-		{
-			LOG(INFO) << __FUNCTION__;
-		}
-
-		//  A data buffer was successfully received.
-		virtual void OnMessage(const webrtc::DataBuffer& buffer);
-
-		// The data channel's buffered_amount has changed.
-		virtual void OnBufferedAmountChange(uint64_t previous_amount)
-		{
-			LOG(INFO) << __FUNCTION__;
-		}
-
 #pragma endregion
 
 		int AddRef() const
@@ -199,15 +347,45 @@ namespace Native
 		};
 
 	private:
+		friend class DataChannelHandler;
+		friend class FileTransfer;
+
+		int AddDataChannel(webrtc::DataChannelInterface * channel, const DataChannelConfig & config);
+		void EndFileTransfer(int transfer, bool close);
+		rtc::Thread * FileThread();
 
 		bool CreatePeerConnection(bool dtls);
 		void DeletePeerConnection();
 		void AddStreams();		
+		void DetachRemoteAudio();
+		void ApplyOpusConfig(webrtc::SessionDescriptionInterface * desc);
+		bool ApplyVideoSender();
 
 		rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection_;
 		rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> pc_factory_;
+
+		// with a PushAudioDevice and an encoder factory the PeerConnection
+		// factory needs its threads passed in
+		rtc::scoped_refptr<PushAudioDevice> push_audio;
+		std::unique_ptr<SessionEncoderFactory> encoder_factory;
+		std::unique_ptr<rtc::Thread> network_thread;
+		std::unique_ptr<rtc::Thread> worker_thread;
 		std::map<std::string, rtc::scoped_refptr<webrtc::MediaStreamInterface>> active_streams_;
-		rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel;
+		std::map<int, std::unique_ptr<DataChannelHandler>> data_channels;
+
+		// |data_channels| by priority, highest first, for PumpDataChannels
+		std::vector<DataChannelHandler*> data_channel_order;
+
+		// closed by CloseDataChannel, kept until their kClosed was delivered
+		std::vector<std::unique_ptr<DataChannelHandler>> closing_data_channels;
+		int data_channel_default;
+		int data_channel_next;
+		rtc::scoped_refptr<DataBufferPool> data_buffers;
+
+		// receivers write on |file_thread|, so it outlives them
+		std::unique_ptr<rtc::Thread> file_thread;
+		std::map<int, std::unique_ptr<FileTransfer>> file_transfers;
+		std::string file_directory;
 		std::vector<webrtc::PeerConnectionInterface::IceServer> serverConfigs;
 
 		YuvFramesCapturer2 * capturer;
@@ -216,15 +394,35 @@ namespace Native
 		std::unique_ptr<VideoRenderer> local_video;
 		std::unique_ptr<VideoRenderer> remote_video;
 		std::unique_ptr<AudioRenderer> remote_audio;
+		rtc::scoped_refptr<webrtc::AudioTrackInterface> remote_audio_track;
+		std::vector<webrtc::AudioTrackSinkInterface*> remote_audio_sinks;
+
+		rtc::scoped_refptr<StatsCollector> stats_;
 
+		std::unique_ptr<TurnCredentials> turnAuth;
 		std::unique_ptr<cricket::TurnServer> turnServer;
+		std::unique_ptr<TurnRelay> turnRelay;
 		std::unique_ptr<cricket::StunServer> stunServer;
+		std::unique_ptr<ServerMetrics> serverMetrics;
 
 	public:
 		int caputureFps;
 		bool audioEnabled;
+		AudioSinkFormat remoteAudioFormat;
+		AudioProcessingConfig audioProcessing;
+		OpusConfig opusConfig;
+		VideoCodecPreference videoCodecs;
+		VideoEncoding videoEncoding;
 		bool barcodeEnabled;
 
+		// gather candidates on loopback adapters too, for headless runs
+		bool loopbackEnabled;
+
+		// NetEq of the remote audio, before InitializePeerConnection; fewer
+		// packets cap the delay lower, 20 ms each with the usual Opus
+		int jitterBufferMaxPackets;
+		bool jitterBufferFastAccelerate;
+
 		int width_;
 		int height_;
 	};
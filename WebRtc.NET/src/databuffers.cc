@@ -0,0 +1,77 @@
+
+#include "databuffers.h"
+
+#include "webrtc/base/checks.h"
+
+namespace Native
+{
+	DataBufferPool::DataBufferPool()
+	{
+	}
+
+	DataBufferPool::~DataBufferPool()
+	{
+		for (DataBufferRef * b : free_)
+		{
+			delete b;
+		}
+	}
+
+	DataBufferRef * DataBufferPool::Acquire(const webrtc::DataBuffer & data)
+	{
+		return Acquire(data, 0, data.size());
+	}
+
+	DataBufferRef * DataBufferPool::Acquire(const webrtc::DataBuffer & data, size_t offset, size_t size)
+	{
+		RTC_DCHECK_LE(offset + size, data.size());
+
+		DataBufferRef * b = nullptr;
+		{
+			rtc::CritScope lock(&crit_);
+			if (!free_.empty())
+			{
+				b = free_.back();
+				free_.pop_back();
+			}
+		}
+		if (b == nullptr)
+		{
+			b = new DataBufferRef();
+		}
+
+		// shares the received buffer, only the reference count changes
+		b->buffer_ = data.data;
+		b->offset_ = offset;
+		b->size_ = size;
+		b->binary_ = data.binary;
+		b->pool_ = this;
+		return b;
+	}
+
+	void DataBufferPool::Recycle(DataBufferRef * b)
+	{
+		b->buffer_ = rtc::CopyOnWriteBuffer();
+
+		// |b| may hold the last reference to this pool
+		rtc::scoped_refptr<DataBufferPool> self;
+		self.swap(b->pool_);
+		{
+			rtc::CritScope lock(&crit_);
+			if (free_.size() < kMaxFree)
+			{
+				free_.push_back(b);
+				b = nullptr;
+			}
+		}
+		delete b;
+	}
+
+	void DataBufferRelease(DataBufferRef * buffer)
+	{
+		if (buffer && buffer->pool_)
+		{
+			buffer->pool_->Recycle(buffer);
+		}
+	}
+}
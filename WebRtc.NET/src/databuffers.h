@@ -0,0 +1,80 @@
+
+#ifndef WEBRTC_NET_DATABUFFERS_H_
+#define WEBRTC_NET_DATABUFFERS_H_
+#pragma once
+
+#include <vector>
+
+#include "webrtc/api/datachannelinterface.h"
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/refcount.h"
+#include "webrtc/base/scoped_ref_ptr.h"
+
+namespace Native
+{
+	class DataBufferPool;
+
+	// A received payload, or a slice of one, still shared with the channel
+	// (no copy). Valid until DataBufferRelease, which may be called from
+	// any thread.
+	class DataBufferRef
+	{
+	public:
+		const uint8_t * data() const
+		{
+			return buffer_.cdata() + offset_;
+		}
+
+		uint32_t size() const
+		{
+			return static_cast<uint32_t>(size_);
+		}
+
+		bool binary() const
+		{
+			return binary_;
+		}
+
+	private:
+		friend class DataBufferPool;
+		friend void DataBufferRelease(DataBufferRef * buffer);
+
+		DataBufferRef() : offset_(0), size_(0), binary_(false)
+		{
+		}
+
+		rtc::CopyOnWriteBuffer buffer_;
+		size_t offset_;
+		size_t size_;
+		bool binary_;
+		rtc::scoped_refptr<DataBufferPool> pool_;
+	};
+
+	void DataBufferRelease(DataBufferRef * buffer);
+
+	// Recycles DataBufferRef holders so receiving does not allocate.
+	// Outstanding buffers keep the pool alive.
+	class DataBufferPool : public rtc::RefCountInterface
+	{
+	public:
+		DataBufferRef * Acquire(const webrtc::DataBuffer & data);
+		DataBufferRef * Acquire(const webrtc::DataBuffer & data, size_t offset, size_t size);
+		void Recycle(DataBufferRef * buffer);
+
+		// holders kept for reuse, the rest is freed on release
+		static const size_t kMaxFree = 1024;
+
+	protected:
+		DataBufferPool();
+		virtual ~DataBufferPool();
+
+	private:
+		rtc::CriticalSection crit_;
+		std::vector<DataBufferRef*> free_;
+	};
+
+	// Caller owned payload for DataChannelSendData, |release| runs once the
+	// channel is done with it.
+	typedef void(__stdcall *OnDataReleaseCallbackNative)(void * context, const uint8_t * data, uint32_t size);
+}
+#endif  // WEBRTC_NET_DATABUFFERS_H_
@@ -0,0 +1,450 @@
+
+#include "datachannels.h"
+#include "conductor.h"
+
+#include "webrtc/base/logging.h"
+
+namespace Native
+{
+	const char kCoalesceProtocol[] = "webrtc.net-coalesce";
+
+	namespace
+	{
+		const uint32_t kMsgPump = 1;
+		const uint32_t kMsgFlush = 2;
+		const uint32_t kMsgClosed = 3;
+
+		// frame header, little endian payload length
+		const size_t kFrameHeader = 4;
+
+		// messages up to this size are packed together
+		const size_t kMaxCoalesceBytes = 4 * 1024;
+
+		// well below the SCTP message size limit
+		const size_t kMaxBatchBytes = 16 * 1024;
+
+		void AppendFrame(rtc::CopyOnWriteBuffer & batch, const uint8_t * data, uint32_t size)
+		{
+			const uint8_t header[kFrameHeader] =
+			{
+				static_cast<uint8_t>(size),
+				static_cast<uint8_t>(size >> 8),
+				static_cast<uint8_t>(size >> 16),
+				static_cast<uint8_t>(size >> 24),
+			};
+			batch.AppendData(header, kFrameHeader);
+			batch.AppendData(data, size);
+		}
+	}
+
+	DataChannelHandler::DataChannelHandler(Conductor & c, int handle, webrtc::DataChannelInterface * channel, const DataChannelConfig & config) :
+		onMessage(nullptr),
+		onBuffer(nullptr),
+		onStateChange(nullptr),
+		onWritable(nullptr),
+		onBatch(nullptr),
+		sink(nullptr),
+		con(&c),
+		handle_(handle),
+		channel_(channel),
+		config_(config),
+		coalesce_(config.coalesce || channel->protocol() == kCoalesceProtocol),
+		thread_(rtc::Thread::Current()),
+		queued_bytes_(0),
+		pump_posted_(false),
+		blocked_(false),
+		pumping_(false),
+		flush_posted_(false)
+	{
+		channel_->RegisterObserver(this);
+	}
+
+	DataChannelHandler::~DataChannelHandler()
+	{
+		channel_->UnregisterObserver();
+	}
+
+	bool DataChannelHandler::Send(const uint8_t * data, uint32_t size, bool binary)
+	{
+		if (channel_->state() != webrtc::DataChannelInterface::kOpen)
+			return false;
+
+		{
+			rtc::CritScope lock(&crit_);
+			if (!queue_.empty())
+			{
+				Enqueue(data, size, binary);
+				return true;
+			}
+		}
+
+		send_buffer_.Clear();
+		if (coalesce_ && binary)
+		{
+			AppendFrame(send_buffer_, data, size);
+		}
+		else
+		{
+			send_buffer_.SetData(data, size);
+		}
+		return channel_->Send(webrtc::DataBuffer(send_buffer_, binary));
+	}
+
+	bool DataChannelHandler::SendAsync(const uint8_t * data, uint32_t size, bool binary)
+	{
+		{
+			rtc::CritScope lock(&crit_);
+			Enqueue(data, size, binary);
+		}
+		return Post();
+	}
+
+	bool DataChannelHandler::SendAsync(const rtc::CopyOnWriteBuffer & buffer, bool binary)
+	{
+		if (coalesce_ && binary)
+			return SendAsync(buffer.cdata(), static_cast<uint32_t>(buffer.size()), binary);
+
+		{
+			rtc::CritScope lock(&crit_);
+			Pending p;
+			p.data = buffer;
+			p.binary = binary;
+			p.batch = false;
+			queue_.push_back(p);
+			queued_bytes_ += buffer.size();
+		}
+		return Post();
+	}
+
+	bool DataChannelHandler::Post()
+	{
+		const uint64_t buffered = channel_->buffered_amount();
+
+		bool post = false;
+		bool writable = true;
+		{
+			rtc::CritScope lock(&crit_);
+			if (buffered + queued_bytes_ >= config_.bufferedAmountHigh)
+			{
+				blocked_ = true;
+			}
+			writable = !blocked_;
+
+			post = !pump_posted_;
+			pump_posted_ = true;
+		}
+
+		// later in the signaling thread loop, so messages sent in one go
+		// end up in the same batch
+		if (post)
+		{
+			thread_->Post(RTC_FROM_HERE, this, kMsgPump);
+		}
+		return writable;
+	}
+
+	// under crit_
+	void DataChannelHandler::Enqueue(const uint8_t * data, uint32_t size, bool binary)
+	{
+		if (coalesce_ && binary)
+		{
+			if (size <= kMaxCoalesceBytes && !queue_.empty() && queue_.back().batch &&
+				queue_.back().data.size() + kFrameHeader + size <= kMaxBatchBytes)
+			{
+				AppendFrame(queue_.back().data, data, size);
+			}
+			else
+			{
+				Pending p;
+				p.binary = true;
+				p.batch = size <= kMaxCoalesceBytes;
+				AppendFrame(p.data, data, size);
+				queue_.push_back(p);
+			}
+			queued_bytes_ += kFrameHeader + size;
+		}
+		else
+		{
+			Pending p;
+			p.data.SetData(data, size);
+			p.binary = binary;
+			p.batch = false;
+			queue_.push_back(p);
+			queued_bytes_ += size;
+		}
+	}
+
+	bool DataChannelHandler::Pump()
+	{
+		// Send may report a buffered amount change right away
+		if (pumping_)
+			return false;
+
+		pumping_ = true;
+		const bool drained = PumpQueue();
+		pumping_ = false;
+		return drained;
+	}
+
+	bool DataChannelHandler::PumpQueue()
+	{
+		const webrtc::DataChannelInterface::DataState state = channel_->state();
+		if (state != webrtc::DataChannelInterface::kOpen)
+		{
+			if (state == webrtc::DataChannelInterface::kClosed)
+			{
+				rtc::CritScope lock(&crit_);
+				queue_.clear();
+				queued_bytes_ = 0;
+			}
+
+			// nothing a lower priority waits for
+			return true;
+		}
+
+		while (channel_->buffered_amount() < config_.bufferedAmountHigh)
+		{
+			Pending p;
+			{
+				rtc::CritScope lock(&crit_);
+				if (queue_.empty())
+					break;
+
+				p = queue_.front();
+				queue_.pop_front();
+				queued_bytes_ -= p.data.size();
+			}
+
+			if (!channel_->Send(webrtc::DataBuffer(p.data, p.binary)))
+			{
+				LOG(LS_WARNING) << "DataChannel send failed, dropped " << p.data.size() << " bytes on " << channel_->label();
+				break;
+			}
+		}
+
+		uint64_t total = channel_->buffered_amount();
+		bool writable = false;
+		bool drained;
+		{
+			rtc::CritScope lock(&crit_);
+			drained = queue_.empty();
+			total += queued_bytes_;
+			if (blocked_ && total <= config_.bufferedAmountLow)
+			{
+				blocked_ = false;
+				writable = true;
+			}
+		}
+
+		if (writable)
+		{
+			OnChannelWritableCallbackNative cb = onWritable ? onWritable : con->onChannelWritable;
+			if (cb != nullptr)
+			{
+				cb(handle_, total);
+			}
+		}
+		return drained;
+	}
+
+	uint64_t DataChannelHandler::BufferedAmount()
+	{
+		uint64_t buffered = channel_->buffered_amount();
+
+		rtc::CritScope lock(&crit_);
+		return buffered + queued_bytes_;
+	}
+
+	void DataChannelHandler::Close()
+	{
+		channel_->Close();
+
+		rtc::CritScope lock(&crit_);
+		queue_.clear();
+		queued_bytes_ = 0;
+	}
+
+	void DataChannelHandler::SetBatching(uint32_t max_bytes, uint32_t max_messages, int delay_ms)
+	{
+		Flush();
+
+		config_.batchBytes = max_bytes;
+		config_.batchMessages = max_messages;
+		config_.batchDelayMs = delay_ms;
+	}
+
+	void DataChannelHandler::OnStateChange()
+	{
+		webrtc::DataChannelInterface::DataState state = channel_->state();
+		LOG(INFO) << __FUNCTION__ << " " << channel_->label() << " " << webrtc::DataChannelInterface::DataStateString(state);
+
+		// nothing received is held back past the end of the channel
+		if (state != webrtc::DataChannelInterface::kOpen)
+		{
+			Flush();
+		}
+
+		OnChannelStateCallbackNative cb = onStateChange ? onStateChange : con->onChannelStateChange;
+		if (sink != nullptr)
+		{
+			sink->OnChannelState(state);
+		}
+		else if (cb != nullptr)
+		{
+			cb(handle_, state);
+		}
+
+		// whatever was queued before the channel opened
+		if (state == webrtc::DataChannelInterface::kOpen)
+		{
+			con->PumpDataChannels();
+		}
+		else if (state == webrtc::DataChannelInterface::kClosed)
+		{
+			// not from inside the observer call
+			thread_->Post(RTC_FROM_HERE, this, kMsgClosed);
+		}
+	}
+
+	void DataChannelHandler::OnMessage(const webrtc::DataBuffer & buffer)
+	{
+		if (!coalesce_ || !buffer.binary)
+		{
+			Deliver(buffer, 0, buffer.size());
+			return;
+		}
+
+		const uint8_t * p = buffer.data.cdata();
+		const size_t size = buffer.size();
+		size_t offset = 0;
+		while (offset + kFrameHeader <= size)
+		{
+			const size_t length = p[offset] | (p[offset + 1] << 8) | (p[offset + 2] << 16) | (static_cast<uint32_t>(p[offset + 3]) << 24);
+			offset += kFrameHeader;
+			if (length > size - offset)
+			{
+				LOG(LS_WARNING) << "Truncated frame on " << channel_->label();
+				break;
+			}
+			Deliver(buffer, offset, length);
+			offset += length;
+		}
+	}
+
+	void DataChannelHandler::Deliver(const webrtc::DataBuffer & buffer, size_t offset, size_t size)
+	{
+		if (sink != nullptr)
+		{
+			sink->OnChannelMessage(buffer, offset, size);
+			return;
+		}
+
+		if (Batch(buffer, offset, size))
+			return;
+
+		const uint8_t * data = buffer.data.cdata() + offset;
+
+		if (buffer.binary)
+		{
+			OnChannelBufferCallbackNative buffer_cb = onBuffer ? onBuffer : con->onDataBuffer;
+			if (buffer_cb != nullptr)
+			{
+				DataBufferRef * ref = con->data_buffers->Acquire(buffer, offset, size);
+				buffer_cb(handle_, ref, ref->data(), ref->size());
+				return;
+			}
+		}
+
+		OnChannelMessageCallbackNative cb = onMessage ? onMessage : con->onChannelMessage;
+		if (cb != nullptr)
+		{
+			cb(handle_, data, static_cast<uint32_t>(size), buffer.binary);
+		}
+		else if (buffer.binary)
+		{
+			if (con->onDataBinaryMessage != nullptr)
+			{
+				con->onDataBinaryMessage(data, static_cast<uint32_t>(size));
+			}
+		}
+		else
+		{
+			if (con->onDataMessage != nullptr)
+			{
+				std::string msg(reinterpret_cast<const char*>(data), size);
+				con->onDataMessage(msg.c_str());
+			}
+		}
+	}
+
+	bool DataChannelHandler::Batch(const webrtc::DataBuffer & buffer, size_t offset, size_t size)
+	{
+		if (config_.batchBytes == 0 || (onBatch == nullptr && con->onChannelBatch == nullptr))
+			return false;
+
+		const uint8_t * data = buffer.data.cdata() + offset;
+		batch_offsets_.push_back(static_cast<uint32_t>(batch_data_.size()));
+		batch_sizes_.push_back(static_cast<uint32_t>(size));
+		batch_binary_.push_back(buffer.binary ? 1 : 0);
+		batch_data_.insert(batch_data_.end(), data, data + size);
+
+		if (batch_data_.size() >= config_.batchBytes || batch_sizes_.size() >= config_.batchMessages)
+		{
+			Flush();
+		}
+		else if (!flush_posted_)
+		{
+			flush_posted_ = true;
+			thread_->PostDelayed(RTC_FROM_HERE, config_.batchDelayMs, this, kMsgFlush);
+		}
+		return true;
+	}
+
+	void DataChannelHandler::Flush()
+	{
+		if (batch_sizes_.empty())
+			return;
+
+		OnChannelBatchCallbackNative cb = onBatch ? onBatch : con->onChannelBatch;
+		if (cb != nullptr)
+		{
+			cb(handle_, batch_data_.data(), batch_offsets_.data(), batch_sizes_.data(), batch_binary_.data(), static_cast<uint32_t>(batch_sizes_.size()));
+		}
+
+		// keeps the capacity
+		batch_data_.clear();
+		batch_offsets_.clear();
+		batch_sizes_.clear();
+		batch_binary_.clear();
+	}
+
+	void DataChannelHandler::OnBufferedAmountChange(uint64_t previous_amount)
+	{
+		if (channel_->buffered_amount() < previous_amount)
+		{
+			con->PumpDataChannels();
+		}
+	}
+
+	void DataChannelHandler::OnMessage(rtc::Message * msg)
+	{
+		if (msg->message_id == kMsgPump)
+		{
+			{
+				rtc::CritScope lock(&crit_);
+				pump_posted_ = false;
+			}
+			con->PumpDataChannels();
+		}
+		else if (msg->message_id == kMsgFlush)
+		{
+			flush_posted_ = false;
+			Flush();
+		}
+		else if (msg->message_id == kMsgClosed)
+		{
+			// deletes this if CloseDataChannel was called
+			con->ReleaseClosedDataChannel(this);
+		}
+	}
+}
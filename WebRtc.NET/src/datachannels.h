@@ -0,0 +1,220 @@
+
+#ifndef WEBRTC_NET_DATACHANNELS_H_
+#define WEBRTC_NET_DATACHANNELS_H_
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "webrtc/api/datachannelinterface.h"
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/thread.h"
+
+#include "databuffers.h"
+
+namespace Native
+{
+	class Conductor;
+
+	// |channel| is the handle returned by Conductor::CreateDataChannel or
+	// passed to onDataChannel, |state| is webrtc::DataChannelInterface::DataState.
+	typedef void(__stdcall *OnDataChannelCallbackNative)(int channel, const char * label);
+	typedef void(__stdcall *OnChannelMessageCallbackNative)(int channel, const uint8_t * data, uint32_t size, bool binary);
+	typedef void(__stdcall *OnChannelBufferCallbackNative)(int channel, DataBufferRef * buffer, const uint8_t * data, uint32_t size);
+	typedef void(__stdcall *OnChannelStateCallbackNative)(int channel, int state);
+	typedef void(__stdcall *OnChannelWritableCallbackNative)(int channel, uint64_t buffered_amount);
+
+	// |count| messages, message i is |sizes[i]| bytes at |data| + |offsets[i]|,
+	// |binary[i]| nonzero for binary ones. Valid during the call only.
+	typedef void(__stdcall *OnChannelBatchCallbackNative)(int channel, const uint8_t * data, const uint32_t * offsets, const uint32_t * sizes, const uint8_t * binary, uint32_t count);
+
+	// protocol of channels whose binary messages are length prefixed batches
+	extern const char kCoalesceProtocol[];
+
+	struct DataChannelConfig
+	{
+		DataChannelConfig() :
+			ordered(true),
+			maxRetransmits(-1),
+			maxRetransmitTime(-1),
+			negotiated(false),
+			id(-1),
+			priority(0),
+			bufferedAmountHigh(1024 * 1024),
+			bufferedAmountLow(256 * 1024),
+			coalesce(false),
+			batchBytes(0),
+			batchMessages(256),
+			batchDelayMs(5)
+		{
+		}
+
+		// reliability, at most one of maxRetransmits/maxRetransmitTime (ms)
+		bool ordered;
+		int maxRetransmits;
+		int maxRetransmitTime;
+
+		// out-of-band negotiated channels need the same |id| on both ends
+		bool negotiated;
+		int id;
+		std::string protocol;
+
+		// SendAsync queues of lower priority drain only while the higher
+		// ones are empty, DataChannelInit carries no priority at this
+		// revision
+		int priority;
+
+		// SendAsync keeps at most |bufferedAmountHigh| bytes in the channel
+		// and queues the rest, onWritable fires once the total (channel plus
+		// queue) got above it and then fell to |bufferedAmountLow|
+		uint64_t bufferedAmountHigh;
+		uint64_t bufferedAmountLow;
+
+		// a channel buffering more than webrtc's kMaxQueuedSendDataBytes
+		// is closed, so is the limit of |bufferedAmountHigh|
+		static const uint64_t kMaxBufferedAmountHigh = 16 * 1024 * 1024;
+
+		// Packs small binary messages sent together into one SCTP message,
+		// the protocol becomes kCoalesceProtocol so the remote handler
+		// splits them again. Both ends must run this handler.
+		bool coalesce;
+
+		// Received messages are collected and handed to onBatch together
+		// once |batchBytes| or |batchMessages| is reached, or |batchDelayMs|
+		// after the first one. 0 bytes delivers each message on its own.
+		uint32_t batchBytes;
+		uint32_t batchMessages;
+		int batchDelayMs;
+	};
+
+	// Native consumer of a channel, takes over the message and state
+	// callbacks while set. Signaling thread.
+	class DataChannelSink
+	{
+	public:
+		virtual void OnChannelMessage(const webrtc::DataBuffer & buffer, size_t offset, size_t size) = 0;
+		virtual void OnChannelState(webrtc::DataChannelInterface::DataState state) = 0;
+
+	protected:
+		virtual ~DataChannelSink()
+		{
+		}
+	};
+
+	// One entry of the Conductor channel table.
+	class DataChannelHandler : public webrtc::DataChannelObserver,
+		public rtc::MessageHandler
+	{
+	public:
+		DataChannelHandler(Conductor & c, int handle, webrtc::DataChannelInterface * channel, const DataChannelConfig & config);
+		virtual ~DataChannelHandler();
+
+		int handle() const
+		{
+			return handle_;
+		}
+
+		std::string label() const
+		{
+			return channel_->label();
+		}
+
+		const DataChannelConfig & config() const
+		{
+			return config_;
+		}
+
+		webrtc::DataChannelInterface * channel() const
+		{
+			return channel_.get();
+		}
+
+		// Sends right away, false if the channel refused it. Goes through
+		// the queue instead while SendAsync data is pending, to keep order.
+		bool Send(const uint8_t * data, uint32_t size, bool binary);
+
+		// Copies into the send queue, drained on the signaling thread as the
+		// channel buffer empties. Any thread. Returns false once above the
+		// high watermark: the message is queued anyway, wait for onWritable.
+		bool SendAsync(const uint8_t * data, uint32_t size, bool binary);
+
+		// same, queues a reference to |buffer| instead of a copy
+		bool SendAsync(const rtc::CopyOnWriteBuffer & buffer, bool binary);
+
+		// moves queued messages into the channel up to the high watermark,
+		// signaling thread only; false while an open channel still has
+		// messages queued
+		bool Pump();
+
+		// channel buffer plus queue
+		uint64_t BufferedAmount();
+
+		void Close();
+
+		// see DataChannelConfig::batchBytes, signaling thread
+		void SetBatching(uint32_t max_bytes, uint32_t max_messages, int delay_ms);
+
+		// Per channel callbacks, nullptr falls back to the Conductor ones,
+		// then to the single channel onData* callbacks.
+		OnChannelMessageCallbackNative onMessage;
+		OnChannelBufferCallbackNative onBuffer;
+		OnChannelStateCallbackNative onStateChange;
+		OnChannelWritableCallbackNative onWritable;
+		OnChannelBatchCallbackNative onBatch;
+
+		DataChannelSink * sink;
+
+	protected:
+
+		virtual void OnStateChange() override;
+		virtual void OnMessage(const webrtc::DataBuffer & buffer) override;
+		virtual void OnBufferedAmountChange(uint64_t previous_amount) override;
+
+		// rtc::MessageHandler, deferred pump
+		virtual void OnMessage(rtc::Message * msg) override;
+
+	private:
+
+		struct Pending
+		{
+			rtc::CopyOnWriteBuffer data;
+			bool binary;
+			bool batch;  // coalesced frames, more may be appended
+		};
+
+		void Enqueue(const uint8_t * data, uint32_t size, bool binary);
+		bool Post();
+		bool PumpQueue();
+		void Deliver(const webrtc::DataBuffer & buffer, size_t offset, size_t size);
+		bool Batch(const webrtc::DataBuffer & buffer, size_t offset, size_t size);
+		void Flush();
+
+		Conductor * con;
+		int handle_;
+		rtc::scoped_refptr<webrtc::DataChannelInterface> channel_;
+		DataChannelConfig config_;
+
+		bool coalesce_;
+		rtc::Thread * thread_;
+
+		// reused, unshared again once Send returns
+		rtc::CopyOnWriteBuffer send_buffer_;
+
+		rtc::CriticalSection crit_;
+		std::deque<Pending> queue_;
+		uint64_t queued_bytes_;
+		bool pump_posted_;
+		bool blocked_;
+		bool pumping_;
+
+		// receive batch, reused across flushes
+		std::vector<uint8_t> batch_data_;
+		std::vector<uint32_t> batch_offsets_;
+		std::vector<uint32_t> batch_sizes_;
+		std::vector<uint8_t> batch_binary_;
+		bool flush_posted_;
+	};
+}
+#endif  // WEBRTC_NET_DATACHANNELS_H_
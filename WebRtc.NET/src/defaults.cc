@@ -2,9 +2,12 @@
 #include "defaults.h"
 #include "internals.h"
 #include "conductor.h"
+#include "trace.h"
 
+#include <algorithm>
 
 #include "webrtc/modules/desktop_capture/desktop_capture_options.h"
+#include "webrtc/system_wrappers/include/clock.h"
 
 namespace Native
 {
@@ -13,6 +16,9 @@ namespace Native
 		return stride_y * height + (stride_u + stride_v) * ((height + 1) / 2);
 	}
 
+	// pushed frames the encoder may hold at once
+	const size_t kMaxPendingFrames = 8;
+
 	YuvFramesCapturer2::YuvFramesCapturer2(Conductor & c) :
 		barcode_interval_(1),
 		frame_generator_(nullptr),
@@ -20,14 +26,23 @@ namespace Native
 		desktop_capturer(nullptr),
 #endif
 		run(false),
-		con(&c)
+		con(&c),
+		frame_data_size_(0),
+		buffer_pool_(false, kMaxPendingFrames),
+		scaled_pool_(false, kMaxPendingFrames),
+		frame_width_(c.width_),
+		frame_height_(c.height_),
+		max_width_(0),
+		max_height_(0),
+		max_fps_(0),
+		adapt_(false),
+		output_width_(0),
+		output_height_(0)
 	{
-		video_buffer = webrtc::I420Buffer::Create(con->width_, con->height_);
-		frame_data_size_ = I420DataSize(con->height_, video_buffer->StrideY(), video_buffer->StrideU(), video_buffer->StrideV());
-
-		video_frame = new webrtc::VideoFrame(video_buffer, 0, 0, webrtc::VideoRotation::kVideoRotation_0);
+		FrameBuffer(con->width_, con->height_);
 
-		// Enumerate the supported formats. We have only one supported format.
+		// Enumerate the supported formats. We have only one supported format,
+		// the size it was started with; frames may have any other.
 		cricket::VideoFormat format(con->width_, con->height_, cricket::VideoFormat::FpsToInterval(con->caputureFps), cricket::FOURCC_IYUV);
 		std::vector<cricket::VideoFormat> supported;
 		supported.push_back(format);
@@ -39,12 +54,6 @@ namespace Native
 
 	YuvFramesCapturer2::~YuvFramesCapturer2()
 	{
-		if (video_frame)
-		{
-			delete video_frame;
-			video_frame = nullptr;
-		}
-
 		if (frame_generator_)
 		{
 			delete frame_generator_;
@@ -61,7 +70,7 @@ namespace Native
 		}
 		SetCaptureFormat(&capture_format);
 
-		barcode_reference_timestamp_millis_ = rtc::TimeNanos();
+		barcode_reference_timestamp_millis_ = rtc::TimeMillis();
 		run = true;
 
 #if DESKTOP_CAPTURE
@@ -106,43 +115,154 @@ namespace Native
 		return true;
 	}
 
-	void YuvFramesCapturer2::PushFrame()
+	webrtc::I420Buffer * YuvFramesCapturer2::FrameBuffer(int width, int height)
+	{
+		if (width > 0 && height > 0)
+		{
+			frame_width_ = width;
+			frame_height_ = height;
+		}
+
+		if (!video_buffer || video_buffer->width() != frame_width_ || video_buffer->height() != frame_height_)
+		{
+			// a new size purges the pool
+			video_buffer = buffer_pool_.CreateBuffer(frame_width_, frame_height_);
+			if (!video_buffer)
+			{
+				LOG(LS_WARNING) << "No free capture buffer, " << kMaxPendingFrames << " frames are pending";
+				return nullptr;
+			}
+			frame_data_size_ = I420DataSize(frame_height_, video_buffer->StrideY(), video_buffer->StrideU(), video_buffer->StrideV());
+		}
+		return video_buffer.get();
+	}
+
+	void YuvFramesCapturer2::SetOutputLimits(int max_width, int max_height, int max_fps, bool adapt)
+	{
+		{
+			rtc::CritScope lock(&limits_crit_);
+			max_width_ = max_width;
+			max_height_ = max_height;
+			max_fps_ = max_fps;
+			adapt_ = adapt;
+			output_width_ = 0;
+			output_height_ = 0;
+		}
+		UpdateOutputFormat(frame_width_, frame_height_);
+	}
+
+	void YuvFramesCapturer2::UpdateOutputFormat(int width, int height)
+	{
+		rtc::CritScope lock(&limits_crit_);
+		if (width == output_width_ && height == output_height_)
+			return;
+
+		output_width_ = width;
+		output_height_ = height;
+
+		// the largest size of the frame's aspect ratio within the limits
+		double scale = 1.0;
+		if (max_width_ > 0 && width > max_width_)
+		{
+			scale = std::min(scale, static_cast<double>(max_width_) / width);
+		}
+		if (max_height_ > 0 && height > max_height_)
+		{
+			scale = std::min(scale, static_cast<double>(max_height_) / height);
+		}
+		const int fps = max_fps_ > 0 ? max_fps_ : con->caputureFps;
+		video_adapter()->OnOutputFormatRequest(cricket::VideoFormat(std::max(1, static_cast<int>(width * scale)),
+																	std::max(1, static_cast<int>(height * scale)),
+																	cricket::VideoFormat::FpsToInterval(fps), cricket::FOURCC_ANY));
+
+		// off by default, AdaptFrame then passes frames through untouched
+		set_enable_video_adapter(adapt_ || max_width_ > 0 || max_height_ > 0 || max_fps_ > 0);
+	}
+
+	void YuvFramesCapturer2::PushFrame(int64_t capture_time_us)
 	{
-		int64_t camera_time_us = rtc::TimeMicros();
-		int64_t system_time_us = camera_time_us;
+		// unfilled, a recycled buffer goes out as it is
+		if (!FrameBuffer(0, 0))
+			return;
+
+		rtc::scoped_refptr<webrtc::I420Buffer> buffer = video_buffer;
+		const int width = buffer->width();
+		const int height = buffer->height();
+		UpdateOutputFormat(width, height);
+
+		// AdaptFrame maps the host's clock onto ours and filters its jitter,
+		// what it returns is the capture time carried on to RTP
+		int64_t system_time_us = rtc::TimeMicros();
+		int64_t camera_time_us = capture_time_us > 0 ? capture_time_us : system_time_us;
 		int out_width;
 		int out_height;
 		int crop_width;
 		int crop_height;
 		int crop_x;
 		int crop_y;
-		int64_t translated_camera_time_us;
-
-		if (AdaptFrame(con->width_,
-					   con->height_,
-					   camera_time_us,
-					   system_time_us,
-					   &out_width,
-					   &out_height,
-					   &crop_width,
-					   &crop_height,
-					   &crop_x,
-					   &crop_y,
-					   &translated_camera_time_us))
+		int64_t translated_camera_time_us = camera_time_us;
+
+		bool adapted = AdaptFrame(width,
+								  height,
+								  camera_time_us,
+								  system_time_us,
+								  &out_width,
+								  &out_height,
+								  &crop_width,
+								  &crop_height,
+								  &crop_x,
+								  &crop_y,
+								  &translated_camera_time_us);
+
+		// keyed on the render time the frame carries to the encoder, known
+		// only now, so the events before are placed back in time
+		const int64_t capture_ms = translated_camera_time_us / rtc::kNumMicrosecsPerMillisec;
+		if (TraceEnabled())
+		{
+			TraceEvent(kTraceCapture, 'B', 0, capture_ms, system_time_us);
+			TraceEvent(kTraceAdapt, 'B', 0, capture_ms, system_time_us);
+			TraceEvent(kTraceAdapt, 'E', 0, capture_ms);
+		}
+
+		if (adapted)
 		{
 			if (con->barcodeEnabled)
 			{
-				if (frame_generator_ == nullptr)
+				if (frame_generator_ == nullptr || frame_generator_->GetWidth() != width || frame_generator_->GetHeight() != height)
 				{
-					frame_generator_ = new cricket::YuvFrameGenerator(con->width_, con->height_, true);
+					delete frame_generator_;
+					frame_generator_ = new YuvFrameGenerator(width, height, true);
 				}
-				frame_generator_->GenerateNextFrame((uint8_t*)video_buffer->DataY(), static_cast<int32_t>(rtc::TimeNanos() - barcode_reference_timestamp_millis_));
+				frame_generator_->GenerateNextFrame(buffer.get(), static_cast<int32_t>(rtc::TimeMillis() - barcode_reference_timestamp_millis_));
 			}
 
-			video_frame->set_timestamp_us(translated_camera_time_us);
+			// the frame keeps the buffer until it is encoded, the host fills
+			// the next one from the pool
+			video_buffer = nullptr;
+
+			// VideoCapturer leaves the cropping and scaling AdaptFrame asks
+			// for to us, limits and resolution degradation depend on it
+			if (out_width != width || out_height != height || crop_width != width || crop_height != height)
+			{
+				rtc::scoped_refptr<webrtc::I420Buffer> scaled = scaled_pool_.CreateBuffer(out_width, out_height);
+				if (scaled)
+				{
+					scaled->CropAndScaleFrom(*buffer, crop_x, crop_y, crop_width, crop_height);
+				}
+				else
+				{
+					LOG(LS_WARNING) << "No free scaled buffer, " << kMaxPendingFrames << " frames are pending";
+				}
+				buffer = scaled;
+			}
 
-			OnFrame(*video_frame, con->width_, con->height_);
+			if (buffer)
+			{
+				OnFrame(webrtc::VideoFrame(buffer, webrtc::VideoRotation::kVideoRotation_0, translated_camera_time_us), width, height);
+			}
 		}
+
+		TraceEvent(kTraceCapture, 'E', 0, capture_ms);
 	}
 
 #if DESKTOP_CAPTURE
@@ -167,15 +287,123 @@ namespace Native
 	// VideoSinkInterface implementation
 	void VideoRenderer::OnFrame(const webrtc::VideoFrame& frame)
 	{
+		// the receiver's render time means nothing to the sender, NTP is
+		// its capture time
+		TraceScope trace(kTraceRender, frame.timestamp(), remote ? frame.ntp_time_ms() : frame.render_time_ms());
+
 		if (remote && con->onRenderRemote)
 		{
 			auto b = frame.video_frame_buffer();
-			con->onRenderRemote((uint8_t*)b->DataY(), b->width(), b->height());
+			con->onRenderRemote((uint8_t*)b->DataY(), b->width(), b->height(), frame.render_time_ms(), frame.ntp_time_ms());
 		}
 		else if (con->onRenderLocal)
 		{
+			// captured here, our NTP clock is the sender's
+			webrtc::Clock * clock = webrtc::Clock::GetRealTimeClock();
+			const int64_t ntp_time_ms = frame.render_time_ms() + clock->CurrentNtpInMilliseconds() - clock->TimeInMilliseconds();
+
 			auto b = frame.video_frame_buffer();
-			con->onRenderLocal((uint8_t*)b->DataY(), b->width(), b->height());
+			con->onRenderLocal((uint8_t*)b->DataY(), b->width(), b->height(), frame.render_time_ms(), ntp_time_ms);
+		}
+	}
+
+	AudioProcessingConfig::AudioProcessingConfig() :
+		bypass(false),
+		echo_cancellation(true),
+		extended_filter_aec(false),
+		delay_agnostic_aec(false),
+		residual_echo_detector(true),
+		auto_gain_control(true),
+		experimental_agc(false),
+		level_control(false),
+		noise_suppression(true),
+		experimental_ns(false),
+		highpass_filter(true),
+		typing_detection(true)
+	{
+	}
+
+	void AudioProcessingConfig::ToAudioOptions(cricket::AudioOptions * options) const
+	{
+		const bool on = !bypass;
+		options->echo_cancellation = rtc::Optional<bool>(on && echo_cancellation);
+		options->extended_filter_aec = rtc::Optional<bool>(on && echo_cancellation && extended_filter_aec);
+		options->delay_agnostic_aec = rtc::Optional<bool>(on && echo_cancellation && delay_agnostic_aec);
+		options->residual_echo_detector = rtc::Optional<bool>(on && residual_echo_detector);
+		options->auto_gain_control = rtc::Optional<bool>(on && auto_gain_control);
+		options->experimental_agc = rtc::Optional<bool>(on && auto_gain_control && experimental_agc);
+		options->level_control = rtc::Optional<bool>(on && level_control);
+		options->noise_suppression = rtc::Optional<bool>(on && noise_suppression);
+		options->experimental_ns = rtc::Optional<bool>(on && noise_suppression && experimental_ns);
+		options->highpass_filter = rtc::Optional<bool>(on && highpass_filter);
+		options->typing_detection = rtc::Optional<bool>(on && typing_detection);
+		options->intelligibility_enhancer = rtc::Optional<bool>(false);
+	}
+
+	OpusConfig::OpusConfig() :
+		frame_ms(0),
+		max_bitrate_bps(0),
+		channels(0),
+		dtx(-1),
+		fec(-1)
+	{
+	}
+
+	void OpusConfig::ToCodec(cricket::AudioCodec * codec) const
+	{
+		if (frame_ms > 0)
+		{
+			codec->SetParam(cricket::kCodecParamPTime, frame_ms);
+			codec->SetParam(cricket::kCodecParamMinPTime, frame_ms);
+		}
+		if (max_bitrate_bps > 0)
+		{
+			codec->SetParam(cricket::kCodecParamMaxAverageBitrate, max_bitrate_bps);
+		}
+		if (channels > 0)
+		{
+			codec->SetParam(cricket::kCodecParamStereo, channels > 1 ? 1 : 0);
+		}
+		if (dtx >= 0)
+		{
+			codec->SetParam(cricket::kCodecParamUseDtx, dtx ? 1 : 0);
+		}
+		if (fec >= 0)
+		{
+			codec->SetParam(cricket::kCodecParamUseInbandFec, fec ? 1 : 0);
+		}
+	}
+
+	void OpusConfig::ToAudioOptions(cricket::AudioOptions * options) const
+	{
+		options->audio_network_adaptor = rtc::Optional<bool>(!network_adaptor_config.empty());
+		if (!network_adaptor_config.empty())
+		{
+			options->audio_network_adaptor_config = rtc::Optional<std::string>(network_adaptor_config);
+		}
+	}
+
+	AudioRenderer::AudioRenderer(Conductor & c, bool remote, webrtc::AudioTrackInterface * track_to_render) :
+		audio_track_(track_to_render), con(&c), remote(remote),
+		format_(c.remoteAudioFormat),
+		batch_count_(0),
+		batch_rate_(0),
+		batch_channels_(0),
+		timestamp_(0),
+		batch_ntp_ms_(0),
+		pending_rate_(0)
+	{
+		audio_track_->AddSink(this);
+	}
+
+	AudioRenderer::~AudioRenderer()
+	{
+		audio_track_->RemoveSink(this);
+
+		// no OnData anymore, a partial batch still goes out
+		if (con->onRemoteAudio)
+		{
+			Deliver();
 		}
 	}
 
@@ -186,12 +414,116 @@ namespace Native
 							   size_t number_of_channels,
 							   size_t number_of_frames)
 	{
-		std::stringstream s;
-		s << "AudioRenderer::OnData, bps: " << bits_per_sample 
-		<< ", rate: " << sample_rate 
-		<< ", channels: " << number_of_channels
-		<< ", frames: " << number_of_frames;
-		
-		::OutputDebugStringA(s.str().c_str());
+		if (!con->onRemoteAudio || bits_per_sample != 16 || number_of_channels == 0)
+			return;
+
+		const int16_t * in = static_cast<const int16_t*>(audio_data);
+		const size_t channels = format_.channels ? format_.channels : number_of_channels;
+
+		// PushResampler takes exactly 10 ms, rates that have no whole 10 ms
+		// frame stay as they are
+		int rate = format_.sample_rate ? format_.sample_rate : sample_rate;
+		const bool resamples = rate == sample_rate || (sample_rate % 100 == 0 && rate % 100 == 0);
+		if (!resamples)
+		{
+			rate = sample_rate;
+		}
+
+		if (rate != batch_rate_ || channels != batch_channels_)
+		{
+			if (!resamples)
+			{
+				LOG(LS_WARNING) << "Remote audio stays at " << sample_rate << " Hz, it can't be resampled to " << format_.sample_rate << " Hz";
+			}
+
+			// the format changed, what is batched goes out as it was
+			Deliver();
+			pending_.clear();
+			batch_rate_ = rate;
+			batch_channels_ = channels;
+		}
+
+		if (channels != number_of_channels)
+		{
+			mixed_.resize(number_of_frames * channels);
+			for (size_t i = 0; i < number_of_frames; ++i)
+			{
+				const int16_t * src = in + i * number_of_channels;
+				int16_t * dst = &mixed_[i * channels];
+				if (channels == 1)
+				{
+					int sum = 0;
+					for (size_t c = 0; c < number_of_channels; ++c)
+					{
+						sum += src[c];
+					}
+					dst[0] = static_cast<int16_t>(sum / static_cast<int>(number_of_channels));
+				}
+				else
+				{
+					// mono or the first channels to more
+					for (size_t c = 0; c < channels; ++c)
+					{
+						dst[c] = src[c < number_of_channels ? c : number_of_channels - 1];
+					}
+				}
+			}
+			in = mixed_.data();
+		}
+
+		if (batch_.empty())
+		{
+			// this pull follows the one the device last saw
+			const int64_t ntp_ms = con->PlayoutNtpMs();
+			batch_ntp_ms_ = ntp_ms > 0 ? ntp_ms + PushAudioDevice::kFrameMs : 0;
+		}
+
+		const size_t samples = number_of_frames * channels;
+		if (rate == sample_rate)
+		{
+			pending_.clear();
+			batch_.insert(batch_.end(), in, in + samples);
+		}
+		else
+		{
+			if (sample_rate != pending_rate_)
+			{
+				// samples of the old rate can't go through the new resampler
+				pending_.clear();
+				pending_rate_ = sample_rate;
+			}
+			pending_.insert(pending_.end(), in, in + samples);
+
+			resampler_.InitializeIfNeeded(sample_rate, rate, channels);
+			const size_t chunk = sample_rate / 100 * channels;
+			const size_t capacity = rate / 100 * channels;
+			size_t done = 0;
+			for (; pending_.size() - done >= chunk; done += chunk)
+			{
+				const size_t offset = batch_.size();
+				batch_.resize(offset + capacity);
+				int n = resampler_.Resample(&pending_[done], chunk, &batch_[offset], capacity);
+				batch_.resize(offset + (n > 0 ? n : 0));
+			}
+			pending_.erase(pending_.begin(), pending_.begin() + done);
+		}
+
+		if (++batch_count_ >= format_.batch_frames)
+		{
+			Deliver();
+		}
+	}
+
+	void AudioRenderer::Deliver()
+	{
+		if (batch_.empty())
+			return;
+
+		const uint32_t frames = static_cast<uint32_t>(batch_.size() / batch_channels_);
+		con->onRemoteAudio(batch_.data(), batch_rate_, static_cast<uint32_t>(batch_channels_), frames, timestamp_, batch_ntp_ms_);
+
+		timestamp_ += frames;
+		batch_.clear();
+		batch_count_ = 0;
 	}
 }
\ No newline at end of file
@@ -3,12 +3,16 @@
 #define WEBRTC_NET_DEFAULTS_H_
 #pragma once
 
+#include "webrtc/base/criticalsection.h"
 #include "webrtc/media/base/videocapturer.h"
-#include "webrtc/media/base/yuvframegenerator.h"
+#include "webrtc/media/base/mediachannel.h"
 #include "webrtc/api/mediastreaminterface.h"
 #include "webrtc/modules/desktop_capture/desktop_capturer.h"
+#include "webrtc/common_audio/resampler/include/push_resampler.h"
+#include "webrtc/common_video/include/i420_buffer_pool.h"
 
 #include "internals.h"
+#include "yuvframegenerator.h"
 
 namespace Native
 {
@@ -32,7 +36,16 @@ namespace Native
 			return false;
 		}
 
-		void PushFrame();
+		// The buffer the host fills for the next PushFrame, at whatever size
+		// the source has now, 0 keeps the last one. It comes from a pool, the
+		// encoder may still read the frames pushed before; null when it is
+		// that far behind.
+		webrtc::I420Buffer * FrameBuffer(int width, int height);
+
+		void PushFrame(int64_t capture_time_us);
+
+		// 0 lifts a limit; |adapt| lets the encoder ask for less resolution
+		void SetOutputLimits(int max_width, int max_height, int max_fps, bool adapt);
 
 #if DESKTOP_CAPTURE
 		void CaptureFrame();
@@ -49,9 +62,25 @@ namespace Native
 
 	private:
 
+		// fits the limits to the aspect ratio of the frames, the adapter crops
+		// to the requested one otherwise
+		void UpdateOutputFormat(int width, int height);
+
 		Conductor * con;
-		cricket::YuvFrameGenerator* frame_generator_;		
-		webrtc::VideoFrame * video_frame;
+		YuvFrameGenerator * frame_generator_;		
+
+		webrtc::I420BufferPool buffer_pool_;
+		webrtc::I420BufferPool scaled_pool_;
+		int frame_width_;
+		int frame_height_;
+
+		rtc::CriticalSection limits_crit_;
+		int max_width_;
+		int max_height_;
+		int max_fps_;
+		bool adapt_;
+		int output_width_;
+		int output_height_;
 
 		int64_t barcode_reference_timestamp_millis_;
 		int32_t barcode_interval_;
@@ -86,18 +115,78 @@ namespace Native
 		rtc::scoped_refptr<webrtc::VideoTrackInterface> rendered_track_;		
 	};
 
+	// What onRemoteAudio gets, 0 keeps the rate or channels as received.
+	struct AudioSinkFormat
+	{
+		int sample_rate;
+		size_t channels;
+
+		// 10 ms frames per callback
+		int batch_frames;
+	};
+
+	// Audio processing of the outgoing audio, the voice engine defaults
+	// until changed. Each Conductor has its own engine, so this is per
+	// session. |bypass| turns everything off, for clean synthetic audio
+	// where echo cancellation and the rest only cost CPU.
+	struct AudioProcessingConfig
+	{
+		AudioProcessingConfig();
+
+		bool bypass;
+
+		bool echo_cancellation;
+		bool extended_filter_aec;
+		bool delay_agnostic_aec;
+		bool residual_echo_detector;
+
+		bool auto_gain_control;
+		bool experimental_agc;
+		bool level_control;
+
+		bool noise_suppression;
+		bool experimental_ns;
+		bool highpass_filter;
+		bool typing_detection;
+
+		void ToAudioOptions(cricket::AudioOptions * options) const;
+	};
+
+	// Opus send settings. The voice engine configures its encoder from the
+	// Opus fmtp of the remote description, so they are written there before
+	// it is applied; 0, or -1 for the flags, leaves a value to the remote.
+	struct OpusConfig
+	{
+		OpusConfig();
+
+		// 10, 20, 40 or 60
+		int frame_ms;
+		int max_bitrate_bps;
+
+		// 1 or 2
+		int channels;
+		int dtx;
+		int fec;
+
+		// serialized audio_network_adaptor::config::ControllerManager, turns
+		// on the AudioNetworkAdaptor which then tunes bitrate, frame length,
+		// FEC and DTX to the network; empty disables it
+		std::string network_adaptor_config;
+
+		void ToCodec(cricket::AudioCodec * codec) const;
+		void ToAudioOptions(cricket::AudioOptions * options) const;
+	};
+
+	// Hands the PCM of a track to onRemoteAudio on the audio thread,
+	// downmixed or upmixed and resampled to the Conductor's AudioSinkFormat
+	// and batched. The timestamp counts samples at the delivered rate, the
+	// track sink carries no RTP timestamp at this revision; the sender's
+	// NTP time is what PushAudioDevice was told for the pull before.
 	class AudioRenderer : public webrtc::AudioTrackSinkInterface
 	{
 	public:
-		AudioRenderer(Conductor & c, bool remote, webrtc::AudioTrackInterface * track_to_render) :
-			audio_track_(track_to_render), con(&c), remote(remote)
-		{
-			audio_track_->AddSink(this);
-		}
-		virtual ~AudioRenderer()
-		{
-			audio_track_->RemoveSink(this);
-		}
+		AudioRenderer(Conductor & c, bool remote, webrtc::AudioTrackInterface * track_to_render);
+		virtual ~AudioRenderer();
 
 		virtual void OnData(const void* audio_data,
 							int bits_per_sample,
@@ -106,10 +195,25 @@ namespace Native
 							size_t number_of_frames) override;
 
 	protected:
+		void Deliver();
 
 		bool remote;
 		Conductor * con;
 		rtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track_;
-	};	
+
+		const AudioSinkFormat format_;
+		webrtc::PushResampler<int16_t> resampler_;
+		std::vector<int16_t> mixed_;
+
+		// input short of 10 ms, resampled once the rest arrives
+		std::vector<int16_t> pending_;
+		int pending_rate_;
+		std::vector<int16_t> batch_;
+		int batch_count_;
+		int batch_rate_;
+		size_t batch_channels_;
+		uint32_t timestamp_;
+		int64_t batch_ntp_ms_;
+	};
 }
 #endif  // WEBRTC_NET_DEFAULTS_H_
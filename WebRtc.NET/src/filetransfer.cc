@@ -0,0 +1,736 @@
+
+#include "filetransfer.h"
+#include "conductor.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "webrtc/base/crc32.h"
+#include "webrtc/base/logging.h"
+
+namespace Native
+{
+	const char kFileProtocol[] = "webrtc.net-file";
+
+	namespace
+	{
+		enum FileMessage
+		{
+			kOffer = 1,
+			kAccept,
+			kChunk,
+			kAck,
+			kNack,
+			kEnd,
+			kDone,
+			kCancel,
+		};
+
+		enum
+		{
+			kMsgRelease = 1,
+			kMsgWrite,
+			kMsgWritten,
+			kMsgVerify,
+			kMsgVerified,
+			kMsgHash,
+			kMsgHashed,
+		};
+
+		// type, offset, crc32
+		const size_t kChunkHeader = 1 + 8 + 4;
+
+		// type, size, chunk size, then the name
+		const size_t kOfferHeader = 1 + 8 + 4;
+
+		// callbacks at most once per this many bytes
+		const uint64_t kProgressBytes = 1024 * 1024;
+
+		// mapped at once by the sender, kHashBlock is the read size when hashing
+		const size_t kViewBytes = 32 * 1024 * 1024;
+		const size_t kHashBlock = 1024 * 1024;
+
+		void PutLe32(uint8_t * p, uint32_t v)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				p[i] = static_cast<uint8_t>(v >> (8 * i));
+			}
+		}
+
+		void PutLe64(uint8_t * p, uint64_t v)
+		{
+			for (int i = 0; i < 8; ++i)
+			{
+				p[i] = static_cast<uint8_t>(v >> (8 * i));
+			}
+		}
+
+		uint32_t GetLe32(const uint8_t * p)
+		{
+			uint32_t v = 0;
+			for (int i = 3; i >= 0; --i)
+			{
+				v = (v << 8) | p[i];
+			}
+			return v;
+		}
+
+		uint64_t GetLe64(const uint8_t * p)
+		{
+			uint64_t v = 0;
+			for (int i = 7; i >= 0; --i)
+			{
+				v = (v << 8) | p[i];
+			}
+			return v;
+		}
+
+		// positional, the handle has no shared file pointer
+		bool WriteAt(HANDLE file, const uint8_t * data, size_t size, uint64_t offset)
+		{
+			OVERLAPPED o = {};
+			o.Offset = static_cast<DWORD>(offset);
+			o.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+			DWORD written = 0;
+			return WriteFile(file, data, static_cast<DWORD>(size), &written, &o) && written == size;
+		}
+
+		bool ReadAt(HANDLE file, uint8_t * data, size_t size, uint64_t offset)
+		{
+			OVERLAPPED o = {};
+			o.Offset = static_cast<DWORD>(offset);
+			o.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+			DWORD read = 0;
+			return ReadFile(file, data, static_cast<DWORD>(size), &read, &o) && read == size;
+		}
+
+		// the last path component, empty if it could leave the directory
+		std::string SafeName(const std::string & name)
+		{
+			size_t slash = name.find_last_of("/\\:");
+			std::string base = slash == std::string::npos ? name : name.substr(slash + 1);
+			if (base == "." || base == "..")
+			{
+				base.clear();
+			}
+			return base;
+		}
+
+		struct ChunkData : public rtc::MessageData
+		{
+			rtc::CopyOnWriteBuffer data;
+			size_t offset;
+			size_t size;
+		};
+
+		struct WriteResult
+		{
+			uint64_t offset;
+			uint32_t size;
+			int status;
+			bool crc_ok;
+		};
+	}
+
+	FileTransfer::FileTransfer(Conductor & c, DataChannelHandler * channel) :
+		con(&c),
+		channel_(channel),
+		thread_(rtc::Thread::Current()),
+		finished_(false),
+		close_(false),
+		handle_(channel->handle()),
+		progress_(0)
+	{
+		channel_->sink = this;
+	}
+
+	FileTransfer::~FileTransfer()
+	{
+		channel_->sink = nullptr;
+	}
+
+	void FileTransfer::Cancel()
+	{
+		if (finished_)
+			return;
+
+		SendControl(kCancel, 0);
+		Finish(kFileCancelled);
+	}
+
+	void FileTransfer::SendControl(uint8_t type, uint64_t value)
+	{
+		uint8_t msg[9];
+		msg[0] = type;
+		PutLe64(msg + 1, value);
+		channel_->SendAsync(msg, sizeof(msg), true);
+	}
+
+	void FileTransfer::Progress(uint64_t done, uint64_t total, bool force)
+	{
+		if (!force && done - progress_ < kProgressBytes)
+			return;
+
+		progress_ = done;
+		if (con->onFileProgress != nullptr)
+		{
+			con->onFileProgress(handle_, done, total);
+		}
+	}
+
+	void FileTransfer::Finish(int status)
+	{
+		if (finished_)
+			return;
+
+		finished_ = true;
+		LOG(INFO) << "File transfer " << handle_ << " " << path_ << " finished, status " << status;
+
+		if (con->onFileComplete != nullptr)
+		{
+			con->onFileComplete(handle_, path_.c_str(), status);
+		}
+		thread_->Post(RTC_FROM_HERE, this, kMsgRelease);
+	}
+
+	void FileTransfer::OnChannelState(webrtc::DataChannelInterface::DataState state)
+	{
+		if (state == webrtc::DataChannelInterface::kClosed)
+		{
+			Finish(kFileChannelClosed);
+		}
+	}
+
+	void FileTransfer::OnMessage(rtc::Message * msg)
+	{
+		if (msg->message_id == kMsgRelease)
+		{
+			// deletes this
+			con->EndFileTransfer(handle_, close_);
+		}
+	}
+
+	FileSender::FileSender(Conductor & c, DataChannelHandler * channel, rtc::Thread * disk, const FileTransferConfig & config) :
+		FileTransfer(c, channel),
+		disk_(disk),
+		config_(config),
+		file_(INVALID_HANDLE_VALUE),
+		mapping_(nullptr),
+		view_(nullptr),
+		view_offset_(0),
+		view_size_(0),
+		size_(0),
+		next_(0),
+		acked_(0),
+		in_flight_(0),
+		started_(false),
+		hashing_(false),
+		ended_(false)
+	{
+		// the sender ends the channel once the receiver reported back
+		close_ = true;
+
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		granularity_ = info.dwAllocationGranularity;
+	}
+
+	FileSender::~FileSender()
+	{
+		// waits for the hash in progress
+		disk_->Invoke<void>(RTC_FROM_HERE, [this]()
+		{
+			disk_->Clear(this);
+		});
+
+		Unmap();
+		if (mapping_)
+		{
+			CloseHandle(mapping_);
+		}
+		if (file_ != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(file_);
+		}
+	}
+
+	bool FileSender::Open(const std::string & path)
+	{
+		path_ = path;
+
+		file_ = CreateFileW(rtc::ToUtf16(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file_ == INVALID_HANDLE_VALUE)
+		{
+			LOG(LS_ERROR) << "SendFile, cannot open " << path << ", error " << GetLastError();
+			return false;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file_, &size))
+			return false;
+
+		size_ = size.QuadPart;
+
+		// an empty file cannot be mapped
+		if (size_ > 0)
+		{
+			mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (!mapping_)
+			{
+				LOG(LS_ERROR) << "SendFile, cannot map " << path << ", error " << GetLastError();
+				return false;
+			}
+		}
+
+		std::string name = SafeName(path);
+		std::vector<uint8_t> offer(kOfferHeader + name.size());
+		offer[0] = kOffer;
+		PutLe64(&offer[1], size_);
+		PutLe32(&offer[9], config_.chunkSize);
+		std::copy(name.begin(), name.end(), offer.begin() + kOfferHeader);
+
+		// queued until the channel opens
+		channel_->SendAsync(offer.data(), static_cast<uint32_t>(offer.size()), true);
+		return true;
+	}
+
+	void FileSender::OnChannelMessage(const webrtc::DataBuffer & buffer, size_t offset, size_t size)
+	{
+		if (finished_ || size < 9)
+			return;
+
+		const uint8_t * p = buffer.data.cdata() + offset;
+		const uint64_t value = GetLe64(p + 1);
+
+		switch (p[0])
+		{
+		case kAccept:
+			if (!started_)
+			{
+				Start(value);
+			}
+			break;
+
+		case kAck:
+			if (value < size_)
+			{
+				--in_flight_;
+				acked_ += std::min<uint64_t>(config_.chunkSize, size_ - value);
+				Progress(acked_, size_, false);
+				Fill();
+			}
+			break;
+
+		case kNack:
+			LOG(LS_WARNING) << "File transfer " << handle() << " resending chunk at " << value;
+			if (value < next_ && !SendChunk(value))
+			{
+				Finish(kFileIoError);
+			}
+			break;
+
+		case kDone:
+			Progress(acked_, size_, true);
+			Finish(static_cast<int>(value));
+			break;
+
+		case kCancel:
+			Finish(kFileCancelled);
+			break;
+		}
+	}
+
+	void FileSender::Start(uint64_t offset)
+	{
+		if (offset > size_)
+		{
+			SendControl(kCancel, 0);
+			Finish(kFileIoError);
+			return;
+		}
+
+		started_ = true;
+		next_ = offset;
+		acked_ = offset;
+
+		// the digest covers the whole file, the receiver hashes its .part
+		if (offset > 0)
+		{
+			hashing_ = true;
+			disk_->Post(RTC_FROM_HERE, this, kMsgHash, rtc::WrapMessageData(offset));
+			return;
+		}
+		Fill();
+	}
+
+	void FileSender::OnMessage(rtc::Message * msg)
+	{
+		switch (msg->message_id)
+		{
+		case kMsgHash:
+			Hash(msg);
+			break;
+
+		case kMsgHashed:
+		{
+			std::unique_ptr<rtc::TypedMessageData<bool>> data(static_cast<rtc::TypedMessageData<bool>*>(msg->pdata));
+			hashing_ = false;
+			if (finished_)
+				break;
+
+			if (!data->data())
+			{
+				Finish(kFileIoError);
+				break;
+			}
+			Fill();
+			break;
+		}
+
+		default:
+			FileTransfer::OnMessage(msg);
+		}
+	}
+
+	void FileSender::Hash(rtc::Message * msg)
+	{
+		std::unique_ptr<rtc::TypedMessageData<uint64_t>> data(static_cast<rtc::TypedMessageData<uint64_t>*>(msg->pdata));
+		const uint64_t offset = data->data();
+
+		// |sha1_| is left alone on the signaling thread until kMsgHashed
+		bool ok = true;
+		std::vector<uint8_t> block(kHashBlock);
+		for (uint64_t o = 0; o < offset; o += kHashBlock)
+		{
+			const size_t n = static_cast<size_t>(std::min<uint64_t>(kHashBlock, offset - o));
+			if (!ReadAt(file_, block.data(), n, o))
+			{
+				LOG(LS_ERROR) << "File transfer " << handle() << ", read failed at " << o << ", error " << GetLastError();
+				ok = false;
+				break;
+			}
+			sha1_.Update(block.data(), n);
+		}
+		thread_->Post(RTC_FROM_HERE, this, kMsgHashed, rtc::WrapMessageData(ok));
+	}
+
+	void FileSender::Fill()
+	{
+		if (hashing_)
+			return;
+
+		while (!finished_ && in_flight_ < config_.window && next_ < size_)
+		{
+			const size_t n = static_cast<size_t>(std::min<uint64_t>(config_.chunkSize, size_ - next_));
+			const uint8_t * p = Map(next_, n);
+			if (!p || !SendChunk(next_))
+			{
+				Finish(kFileIoError);
+				return;
+			}
+			sha1_.Update(p, n);
+
+			next_ += n;
+			++in_flight_;
+		}
+
+		if (!ended_ && next_ == size_ && in_flight_ == 0)
+		{
+			ended_ = true;
+
+			uint8_t msg[1 + rtc::Sha1Digest::kSize];
+			msg[0] = kEnd;
+			sha1_.Finish(msg + 1, rtc::Sha1Digest::kSize);
+			channel_->SendAsync(msg, sizeof(msg), true);
+		}
+	}
+
+	bool FileSender::SendChunk(uint64_t offset)
+	{
+		const size_t n = static_cast<size_t>(std::min<uint64_t>(config_.chunkSize, size_ - offset));
+		const uint8_t * p = Map(offset, n);
+		if (!p)
+			return false;
+
+		uint8_t header[kChunkHeader];
+		header[0] = kChunk;
+		PutLe64(header + 1, offset);
+		PutLe32(header + 9, rtc::ComputeCrc32(p, n));
+
+		// the only copy, the queue keeps a reference
+		rtc::CopyOnWriteBuffer msg(0, kChunkHeader + n);
+		msg.AppendData(header, kChunkHeader);
+		msg.AppendData(p, n);
+		channel_->SendAsync(msg, true);
+		return true;
+	}
+
+	const uint8_t * FileSender::Map(uint64_t offset, size_t size)
+	{
+		if (view_ && offset >= view_offset_ && offset + size <= view_offset_ + view_size_)
+			return view_ + (offset - view_offset_);
+
+		Unmap();
+
+		const uint64_t base = offset - offset % granularity_;
+		const size_t length = static_cast<size_t>(std::min<uint64_t>(std::max<uint64_t>(kViewBytes, offset - base + size), size_ - base));
+
+		view_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ,
+			static_cast<DWORD>(base >> 32), static_cast<DWORD>(base), length));
+		if (!view_)
+		{
+			LOG(LS_ERROR) << "SendFile, cannot map view at " << base << ", error " << GetLastError();
+			return nullptr;
+		}
+		view_offset_ = base;
+		view_size_ = length;
+		return view_ + (offset - base);
+	}
+
+	void FileSender::Unmap()
+	{
+		if (view_)
+		{
+			UnmapViewOfFile(view_);
+			view_ = nullptr;
+		}
+	}
+
+	FileReceiver::FileReceiver(Conductor & c, DataChannelHandler * channel, rtc::Thread * disk, const std::string & directory) :
+		FileTransfer(c, channel),
+		disk_(disk),
+		directory_(directory),
+		file_(INVALID_HANDLE_VALUE),
+		size_(0),
+		written_(0),
+		chunk_size_(0),
+		offered_(false)
+	{
+	}
+
+	FileReceiver::~FileReceiver()
+	{
+		// waits for a write in progress, drops the queued ones
+		disk_->Invoke<void>(RTC_FROM_HERE, [this]()
+		{
+			disk_->Clear(this);
+			if (file_ != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(file_);
+				file_ = INVALID_HANDLE_VALUE;
+			}
+		});
+	}
+
+	void FileReceiver::OnChannelMessage(const webrtc::DataBuffer & buffer, size_t offset, size_t size)
+	{
+		if (finished_ || size == 0)
+			return;
+
+		const uint8_t * p = buffer.data.cdata() + offset;
+		switch (p[0])
+		{
+		case kOffer:
+			if (!offered_)
+			{
+				OnOffer(p, size);
+			}
+			break;
+
+		case kChunk:
+			if (offered_ && size > kChunkHeader)
+			{
+				ChunkData * chunk = new ChunkData();
+				chunk->data = buffer.data;
+				chunk->offset = offset;
+				chunk->size = size;
+				disk_->Post(RTC_FROM_HERE, this, kMsgWrite, chunk);
+			}
+			break;
+
+		case kEnd:
+			if (offered_ && size == 1 + rtc::Sha1Digest::kSize)
+			{
+				std::string digest(reinterpret_cast<const char*>(p + 1), rtc::Sha1Digest::kSize);
+				disk_->Post(RTC_FROM_HERE, this, kMsgVerify, rtc::WrapMessageData(digest));
+			}
+			break;
+
+		case kCancel:
+			Finish(kFileCancelled);
+			break;
+		}
+	}
+
+	void FileReceiver::OnOffer(const uint8_t * p, size_t size)
+	{
+		if (size < kOfferHeader)
+			return;
+
+		offered_ = true;
+		size_ = GetLe64(p + 1);
+		chunk_size_ = GetLe32(p + 9);
+
+		std::string name = SafeName(std::string(reinterpret_cast<const char*>(p + kOfferHeader), size - kOfferHeader));
+		if (directory_.empty() || name.empty() || chunk_size_ == 0 || chunk_size_ > kMaxChunkSize)
+		{
+			LOG(LS_WARNING) << "File transfer " << handle() << " refused: " << name;
+			SendControl(kDone, kFileRefused);
+			Finish(kFileRefused);
+			return;
+		}
+
+		path_ = directory_ + "\\" + name;
+		part_ = path_ + ".part";
+
+		file_ = CreateFileW(rtc::ToUtf16(part_).c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+			OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		LARGE_INTEGER existing = {};
+		if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &existing))
+		{
+			LOG(LS_ERROR) << "File transfer " << handle() << ", cannot open " << part_ << ", error " << GetLastError();
+			SendControl(kDone, kFileIoError);
+			Finish(kFileIoError);
+			return;
+		}
+
+		// resume after the last whole chunk of an earlier attempt
+		uint64_t resume = static_cast<uint64_t>(existing.QuadPart);
+		resume = std::min(resume - resume % chunk_size_, size_);
+		written_ = resume;
+
+		LOG(INFO) << "File transfer " << handle() << " " << path_ << ", " << size_ << " bytes from " << resume;
+
+		if (con->onFileOffer != nullptr)
+		{
+			con->onFileOffer(handle(), name.c_str(), size_, resume);
+		}
+		SendControl(kAccept, resume);
+	}
+
+	void FileReceiver::OnMessage(rtc::Message * msg)
+	{
+		switch (msg->message_id)
+		{
+		case kMsgWrite:
+			Write(msg);
+			break;
+
+		case kMsgVerify:
+			Verify(msg);
+			break;
+
+		case kMsgWritten:
+		{
+			std::unique_ptr<rtc::TypedMessageData<WriteResult>> data(static_cast<rtc::TypedMessageData<WriteResult>*>(msg->pdata));
+			const WriteResult & r = data->data();
+			if (finished_)
+				break;
+
+			if (r.status != kFileOk)
+			{
+				SendControl(kDone, r.status);
+				Finish(r.status);
+			}
+			else if (!r.crc_ok)
+			{
+				LOG(LS_WARNING) << "File transfer " << handle() << " bad chunk at " << r.offset;
+				SendControl(kNack, r.offset);
+			}
+			else
+			{
+				written_ += r.size;
+				SendControl(kAck, r.offset);
+				Progress(written_, size_, false);
+			}
+			break;
+		}
+
+		case kMsgVerified:
+		{
+			std::unique_ptr<rtc::TypedMessageData<int>> data(static_cast<rtc::TypedMessageData<int>*>(msg->pdata));
+			Progress(written_, size_, true);
+			SendControl(kDone, data->data());
+			Finish(data->data());
+			break;
+		}
+
+		default:
+			FileTransfer::OnMessage(msg);
+		}
+	}
+
+	void FileReceiver::Write(rtc::Message * msg)
+	{
+		std::unique_ptr<ChunkData> chunk(static_cast<ChunkData*>(msg->pdata));
+		const uint8_t * p = chunk->data.cdata() + chunk->offset;
+
+		WriteResult r;
+		r.offset = GetLe64(p + 1);
+		r.size = static_cast<uint32_t>(chunk->size - kChunkHeader);
+		r.status = kFileOk;
+		r.crc_ok = rtc::ComputeCrc32(p + kChunkHeader, r.size) == GetLe32(p + 9);
+
+		if (r.crc_ok && (r.offset + r.size > size_ || !WriteAt(file_, p + kChunkHeader, r.size, r.offset)))
+		{
+			LOG(LS_ERROR) << "File transfer " << handle() << ", write failed at " << r.offset << ", error " << GetLastError();
+			r.status = kFileIoError;
+		}
+		thread_->Post(RTC_FROM_HERE, this, kMsgWritten, rtc::WrapMessageData(r));
+	}
+
+	void FileReceiver::Verify(rtc::Message * msg)
+	{
+		std::unique_ptr<rtc::TypedMessageData<std::string>> expected(static_cast<rtc::TypedMessageData<std::string>*>(msg->pdata));
+
+		int status = kFileOk;
+
+		// a longer .part from an earlier, bigger offer
+		LARGE_INTEGER end;
+		end.QuadPart = size_;
+		if (!SetFilePointerEx(file_, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file_))
+		{
+			status = kFileIoError;
+		}
+
+		rtc::Sha1Digest sha1;
+		std::vector<uint8_t> block(kHashBlock);
+		for (uint64_t o = 0; status == kFileOk && o < size_; o += kHashBlock)
+		{
+			const size_t n = static_cast<size_t>(std::min<uint64_t>(kHashBlock, size_ - o));
+			if (!ReadAt(file_, block.data(), n, o))
+			{
+				status = kFileIoError;
+				break;
+			}
+			sha1.Update(block.data(), n);
+		}
+
+		uint8_t digest[rtc::Sha1Digest::kSize];
+		sha1.Finish(digest, sizeof(digest));
+
+		CloseHandle(file_);
+		file_ = INVALID_HANDLE_VALUE;
+
+		if (status == kFileOk && expected->data().compare(0, std::string::npos, reinterpret_cast<const char*>(digest), sizeof(digest)) != 0)
+		{
+			LOG(LS_ERROR) << "File transfer " << handle() << ", sha1 mismatch on " << path_;
+			status = kFileHashMismatch;
+
+			// would only be resumed into the same mismatch
+			DeleteFileW(rtc::ToUtf16(part_).c_str());
+		}
+
+		if (status == kFileOk && !MoveFileExW(rtc::ToUtf16(part_).c_str(), rtc::ToUtf16(path_).c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			LOG(LS_ERROR) << "File transfer " << handle() << ", cannot rename " << part_ << ", error " << GetLastError();
+			status = kFileIoError;
+		}
+		thread_->Post(RTC_FROM_HERE, this, kMsgVerified, rtc::WrapMessageData(status));
+	}
+}
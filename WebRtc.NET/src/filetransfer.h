@@ -0,0 +1,181 @@
+
+#ifndef WEBRTC_NET_FILETRANSFER_H_
+#define WEBRTC_NET_FILETRANSFER_H_
+#pragma once
+
+#include <string>
+
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/sha1digest.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/base/win32.h"
+
+#include "datachannels.h"
+
+namespace Native
+{
+	class Conductor;
+
+	// protocol of the channel carrying one transfer
+	extern const char kFileProtocol[];
+
+	// |transfer| is the handle of the channel carrying the file.
+	// |offset| is where a resumed transfer starts, 0 for a new one.
+	typedef void(__stdcall *OnFileOfferCallbackNative)(int transfer, const char * name, uint64_t size, uint64_t offset);
+	typedef void(__stdcall *OnFileProgressCallbackNative)(int transfer, uint64_t done, uint64_t total);
+	typedef void(__stdcall *OnFileCompleteCallbackNative)(int transfer, const char * path, int status);
+
+	enum FileTransferStatus
+	{
+		kFileOk,
+		kFileCancelled,
+		kFileIoError,
+		kFileHashMismatch,
+		kFileChannelClosed,
+		kFileRefused,
+	};
+
+	struct FileTransferConfig
+	{
+		FileTransferConfig() :
+			chunkSize(64 * 1024),
+			window(16)
+		{
+		}
+
+		// payload per message, at most kMaxChunkSize
+		uint32_t chunkSize;
+
+		// chunks sent but not yet written by the receiver
+		int window;
+	};
+
+	// One file over its own reliable, ordered channel:
+	//
+	//   sender                       receiver
+	//   offer(size, chunk, name) ->
+	//                            <-  accept(offset), resumes a .part file
+	//   chunk(offset, crc32, data) ->
+	//                            <-  ack(offset) once written, nack(offset) on a bad crc
+	//   end(sha1) ->
+	//                            <-  done(status), after hashing the written file
+	//
+	// Either side may send cancel. Integers are little endian.
+	class FileTransfer : public DataChannelSink,
+		public rtc::MessageHandler
+	{
+	public:
+		virtual ~FileTransfer();
+
+		int handle() const
+		{
+			return handle_;
+		}
+
+		virtual void Cancel();
+
+		static const uint32_t kMaxChunkSize = 1024 * 1024;
+
+	protected:
+		FileTransfer(Conductor & c, DataChannelHandler * channel);
+
+		void SendControl(uint8_t type, uint64_t value);
+		void Progress(uint64_t done, uint64_t total, bool force);
+
+		// reports |status| once and drops the transfer later in the loop,
+		// closing the channel if |close_|
+		void Finish(int status);
+
+		virtual void OnChannelState(webrtc::DataChannelInterface::DataState state) override;
+		virtual void OnMessage(rtc::Message * msg) override;
+
+		Conductor * con;
+		DataChannelHandler * channel_;
+		rtc::Thread * thread_;
+		std::string path_;
+		bool finished_;
+		bool close_;
+
+	private:
+		int handle_;
+		uint64_t progress_;
+	};
+
+	// Reads through a memory mapped view, so chunks are copied once,
+	// straight into the send queue. The part a resumed transfer skips is
+	// hashed on the Conductor file thread before the first chunk.
+	class FileSender : public FileTransfer
+	{
+	public:
+		FileSender(Conductor & c, DataChannelHandler * channel, rtc::Thread * disk, const FileTransferConfig & config);
+		virtual ~FileSender();
+
+		bool Open(const std::string & path);
+
+	protected:
+		virtual void OnChannelMessage(const webrtc::DataBuffer & buffer, size_t offset, size_t size) override;
+		virtual void OnMessage(rtc::Message * msg) override;
+
+	private:
+		void Start(uint64_t offset);
+		void Fill();
+
+		// file thread
+		void Hash(rtc::Message * msg);
+		bool SendChunk(uint64_t offset);
+		const uint8_t * Map(uint64_t offset, size_t size);
+		void Unmap();
+
+		rtc::Thread * disk_;
+		FileTransferConfig config_;
+		HANDLE file_;
+		HANDLE mapping_;
+		const uint8_t * view_;
+		uint64_t view_offset_;
+		size_t view_size_;
+		uint32_t granularity_;
+
+		uint64_t size_;
+		uint64_t next_;
+		uint64_t acked_;
+		int in_flight_;
+		bool started_;
+		bool hashing_;
+		bool ended_;
+
+		// over the chunks in file order, resends are not hashed again
+		rtc::Sha1Digest sha1_;
+	};
+
+	// Writes into |name|.part on the Conductor file thread, renamed to
+	// |name| after the hash matched. A .part left by a broken transfer is
+	// resumed from its last whole chunk.
+	class FileReceiver : public FileTransfer
+	{
+	public:
+		FileReceiver(Conductor & c, DataChannelHandler * channel, rtc::Thread * disk, const std::string & directory);
+		virtual ~FileReceiver();
+
+	protected:
+		virtual void OnChannelMessage(const webrtc::DataBuffer & buffer, size_t offset, size_t size) override;
+		virtual void OnMessage(rtc::Message * msg) override;
+
+	private:
+		void OnOffer(const uint8_t * p, size_t size);
+
+		// file thread
+		void Write(rtc::Message * msg);
+		void Verify(rtc::Message * msg);
+
+		rtc::Thread * disk_;
+		std::string directory_;
+		std::string part_;
+		HANDLE file_;
+
+		uint64_t size_;
+		uint64_t written_;
+		uint32_t chunk_size_;
+		bool offered_;
+	};
+}
+#endif  // WEBRTC_NET_FILETRANSFER_H_
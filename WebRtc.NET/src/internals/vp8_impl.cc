@@ -34,6 +34,7 @@
 #include "webrtc/system_wrappers/include/metrics.h"
 
 #include "internals.h"
+#include "trace.h"
 
 namespace webrtc
 {
@@ -114,6 +115,30 @@ namespace webrtc
 			return true;
 		}
 
+		// Everything but the frame size and the bitrates the same, a single
+		// stream: UpdateCodecFrameSize can take it.
+		bool OnlyFrameSizeChanged(const VideoCodec& current, const VideoCodec& next)
+		{
+			if (next.numberOfSimulcastStreams > 1 || current.numberOfSimulcastStreams > 1)
+				return false;
+
+			const VideoCodecVP8& a = current.VP8();
+			const VideoCodecVP8& b = next.VP8();
+			return current.codecType == next.codecType &&
+				current.mode == next.mode &&
+				current.maxFramerate == next.maxFramerate &&
+				current.qpMax == next.qpMax &&
+				a.resilience == b.resilience &&
+				a.numberOfTemporalLayers == b.numberOfTemporalLayers &&
+				a.denoisingOn == b.denoisingOn &&
+				a.errorConcealmentOn == b.errorConcealmentOn &&
+				a.automaticResizeOn == b.automaticResizeOn &&
+				a.frameDroppingOn == b.frameDroppingOn &&
+				a.keyFrameInterval == b.keyFrameInterval &&
+				a.feedbackModeOn == b.feedbackModeOn &&
+				a.tl_factory == b.tl_factory;
+		}
+
 		int NumStreamsDisabled(const std::vector<bool>& streams)
 		{
 			int num_disabled = 0;
@@ -376,6 +401,28 @@ namespace webrtc
 		{
 			return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
 		}
+
+		// A source that changes size, or the quality scaler: libvpx resizes in
+		// place, rate control, temporal layers and picture ids go on and the
+		// only key frame is the one VP8 needs for a new size. It can't grow
+		// beyond the size it was created with, that takes a full init. Only
+		// reached through Native::SessionEncoder, which holds back the
+		// Release the send pipeline calls first and keeps the encoder of a
+		// simulcast stream across the adapter's reconfiguration.
+		if (inited_ && number_of_cores == number_of_cores_ && OnlyFrameSizeChanged(codec_, *inst))
+		{
+			if (UpdateCodecFrameSize(inst->width, inst->height) == WEBRTC_VIDEO_CODEC_OK)
+			{
+				codec_.startBitrate = inst->startBitrate;
+				codec_.minBitrate = inst->minBitrate;
+				codec_.maxBitrate = inst->maxBitrate;
+				codec_.simulcastStream[0].maxBitrate = inst->simulcastStream[0].maxBitrate;
+				codec_.simulcastStream[0].targetBitrate = inst->simulcastStream[0].targetBitrate;
+				codec_.simulcastStream[0].minBitrate = inst->simulcastStream[0].minBitrate;
+				return WEBRTC_VIDEO_CODEC_OK;
+			}
+		}
+
 		int retVal = Release();
 		if (retVal < 0)
 		{
@@ -769,6 +816,8 @@ namespace webrtc
 		RTC_DCHECK_EQ(frame.width(), codec_.width);
 		RTC_DCHECK_EQ(frame.height(), codec_.height);
 
+		Native::TraceScope trace(Native::kTraceEncode, frame.timestamp(), frame.render_time_ms());
+
 		if (!inited_)
 			return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
 		if (encoded_complete_callback_ == NULL)
@@ -1121,6 +1170,8 @@ namespace webrtc
 					vpx_codec_control(&encoders_[encoder_idx], VP8E_GET_LAST_QUANTIZER,
 									  &qp_128);
 					encoded_images_[encoder_idx].qp_ = qp_128;
+
+					Native::TraceScope trace(Native::kTracePacketize, input_image.timestamp(), input_image.render_time_ms());
 					encoded_complete_callback_->OnEncodedImage(encoded_images_[encoder_idx],
 															   &codec_specific, &frag_info);
 				}
@@ -1139,7 +1190,8 @@ namespace webrtc
 			configurations_[0].rc_dropframe_thresh > 0 &&
 			codec_.VP8().automaticResizeOn;
 
-		return VideoEncoder::ScalingSettings(enable_scaling && Native::CFG_quality_scaler_enabled_);
+		// gated per session by SessionEncoderFactory
+		return VideoEncoder::ScalingSettings(enable_scaling);
 	}
 
 	int VP8EncoderImpl::SetChannelParameters(uint32_t packetLoss, int64_t rtt)
@@ -1228,6 +1280,9 @@ namespace webrtc
 							   const CodecSpecificInfo* codec_specific_info,
 							   int64_t /*render_time_ms*/)
 	{
+		Native::TraceEvent(Native::kTraceReceive, 'i', input_image._timeStamp, input_image.capture_time_ms_);
+		Native::TraceScope trace(Native::kTraceDecode, input_image._timeStamp, input_image.capture_time_ms_);
+
 		if (!inited_)
 		{
 			return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
@@ -1,15 +1,15 @@
-
-#include "webrtc/media/base/yuvframegenerator.h"
+#include "yuvframegenerator.h"
 
 #include <string.h>
-#include <sstream>
+#include <algorithm>
+
+#include "libyuv/planar_functions.h"
 
 #include "webrtc/base/basictypes.h"
 #include "webrtc/base/common.h"
 
-namespace cricket
+namespace Native
 {
-
 	// These values were figured out by trial and error. If you change any
 	// basic parameters e.g. unit-bar size or bars-x-offset, you may need to change
 	// background-width/background-height.
@@ -21,19 +21,27 @@ namespace cricket
 	const int kBarcodeNormalBarHeight = 80;
 	const int kBarcodeGuardBarHeight = 96;
 	const int kBarcodeMaxEncodableDigits = 7;
+	const uint32_t kBarcodeMaxValue = 10000000;
+
+	// For each digit: 0-9, |kEanEncodings| contains a bit-mask indicating
+	// which bars are black (1) and which are blank (0). These are for the L-code
+	// only. R-code values are bitwise negation of these. Reference:
+	// http://en.wikipedia.org/wiki/European_Article_Number#Binary_encoding_of_data_digits_into_EAN-13_barcode // NOLINT
+	const uint8_t kEanEncodings[] = { 13, 25, 19, 61, 35, 49, 47, 59, 55, 11 };
 
-	YuvFrameGenerator::YuvFrameGenerator(int width, int height,
-										 bool enable_barcode)
+	YuvFrameGenerator::YuvFrameGenerator(int width, int height, bool enable_barcode) :
+		width_(width),
+		height_(height),
+		chroma_width_((width + 1) / 2),
+		chroma_height_((height + 1) / 2),
+		frame_index_(0),
+		drawn_(),
+		frames_(0)
 	{
-		width_ = width;
-		height_ = height;
-		frame_index_ = 0;
-		int size = width_ * height_;
-		int qsize = size / 4;
-		frame_data_size_ = size + 2 * qsize;
-		y_data_ = new uint8_t[size];
-		u_data_ = new uint8_t[qsize];
-		v_data_ = new uint8_t[qsize];
+		y_data_.reset(new uint8_t[width_ * height_]);
+		u_data_.reset(new uint8_t[chroma_width_ * chroma_height_]);
+		v_data_.reset(new uint8_t[chroma_width_ * chroma_height_]);
+
 		if (enable_barcode)
 		{
 			ASSERT(width_ >= kBarcodeBackgroundWidth);
@@ -46,135 +54,153 @@ namespace cricket
 			barcode_start_x_ = -1;
 			barcode_start_y_ = -1;
 		}
+
+		DrawBackground();
 	}
 
 	YuvFrameGenerator::~YuvFrameGenerator()
 	{
-		delete y_data_;
-		delete u_data_;
-		delete v_data_;
 	}
 
-	void YuvFrameGenerator::GenerateNextFrame(uint8_t* frame_buffer,
-											  int32_t barcode_value)
+	void YuvFrameGenerator::DrawBackground()
 	{
-		int size = width_ * height_;
-		int qsize = size / 4;
-		memset(y_data_, 0, size);
-		memset(u_data_, 0, qsize);
-		memset(v_data_, 0, qsize);
-
-		DrawLandscape(y_data_, width_, height_);
-		DrawGradientX(u_data_, width_ / 2, height_ / 2);
-		DrawGradientY(v_data_, width_ / 2, height_ / 2);
-		DrawMovingLineX(u_data_, width_ / 2, height_ / 2, frame_index_);
-		DrawMovingLineY(v_data_, width_ / 2, height_ / 2, frame_index_);
-		DrawBouncingCube(y_data_, width_, height_, frame_index_);
-
-		if (barcode_value >= 0)
+		// landscape with striped crosshair
+		uint8_t * p = y_data_.get();
+		const int w = width_;
+		const int h = height_;
+		for (int y = 0; y < h; y++)
 		{
-			ASSERT(barcode_start_x_ != -1);
-			DrawBarcode(barcode_value);
-		}
-
-		memcpy(frame_buffer, y_data_, size);
-		frame_buffer += size;
-		memcpy(frame_buffer, u_data_, qsize);
-		frame_buffer += qsize;
-		memcpy(frame_buffer, v_data_, qsize);
-
-		frame_index_ = (frame_index_ + 1) & 0x0000FFFF;
-	}
-
-	void YuvFrameGenerator::DrawLandscape(uint8_t* p, int w, int h)
-	{
-		int x, y;
-		for (y = 0; y < h; y++)
-		{
-			for (x = 0; x < w; x++)
+			const bool stripe_y = (y > h / 2 - (h / 32)) && (y < h / 2 + (h / 32));
+			for (int x = 0; x < w; x++)
 			{
-				p[x + y * w] = x % (y + 1);
-				if (((x > w / 2 - (w / 32)) && (x < w / 2 + (w / 32))) ||
-					((y > h / 2 - (h / 32)) && (y < h / 2 + (h / 32))))
+				const bool stripe_x = (x > w / 2 - (w / 32)) && (x < w / 2 + (w / 32));
+				if (stripe_x || stripe_y)
 				{
 					p[x + y * w] = (((x + y) / 8 % 2)) ? 255 : 0;
 				}
+				else
+				{
+					p[x + y * w] = x % (y + 1);
+				}
 			}
 		}
-	}
 
-	void YuvFrameGenerator::DrawGradientX(uint8_t* p, int w, int h)
-	{
-		int x, y;
-		for (y = 0; y < h; y++)
+		// horizontal gradient in U, every row is the same
+		const int cw = chroma_width_;
+		const int ch = chroma_height_;
+		uint8_t * u = u_data_.get();
+		for (int x = 0; x < cw; x++)
 		{
-			for (x = 0; x < w; x++)
-			{
-				p[x + y * w] = (x << 8) / w;
-			}
+			u[x] = (x << 8) / cw;
+		}
+		for (int y = 1; y < ch; y++)
+		{
+			memcpy(u + y * cw, u, cw);
 		}
-	}
 
-	void YuvFrameGenerator::DrawGradientY(uint8_t* p, int w, int h)
-	{
-		int x, y;
-		for (y = 0; y < h; y++)
+		// vertical gradient in V, every row is a single value
+		uint8_t * v = v_data_.get();
+		for (int y = 0; y < ch; y++)
 		{
-			for (x = 0; x < w; x++)
-			{
-				p[x + y * w] = (y << 8) / h;
-			}
+			memset(v + y * cw, (y << 8) / ch, cw);
 		}
 	}
 
-	void YuvFrameGenerator::DrawMovingLineX(uint8_t* p, int w, int h, int n)
+	void YuvFrameGenerator::GenerateNextFrame(webrtc::I420Buffer * buffer, int32_t barcode_value)
 	{
-		int x, y;
-		x = n % (w * 2);
-		if (x >= w) x = w + w - x - 1;
-		for (y = 0; y < h; y++)
+		ASSERT(buffer->width() == width_ && buffer->height() == height_);
+
+		Drawn * drawn = Find(buffer);
+		if (drawn->buffer == buffer)
 		{
-			p[x + y * w] = 255;
+			Restore(buffer, drawn->dirty);
 		}
-	}
+		else
+		{
+			libyuv::CopyPlane(y_data_.get(), width_, buffer->MutableDataY(), buffer->StrideY(), width_, height_);
+			libyuv::CopyPlane(u_data_.get(), chroma_width_, buffer->MutableDataU(), buffer->StrideU(), chroma_width_, chroma_height_);
+			libyuv::CopyPlane(v_data_.get(), chroma_width_, buffer->MutableDataV(), buffer->StrideV(), chroma_width_, chroma_height_);
+			drawn->buffer = buffer;
+		}
+		drawn->frame = ++frames_;
 
-	void YuvFrameGenerator::DrawMovingLineY(uint8_t* p, int w, int h, int n)
-	{
-		int x, y;
-		y = n % (h * 2);
-		if (y >= h) y = h + h - y - 1;
-		for (x = 0; x < w; x++)
+		Dirty & dirty = drawn->dirty;
+		dirty = Dirty();
+
+		const int n = frame_index_;
+
+		// moving line in U
+		{
+			int x = n % (chroma_width_ * 2);
+			if (x >= chroma_width_) x = chroma_width_ + chroma_width_ - x - 1;
+
+			Rect r = { x, 0, 1, chroma_height_ };
+			Fill(buffer->MutableDataU(), buffer->StrideU(), r, 255);
+			dirty.u[0] = r;
+		}
+
+		// moving line in V
+		{
+			int y = n % (chroma_height_ * 2);
+			if (y >= chroma_height_) y = chroma_height_ + chroma_height_ - y - 1;
+
+			Rect r = { 0, y, chroma_width_, 1 };
+			Fill(buffer->MutableDataV(), buffer->StrideV(), r, 255);
+			dirty.v[0] = r;
+		}
+
+		// bouncing cube in Y
+		{
+			int pw = width_ / 16;
+			int ph = height_ / 16;
+			int px = n % (width_ * 2);
+			int py = n % (height_ * 2);
+			if (px >= width_) px = width_ + width_ - px - 1;
+			if (py >= height_) py = height_ + height_ - py - 1;
+
+			Rect r = Clip({ px - pw, py - ph, pw * 2, ph * 2 }, width_, height_);
+			Fill(buffer->MutableDataY(), buffer->StrideY(), r, 255);
+			dirty.y[0] = r;
+		}
+
+		if (barcode_value >= 0)
 		{
-			p[x + y * w] = 255;
+			ASSERT(barcode_start_x_ != -1);
+			DrawBarcode(buffer, static_cast<uint32_t>(barcode_value) % kBarcodeMaxValue, dirty);
 		}
+
+		frame_index_ = (frame_index_ + 1) & 0x0000FFFF;
 	}
 
-	void YuvFrameGenerator::DrawBouncingCube(uint8_t* p, int w, int h, int n)
+	// the record of |buffer|, or the least recently drawn one to reuse
+	YuvFrameGenerator::Drawn * YuvFrameGenerator::Find(const webrtc::I420Buffer * buffer)
 	{
-		int x, y, pw, ph, px, py;
-		pw = w / 16;
-		ph = h / 16;
-		px = n % (w * 2);
-		py = n % (h * 2);
-		if (px >= w) px = w + w - px - 1;
-		if (py >= h) py = h + h - py - 1;
-		for (y = py - ph; y < py + ph; y++)
+		Drawn * oldest = &drawn_[0];
+		for (size_t i = 0; i < kTracked; i++)
 		{
-			if (y >= 0 && y < h)
+			if (drawn_[i].buffer == buffer)
 			{
-				for (x = px - pw; x < px + pw; x++)
-				{
-					if (x >= 0 && x < w)
-					{
-						p[x + y * w] = 255;
-					}
-				}
+				return &drawn_[i];
+			}
+			if (frames_ - drawn_[i].frame > frames_ - oldest->frame)
+			{
+				oldest = &drawn_[i];
 			}
 		}
+		return oldest;
 	}
 
-	void YuvFrameGenerator::GetBarcodeBounds(int* top, int* left,
-											 int* width, int* height)
+	void YuvFrameGenerator::Restore(webrtc::I420Buffer * buffer, const Dirty & dirty)
+	{
+		for (int i = 0; i < 2; i++)
+		{
+			Copy(y_data_.get(), width_, buffer->MutableDataY(), buffer->StrideY(), dirty.y[i]);
+			Copy(u_data_.get(), chroma_width_, buffer->MutableDataU(), buffer->StrideU(), dirty.u[i]);
+			Copy(v_data_.get(), chroma_width_, buffer->MutableDataV(), buffer->StrideV(), dirty.v[i]);
+		}
+	}
+
+	void YuvFrameGenerator::GetBarcodeBounds(int * top, int * left, int * width, int * height) const
 	{
 		ASSERT(barcode_start_x_ != -1);
 		*top = barcode_start_y_;
@@ -183,130 +209,125 @@ namespace cricket
 		*height = kBarcodeBackgroundHeight;
 	}
 
-	static void ComputeBarcodeDigits(uint32_t value, std::stringstream* result)
+	void YuvFrameGenerator::DrawBarcode(webrtc::I420Buffer * buffer, uint32_t value, Dirty & dirty)
 	{
-		// Serialize |value| as 7-char string, padded with 0's to the left.
-		result->width(kBarcodeMaxEncodableDigits);
-		result->fill('0');
-		*result << value;
-
-		// Compute check-digit and append to result. Steps described here:
+		// Serialize |value| as 7 digits padded with 0's to the left and
+		// append the check-digit. Steps described here:
 		// http://en.wikipedia.org/wiki/European_Article_Number#Calculation_of_checksum_digit
+		int digits[kBarcodeMaxEncodableDigits + 1];
+		for (int pos = kBarcodeMaxEncodableDigits - 1; pos >= 0; pos--)
+		{
+			digits[pos] = value % 10;
+			value /= 10;
+		}
+
 		int sum = 0;
 		for (int pos = 1; pos <= kBarcodeMaxEncodableDigits; pos++)
 		{
-			char next_char;
-			result->get(next_char);
-			uint8_t digit = next_char - '0';
-			sum += digit * (pos % 2 ? 3 : 1);
+			sum += digits[pos - 1] * (pos % 2 ? 3 : 1);
 		}
-		uint8_t check_digit = sum % 10;
+		int check_digit = sum % 10;
 		if (check_digit != 0)
 		{
 			check_digit = 10 - check_digit;
 		}
+		digits[kBarcodeMaxEncodableDigits] = check_digit;
 
-		*result << static_cast<int>(check_digit);
-		result->seekg(0);
-	}
+		// Draw white filled rectangle as background to barcode.
+		Rect ry = { barcode_start_x_, barcode_start_y_, kBarcodeBackgroundWidth, kBarcodeBackgroundHeight };
+		Rect ruv = { barcode_start_x_ / 2, barcode_start_y_ / 2, kBarcodeBackgroundWidth / 2, kBarcodeBackgroundHeight / 2 };
 
-	void YuvFrameGenerator::DrawBarcode(uint32_t value)
-	{
-		std::stringstream value_str_stream;
-		ComputeBarcodeDigits(value, &value_str_stream);
+		Fill(buffer->MutableDataY(), buffer->StrideY(), ry, 255);
+		Fill(buffer->MutableDataU(), buffer->StrideU(), ruv, 128);
+		Fill(buffer->MutableDataV(), buffer->StrideV(), ruv, 128);
+
+		dirty.y[1] = ry;
+		dirty.u[1] = ruv;
+		dirty.v[1] = ruv;
+
+		// Scan through digits and draw black bars.
+		uint8_t * p = buffer->MutableDataY();
+		const int stride = buffer->StrideY();
 
-		// Draw white filled rectangle as background to barcode.
-		DrawBlockRectangle(y_data_, barcode_start_x_, barcode_start_y_,
-						   kBarcodeBackgroundWidth, kBarcodeBackgroundHeight,
-						   width_, 255);
-		DrawBlockRectangle(u_data_, barcode_start_x_ / 2, barcode_start_y_ / 2,
-						   kBarcodeBackgroundWidth / 2, kBarcodeBackgroundHeight / 2,
-						   width_ / 2, 128);
-		DrawBlockRectangle(v_data_, barcode_start_x_ / 2, barcode_start_y_ / 2,
-						   kBarcodeBackgroundWidth / 2, kBarcodeBackgroundHeight / 2,
-						   width_ / 2, 128);
-
-		// Scan through chars (digits) and draw black bars.
 		int x = barcode_start_x_ + kBarsXOffset;
 		int y = barcode_start_y_ + kBarsYOffset;
-		int pos = 0;
-		x = DrawSideGuardBars(x, y, kBarcodeGuardBarHeight);
-		while (true)
+
+		// side guard bars
+		x = DrawBars(p, stride, x, y, 2, kBarcodeGuardBarHeight);
+
+		for (int pos = 0; pos <= kBarcodeMaxEncodableDigits; pos++)
 		{
-			char next_char;
-			value_str_stream.get(next_char);
-			if (!value_str_stream.good())
+			if (pos == 4)
+			{
+				// middle guard bars
+				x = DrawBars(p, stride, x + kUnitBarSize, y, 2, kBarcodeGuardBarHeight) + kUnitBarSize;
+			}
+
+			uint8_t ean_encoding = kEanEncodings[digits[pos]];
+			if (pos >= 4)
 			{
-				break;
+				ean_encoding = ~ean_encoding;
 			}
-			if (pos++ == 4)
+			uint8_t mask = 0x40;
+			for (int i = 6; i >= 0; i--, mask >>= 1)
 			{
-				x = DrawMiddleGuardBars(x, y, kBarcodeGuardBarHeight);
+				if (ean_encoding & mask)
+				{
+					Rect r = { x, y, kUnitBarSize, kBarcodeNormalBarHeight };
+					Fill(p, stride, r, 0);
+				}
+				x += kUnitBarSize;
 			}
-			uint8_t digit = next_char - '0';
-			x = DrawEanEncodedDigit(digit, x, y, kBarcodeNormalBarHeight, pos > 4);
 		}
-		x = DrawSideGuardBars(x, y, kBarcodeGuardBarHeight);
-	}
-
-	int YuvFrameGenerator::DrawMiddleGuardBars(int x, int y, int height)
-	{
-		x += kUnitBarSize;
-		DrawBlockRectangle(y_data_, x, y, kUnitBarSize, height, width_, 0);
-		x += (kUnitBarSize * 2);
-		DrawBlockRectangle(y_data_, x, y, kUnitBarSize, height, width_, 0);
-		return x + (kUnitBarSize * 2);
-	}
 
-	int YuvFrameGenerator::DrawSideGuardBars(int x, int y, int height)
-	{
-		DrawBlockRectangle(y_data_, x, y, kUnitBarSize, height, width_, 0);
-		x += (kUnitBarSize * 2);
-		DrawBlockRectangle(y_data_, x, y, kUnitBarSize, height, width_, 0);
-		return x + kUnitBarSize;
+		// side guard bars
+		DrawBars(p, stride, x, y, 2, kBarcodeGuardBarHeight);
 	}
 
-	// For each digit: 0-9, |kEanEncodings| contains a bit-mask indicating
-	// which bars are black (1) and which are blank (0). These are for the L-code
-	// only. R-code values are bitwise negation of these. Reference:
-	// http://en.wikipedia.org/wiki/European_Article_Number#Binary_encoding_of_data_digits_into_EAN-13_barcode // NOLINT
-	const uint8_t kEanEncodings[] = { 13, 25, 19, 61, 35, 49, 47, 59, 55, 11 };
-
-	int YuvFrameGenerator::DrawEanEncodedDigit(int digit, int x, int y,
-											   int height, bool flip)
+	// Draws |count| black bars of unit width separated by a unit gap and
+	// returns the position right after the last bar.
+	int YuvFrameGenerator::DrawBars(uint8_t * p, int stride, int x, int y, int count, int height)
 	{
-		uint8_t ean_encoding = kEanEncodings[digit];
-		if (flip)
+		for (int i = 0; i < count; i++)
 		{
-			ean_encoding = ~ean_encoding;
-		}
-		uint8_t mask = 0x40;
-		for (int i = 6; i >= 0; i--, mask >>= 1)
-		{
-			if (ean_encoding & mask)
+			if (i > 0)
 			{
-				DrawBlockRectangle(y_data_, x, y, kUnitBarSize, height, width_, 0);
+				x += kUnitBarSize;
 			}
+			Rect r = { x, y, kUnitBarSize, height };
+			Fill(p, stride, r, 0);
 			x += kUnitBarSize;
 		}
 		return x;
 	}
 
-	void YuvFrameGenerator::DrawBlockRectangle(uint8_t* p,
-											   int x_start,
-											   int y_start,
-											   int width,
-											   int height,
-											   int pitch,
-											   uint8_t value)
+	void YuvFrameGenerator::Fill(uint8_t * p, int stride, const Rect & r, uint8_t value)
 	{
-		for (int x = x_start; x < x_start + width; x++)
+		if (r.w > 0 && r.h > 0)
 		{
-			for (int y = y_start; y < y_start + height; y++)
-			{
-				p[x + y * pitch] = value;
-			}
+			libyuv::SetPlane(p + r.y * stride + r.x, stride, r.w, r.h, value);
 		}
 	}
 
-}  // namespace cricket
\ No newline at end of file
+	void YuvFrameGenerator::Copy(const uint8_t * src, int src_stride, uint8_t * dst, int dst_stride, const Rect & r)
+	{
+		if (r.w > 0 && r.h > 0)
+		{
+			libyuv::CopyPlane(src + r.y * src_stride + r.x, src_stride, dst + r.y * dst_stride + r.x, dst_stride, r.w, r.h);
+		}
+	}
+
+	YuvFrameGenerator::Rect YuvFrameGenerator::Clip(const Rect & r, int w, int h)
+	{
+		int x0 = std::max(r.x, 0);
+		int y0 = std::max(r.y, 0);
+		int x1 = std::min(r.x + r.w, w);
+		int y1 = std::min(r.y + r.h, h);
+		if (x1 <= x0 || y1 <= y0)
+		{
+			return Rect();
+		}
+		Rect c = { x0, y0, x1 - x0, y1 - y0 };
+		return c;
+	}
+}
@@ -3,6 +3,9 @@
 #include "internals.h"
 #include "defaults.h"
 #include "conductor.h"
+#include "audioconference.h"
+#include "stats.h"
+#include "trace.h"
 #pragma managed
 
 #include "msclr\marshal_cppstd.h"
@@ -30,6 +33,383 @@ namespace WebRtc
 {
 	namespace NET
 	{
+		// Native::SessionStats, -1 where a value is not known yet
+		public value struct SessionStats
+		{
+			Int64 TimestampUs;
+			Double RttMs;
+			Double AvailableSendBps;
+			Double AvailableReceiveBps;
+			Double JitterMs;
+			Double FractionLost;
+			Int64 PacketsReceived;
+			Int64 PacketsLost;
+			Int64 BytesReceived;
+			Int64 FramesDecoded;
+			Int64 FramesDropped;
+			Double DecodeFps;
+			Int64 PacketsSent;
+			Int64 BytesSent;
+			Int64 FramesEncoded;
+			Double EncodeFps;
+			Double EncodeMs;
+			Double Qp;
+			Double AudioDelayMs;
+			Double JitterBufferMs;
+			Double PreferredBufferMs;
+			Double ExpandRate;
+			Double SpeechExpandRate;
+			Double AccelerateRate;
+			Double PreemptiveExpandRate;
+			Double SecondaryDecodedRate;
+			Int64 DecodingNormal;
+			Int64 DecodingPlc;
+			Int64 DecodingCng;
+			Int64 DecodingPlcCng;
+			Int64 DecodingMuted;
+
+		internal:
+			static SessionStats FromNative(const Native::SessionStats & s)
+			{
+				SessionStats r;
+				r.TimestampUs = s.timestamp_us;
+				r.RttMs = s.rtt_ms;
+				r.AvailableSendBps = s.available_send_bps;
+				r.AvailableReceiveBps = s.available_receive_bps;
+				r.JitterMs = s.jitter_ms;
+				r.FractionLost = s.fraction_lost;
+				r.PacketsReceived = s.packets_received;
+				r.PacketsLost = s.packets_lost;
+				r.BytesReceived = s.bytes_received;
+				r.FramesDecoded = s.frames_decoded;
+				r.FramesDropped = s.frames_dropped;
+				r.DecodeFps = s.decode_fps;
+				r.PacketsSent = s.packets_sent;
+				r.BytesSent = s.bytes_sent;
+				r.FramesEncoded = s.frames_encoded;
+				r.EncodeFps = s.encode_fps;
+				r.EncodeMs = s.encode_ms;
+				r.Qp = s.qp;
+				r.AudioDelayMs = s.audio_delay_ms;
+				r.JitterBufferMs = s.jitter_buffer_ms;
+				r.PreferredBufferMs = s.preferred_buffer_ms;
+				r.ExpandRate = s.expand_rate;
+				r.SpeechExpandRate = s.speech_expand_rate;
+				r.AccelerateRate = s.accelerate_rate;
+				r.PreemptiveExpandRate = s.preemptive_expand_rate;
+				r.SecondaryDecodedRate = s.secondary_decoded_rate;
+				r.DecodingNormal = s.decoding_normal;
+				r.DecodingPlc = s.decoding_plc;
+				r.DecodingCng = s.decoding_cng;
+				r.DecodingPlcCng = s.decoding_plc_cng;
+				r.DecodingMuted = s.decoding_muted;
+				return r;
+			}
+		};
+
+		// Native::AudioProcessingConfig, start from Defaults() or Bypass()
+		public value struct AudioProcessingConfig
+		{
+			Boolean Bypass;
+			Boolean EchoCancellation;
+			Boolean ExtendedFilterAec;
+			Boolean DelayAgnosticAec;
+			Boolean ResidualEchoDetector;
+			Boolean AutoGainControl;
+			Boolean ExperimentalAgc;
+			Boolean LevelControl;
+			Boolean NoiseSuppression;
+			Boolean ExperimentalNs;
+			Boolean HighpassFilter;
+			Boolean TypingDetection;
+
+			// what the voice engine does by default
+			static AudioProcessingConfig Defaults()
+			{
+				return FromNative(Native::AudioProcessingConfig());
+			}
+
+			// no processing at all, for bots sending clean audio
+			static AudioProcessingConfig None()
+			{
+				AudioProcessingConfig r = Defaults();
+				r.Bypass = true;
+				return r;
+			}
+
+		internal:
+			static AudioProcessingConfig FromNative(const Native::AudioProcessingConfig & c)
+			{
+				AudioProcessingConfig r;
+				r.Bypass = c.bypass;
+				r.EchoCancellation = c.echo_cancellation;
+				r.ExtendedFilterAec = c.extended_filter_aec;
+				r.DelayAgnosticAec = c.delay_agnostic_aec;
+				r.ResidualEchoDetector = c.residual_echo_detector;
+				r.AutoGainControl = c.auto_gain_control;
+				r.ExperimentalAgc = c.experimental_agc;
+				r.LevelControl = c.level_control;
+				r.NoiseSuppression = c.noise_suppression;
+				r.ExperimentalNs = c.experimental_ns;
+				r.HighpassFilter = c.highpass_filter;
+				r.TypingDetection = c.typing_detection;
+				return r;
+			}
+
+			Native::AudioProcessingConfig ToNative()
+			{
+				Native::AudioProcessingConfig c;
+				c.bypass = Bypass;
+				c.echo_cancellation = EchoCancellation;
+				c.extended_filter_aec = ExtendedFilterAec;
+				c.delay_agnostic_aec = DelayAgnosticAec;
+				c.residual_echo_detector = ResidualEchoDetector;
+				c.auto_gain_control = AutoGainControl;
+				c.experimental_agc = ExperimentalAgc;
+				c.level_control = LevelControl;
+				c.noise_suppression = NoiseSuppression;
+				c.experimental_ns = ExperimentalNs;
+				c.highpass_filter = HighpassFilter;
+				c.typing_detection = TypingDetection;
+				return c;
+			}
+		};
+
+		// Native::OpusConfig, 0 or for Dtx and Fec -1 leaves a value to the remote
+		public value struct OpusConfig
+		{
+			Int32 FrameMs;
+			Int32 MaxBitrateBps;
+			Int32 Channels;
+			Int32 Dtx;
+			Int32 Fec;
+
+			// serialized audio network adaptor config, null disables it
+			array<Byte> ^ NetworkAdaptorConfig;
+
+			static OpusConfig Defaults()
+			{
+				OpusConfig r;
+				r.Dtx = -1;
+				r.Fec = -1;
+				return r;
+			}
+
+		internal:
+			Native::OpusConfig ToNative()
+			{
+				Native::OpusConfig c;
+				c.frame_ms = FrameMs;
+				c.max_bitrate_bps = MaxBitrateBps;
+				c.channels = Channels;
+				c.dtx = Dtx;
+				c.fec = Fec;
+				if (NetworkAdaptorConfig != nullptr && NetworkAdaptorConfig->Length > 0)
+				{
+					pin_ptr<Byte> p = &NetworkAdaptorConfig[0];
+					c.network_adaptor_config.assign(reinterpret_cast<const char*>(p), NetworkAdaptorConfig->Length);
+				}
+				return c;
+			}
+		};
+
+		// Native::VideoCodecPreference, start from Defaults()
+		public value struct VideoCodecPreference
+		{
+			// e.g. "VP9", "H264", "VP8", most preferred first
+			array<String ^> ^ Order;
+			Int32 Vp9SpatialLayers;
+			Int32 Vp9TemporalLayers;
+
+			// null and -1 keep what the engine offers
+			String ^ H264ProfileLevelId;
+			Int32 H264PacketizationMode;
+
+			static VideoCodecPreference Defaults()
+			{
+				VideoCodecPreference r;
+				r.Vp9SpatialLayers = 1;
+				r.Vp9TemporalLayers = 1;
+				r.H264PacketizationMode = -1;
+				return r;
+			}
+
+		internal:
+			Native::VideoCodecPreference ToNative()
+			{
+				Native::VideoCodecPreference p;
+				if (Order != nullptr)
+				{
+					for each (String ^ name in Order)
+					{
+						p.order.push_back(marshal_as<std::string>(name));
+					}
+				}
+				p.vp9_spatial_layers = Vp9SpatialLayers;
+				p.vp9_temporal_layers = Vp9TemporalLayers;
+				if (H264ProfileLevelId != nullptr)
+				{
+					p.h264_profile_level_id = marshal_as<std::string>(H264ProfileLevelId);
+				}
+				p.h264_packetization_mode = H264PacketizationMode;
+				return p;
+			}
+		};
+
+		public enum class DegradationPreference
+		{
+			MaintainFramerate = Native::kMaintainFramerate,
+			MaintainResolution = Native::kMaintainResolution
+		};
+
+		// Native::VideoEncoding, 0 lifts a limit; start from Defaults()
+		public value struct VideoEncoding
+		{
+			Int32 MinBitrateBps;
+			Int32 StartBitrateBps;
+			Int32 MaxBitrateBps;
+			Int32 MaxWidth;
+			Int32 MaxHeight;
+			Int32 MaxFps;
+			DegradationPreference Degradation;
+			bool QualityScaler;
+
+			static VideoEncoding Defaults()
+			{
+				Native::VideoEncoding e;
+				VideoEncoding r;
+				r.Degradation = static_cast<DegradationPreference>(e.degradation);
+				r.QualityScaler = e.quality_scaler;
+				return r;
+			}
+
+		internal:
+			Native::VideoEncoding ToNative()
+			{
+				Native::VideoEncoding e;
+				e.min_bitrate_bps = MinBitrateBps;
+				e.start_bitrate_bps = StartBitrateBps;
+				e.max_bitrate_bps = MaxBitrateBps;
+				e.max_width = MaxWidth;
+				e.max_height = MaxHeight;
+				e.max_fps = MaxFps;
+				e.degradation = static_cast<Native::DegradationPreference>(Degradation);
+				e.quality_scaler = QualityScaler;
+				return e;
+			}
+		};
+
+		public value struct RelayCounters
+		{
+			UInt64 PacketsToPeer;
+			UInt64 BytesToPeer;
+			UInt64 PacketsFromPeer;
+			UInt64 BytesFromPeer;
+
+		internal:
+			static RelayCounters FromNative(const Native::RelayCounters & c)
+			{
+				RelayCounters r;
+				r.PacketsToPeer = c.packets_to_peer;
+				r.BytesToPeer = c.bytes_to_peer;
+				r.PacketsFromPeer = c.packets_from_peer;
+				r.BytesFromPeer = c.bytes_from_peer;
+				return r;
+			}
+		};
+
+		// Native::BatchedUdpSocket::Counters
+		public value struct ServerSocketStats
+		{
+			UInt64 PacketsReceived;
+			UInt64 BytesReceived;
+			UInt64 PacketsSent;
+			UInt64 BytesSent;
+			UInt64 Drops;
+
+		internal:
+			static ServerSocketStats FromNative(const Native::BatchedUdpSocket::Counters & c)
+			{
+				ServerSocketStats r;
+				r.PacketsReceived = c.packets_received;
+				r.BytesReceived = c.bytes_received;
+				r.PacketsSent = c.packets_sent;
+				r.BytesSent = c.bytes_sent;
+				r.Drops = c.drops;
+				return r;
+			}
+		};
+
+		public value struct TurnAllocationStats
+		{
+			String ^ Username;
+			String ^ Client;
+			String ^ Relay;
+			Int64 CreatedMs;
+			RelayCounters Relayed;
+		};
+
+		public value struct TurnUserStats
+		{
+			String ^ Username;
+			UInt64 Allocations;
+			UInt32 Active;
+			RelayCounters Relayed;
+		};
+
+		// Native::ServerStats, cumulative since the servers started
+		public value struct ServerStats
+		{
+			Int64 TimestampMs;
+			ServerSocketStats Stun;
+			ServerSocketStats Turn;
+			UInt64 AllocationsCreated;
+			UInt64 AllocationsActive;
+			UInt64 AuthFailures;
+			UInt64 PermissionMisses;
+			UInt64 RelayDrops;
+			RelayCounters Relayed;
+			array<TurnAllocationStats> ^ Allocations;
+			array<TurnUserStats> ^ Users;
+
+		internal:
+			static ServerStats FromNative(const Native::ServerStats & s)
+			{
+				ServerStats r;
+				r.TimestampMs = s.timestamp_ms;
+				r.Stun = ServerSocketStats::FromNative(s.stun);
+				r.Turn = ServerSocketStats::FromNative(s.turn);
+				r.AllocationsCreated = s.allocations_created;
+				r.AllocationsActive = s.allocations_active;
+				r.AuthFailures = s.auth_failures;
+				r.PermissionMisses = s.permission_misses;
+				r.RelayDrops = s.relay_drops;
+				r.Relayed = RelayCounters::FromNative(s.relayed);
+
+				r.Allocations = gcnew array<TurnAllocationStats>(static_cast<int>(s.allocations.size()));
+				for (int i = 0; i < r.Allocations->Length; ++i)
+				{
+					const Native::AllocationStats & a = s.allocations[i];
+					r.Allocations[i].Username = marshal_as<String^>(a.username);
+					r.Allocations[i].Client = marshal_as<String^>(a.client.ToString());
+					r.Allocations[i].Relay = marshal_as<String^>(a.relay.ToString());
+					r.Allocations[i].CreatedMs = a.created_ms;
+					r.Allocations[i].Relayed = RelayCounters::FromNative(a.relayed);
+				}
+
+				r.Users = gcnew array<TurnUserStats>(static_cast<int>(s.users.size()));
+				for (int i = 0; i < r.Users->Length; ++i)
+				{
+					const Native::UserStats & u = s.users[i];
+					r.Users[i].Username = marshal_as<String^>(u.username);
+					r.Users[i].Allocations = u.allocations;
+					r.Users[i].Active = u.active;
+					r.Users[i].Relayed = RelayCounters::FromNative(u.relayed);
+				}
+				return r;
+			}
+		};
+
 		public ref class ManagedConductor
 		{
 		private:
@@ -37,7 +417,7 @@ namespace WebRtc
 			bool m_isDisposed;
 			Native::Conductor * cd;
 
-			delegate void _OnRenderCallback(uint8_t * frame_buffer, uint32_t w, uint32_t h);
+			delegate void _OnRenderCallback(uint8_t * frame_buffer, uint32_t w, uint32_t h, int64_t render_time_ms, int64_t ntp_time_ms);
 			_OnRenderCallback ^ onRenderLocal;
 			_OnRenderCallback ^ onRenderRemote;
 			GCHandle ^ onRenderLocalHandle;			
@@ -67,6 +447,50 @@ namespace WebRtc
 			_OnIceCandidateCallback ^ onIceCandidate;
 			GCHandle ^ onIceCandidateHandle;
 
+			delegate void _OnDataBufferCallback(int channel, Native::DataBufferRef * buffer, const uint8_t * data, uint32_t size);
+			_OnDataBufferCallback ^ onDataBuffer;
+			GCHandle ^ onDataBufferHandle;
+
+			delegate void _OnDataChannelCallback(int channel, const char * label);
+			_OnDataChannelCallback ^ onDataChannel;
+			GCHandle ^ onDataChannelHandle;
+
+			delegate void _OnChannelMessageCallback(int channel, const uint8_t * data, uint32_t size, bool binary);
+			_OnChannelMessageCallback ^ onChannelMessage;
+			GCHandle ^ onChannelMessageHandle;
+
+			delegate void _OnChannelStateCallback(int channel, int state);
+			_OnChannelStateCallback ^ onChannelStateChange;
+			GCHandle ^ onChannelStateChangeHandle;
+
+			delegate void _OnChannelWritableCallback(int channel, uint64_t buffered_amount);
+			_OnChannelWritableCallback ^ onChannelWritable;
+			GCHandle ^ onChannelWritableHandle;
+
+			delegate void _OnChannelBatchCallback(int channel, const uint8_t * data, const uint32_t * offsets, const uint32_t * sizes, const uint8_t * binary, uint32_t count);
+			_OnChannelBatchCallback ^ onChannelBatch;
+			GCHandle ^ onChannelBatchHandle;
+
+			delegate void _OnFileOfferCallback(int transfer, const char * name, uint64_t size, uint64_t offset);
+			_OnFileOfferCallback ^ onFileOffer;
+			GCHandle ^ onFileOfferHandle;
+
+			delegate void _OnFileProgressCallback(int transfer, uint64_t done, uint64_t total);
+			_OnFileProgressCallback ^ onFileProgress;
+			GCHandle ^ onFileProgressHandle;
+
+			delegate void _OnFileCompleteCallback(int transfer, const char * path, int status);
+			_OnFileCompleteCallback ^ onFileComplete;
+			GCHandle ^ onFileCompleteHandle;
+
+			delegate void _OnRemoteAudioCallback(const int16_t * data, int sample_rate, uint32_t channels, uint32_t frames, uint32_t timestamp, int64_t ntp_time_ms);
+			_OnRemoteAudioCallback ^ onRemoteAudio;
+			GCHandle ^ onRemoteAudioHandle;
+
+			delegate void _OnStatsCallback(const Native::SessionStats * stats);
+			_OnStatsCallback ^ onStats;
+			GCHandle ^ onStatsHandle;
+
 			void FreeGCHandle(GCHandle ^% g)
 			{
 				if (g != nullptr)
@@ -126,14 +550,100 @@ namespace WebRtc
 				OnDataBinaryMessage(data_array);
 			}
 
-			void _OnRenderLocal(uint8_t * frame_buffer, uint32_t w, uint32_t h)
+			void _OnDataBuffer(int channel, Native::DataBufferRef * buffer, const uint8_t * data, uint32_t size)
+			{
+				OnDataBuffer(channel, IntPtr(buffer), IntPtr(const_cast<uint8_t*>(data)), size);
+			}
+
+			void _OnDataChannel(int channel, const char * label)
+			{
+				OnDataChannel(channel, marshal_as<String^>(label));
+			}
+
+			void _OnChannelMessage(int channel, const uint8_t * data, uint32_t size, bool binary)
+			{
+				if (binary)
+				{
+					array<Byte>^ data_array = gcnew array<Byte>(size);
+					Marshal::Copy(IntPtr(const_cast<uint8_t*>(data)), data_array, 0, size);
+
+					OnChannelDataBinaryMessage(channel, data_array);
+					OnDataBinaryMessage(data_array);
+				}
+				else
+				{
+					String ^ msg = marshal_as<String^>(std::string(reinterpret_cast<const char*>(data), size));
+
+					OnChannelDataMessage(channel, msg);
+					OnDataMessage(msg);
+				}
+			}
+
+			void _OnChannelStateChange(int channel, int state)
+			{
+				OnChannelStateChange(channel, state);
+			}
+
+			void _OnChannelWritable(int channel, uint64_t buffered_amount)
+			{
+				OnChannelWritable(channel, buffered_amount);
+			}
+
+			void _OnRemoteAudio(const int16_t * data, int sample_rate, uint32_t channels, uint32_t frames, uint32_t timestamp, int64_t ntp_time_ms)
+			{
+				OnRemoteAudio(IntPtr(const_cast<int16_t*>(data)), sample_rate, channels, frames, timestamp, ntp_time_ms);
+			}
+
+			void _OnChannelBatch(int channel, const uint8_t * data, const uint32_t * offsets, const uint32_t * sizes, const uint8_t * binary, uint32_t count)
+			{
+				// one copy per batch, not per message
+				int length = count > 0 ? offsets[count - 1] + sizes[count - 1] : 0;
+				array<Byte>^ data_array = gcnew array<Byte>(length);
+				array<Int32>^ offset_array = gcnew array<Int32>(count);
+				array<Int32>^ size_array = gcnew array<Int32>(count);
+				array<bool>^ binary_array = gcnew array<bool>(count);
+
+				if (length > 0)
+				{
+					Marshal::Copy(IntPtr(const_cast<uint8_t*>(data)), data_array, 0, length);
+				}
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					offset_array[i] = offsets[i];
+					size_array[i] = sizes[i];
+					binary_array[i] = binary[i] != 0;
+				}
+				OnChannelBatch(channel, data_array, offset_array, size_array, binary_array);
+			}
+
+			void _OnFileOffer(int transfer, const char * name, uint64_t size, uint64_t offset)
+			{
+				OnFileOffer(transfer, marshal_as<String^>(rtc::ToUtf16(name)), size, offset);
+			}
+
+			void _OnFileProgress(int transfer, uint64_t done, uint64_t total)
+			{
+				OnFileProgress(transfer, done, total);
+			}
+
+			void _OnFileComplete(int transfer, const char * path, int status)
+			{
+				OnFileComplete(transfer, marshal_as<String^>(rtc::ToUtf16(path)), status);
+			}
+
+			void _OnStats(const Native::SessionStats * stats)
 			{
-				OnRenderLocal(frame_buffer, w, h);
+				OnStats(SessionStats::FromNative(*stats));
 			}
 
-			void _OnRenderRemote(uint8_t * frame_buffer, uint32_t w, uint32_t h)
+			void _OnRenderLocal(uint8_t * frame_buffer, uint32_t w, uint32_t h, int64_t render_time_ms, int64_t ntp_time_ms)
 			{
-				OnRenderRemote(frame_buffer, w, h);
+				OnRenderLocal(frame_buffer, w, h, render_time_ms, ntp_time_ms);
+			}
+
+			void _OnRenderRemote(uint8_t * frame_buffer, uint32_t w, uint32_t h, int64_t render_time_ms, int64_t ntp_time_ms)
+			{
+				OnRenderRemote(frame_buffer, w, h, render_time_ms, ntp_time_ms);
 			}
 
 		public:
@@ -156,10 +666,61 @@ namespace WebRtc
 			delegate void OnCallbackDataBinaryMessage(array<Byte>^ msg);
 			event OnCallbackDataBinaryMessage ^ OnDataBinaryMessage;
 
-			delegate void OnCallbackRender(System::Byte * frame_buffer, System::UInt32 w, System::UInt32 h);
+			// |renderTimeMs| on the local clock, the capture time for local frames; |ntpTimeMs|
+			// when the sender captured the frame, 0 until RTCP aligned the remote stream
+			delegate void OnCallbackRender(System::Byte * frame_buffer, System::UInt32 w, System::UInt32 h, Int64 renderTimeMs, Int64 ntpTimeMs);
 			event OnCallbackRender ^ OnRenderLocal;
 			event OnCallbackRender ^ OnRenderRemote;
 
+			// |frames| interleaved 16-bit frames at |data|, valid during the call only, on the
+			// audio thread; |timestamp| counts frames, see SetRemoteAudioFormat; |ntpTimeMs| when
+			// the sender captured the first frame, needs EnablePushAudio, 0 when not known
+			delegate void OnCallbackRemoteAudio(IntPtr data, Int32 sampleRate, UInt32 channels, UInt32 frames, UInt32 timestamp, Int64 ntpTimeMs);
+			event OnCallbackRemoteAudio ^ OnRemoteAudio;
+
+			// |data| stays valid until ReleaseDataBuffer(|buffer|), from any thread
+			delegate void OnCallbackDataBuffer(Int32 channel, IntPtr buffer, IntPtr data, UInt32 size);
+			event OnCallbackDataBuffer ^ OnDataBuffer;
+
+			// remote opened a channel, |channel| is its handle
+			delegate void OnCallbackDataChannel(Int32 channel, String ^ label);
+			event OnCallbackDataChannel ^ OnDataChannel;
+
+			// OnDataMessage/OnDataBinaryMessage are raised as well, for any channel
+			delegate void OnCallbackChannelDataMessage(Int32 channel, String ^ msg);
+			event OnCallbackChannelDataMessage ^ OnChannelDataMessage;
+
+			delegate void OnCallbackChannelDataBinaryMessage(Int32 channel, array<Byte>^ msg);
+			event OnCallbackChannelDataBinaryMessage ^ OnChannelDataBinaryMessage;
+
+			// |state| is 0 connecting, 1 open, 2 closing, 3 closed
+			delegate void OnCallbackChannelState(Int32 channel, Int32 state);
+			event OnCallbackChannelState ^ OnChannelStateChange;
+
+			// DataChannelSendAsync went above the high watermark and the
+			// channel drained to the low one, safe to send again
+			delegate void OnCallbackChannelWritable(Int32 channel, UInt64 bufferedAmount);
+			event OnCallbackChannelWritable ^ OnChannelWritable;
+
+			// channels with SetReceiveBatching, message i is sizes[i] bytes at
+			// data[offsets[i]], text messages are UTF-8
+			delegate void OnCallbackChannelBatch(Int32 channel, array<Byte>^ data, array<Int32>^ offsets, array<Int32>^ sizes, array<bool>^ binary);
+			event OnCallbackChannelBatch ^ OnChannelBatch;
+
+			// incoming file, |offset| > 0 when an earlier .part is resumed
+			delegate void OnCallbackFileOffer(Int32 transfer, String ^ name, UInt64 size, UInt64 offset);
+			event OnCallbackFileOffer ^ OnFileOffer;
+
+			delegate void OnCallbackFileProgress(Int32 transfer, UInt64 done, UInt64 total);
+			event OnCallbackFileProgress ^ OnFileProgress;
+
+			// |status| 0 ok, 1 cancelled, 2 i/o error, 3 hash mismatch, 4 channel closed, 5 refused
+			delegate void OnCallbackFileComplete(Int32 transfer, String ^ path, Int32 status);
+			event OnCallbackFileComplete ^ OnFileComplete;
+
+			delegate void OnCallbackStats(SessionStats stats);
+			event OnCallbackStats ^ OnStats;
+
 			ManagedConductor()
 			{
 				m_isDisposed = false;
@@ -196,6 +757,49 @@ namespace WebRtc
 				onIceCandidate = gcnew _OnIceCandidateCallback(this, &ManagedConductor::_OnIceCandidate);
 				onIceCandidateHandle = GCHandle::Alloc(onIceCandidate);
 				cd->onIceCandidate = static_cast<Native::OnIceCandidateCallbackNative>(Marshal::GetFunctionPointerForDelegate(onIceCandidate).ToPointer());
+
+				onDataChannel = gcnew _OnDataChannelCallback(this, &ManagedConductor::_OnDataChannel);
+				onDataChannelHandle = GCHandle::Alloc(onDataChannel);
+				cd->onDataChannel = static_cast<Native::OnDataChannelCallbackNative>(Marshal::GetFunctionPointerForDelegate(onDataChannel).ToPointer());
+
+				onChannelMessage = gcnew _OnChannelMessageCallback(this, &ManagedConductor::_OnChannelMessage);
+				onChannelMessageHandle = GCHandle::Alloc(onChannelMessage);
+				cd->onChannelMessage = static_cast<Native::OnChannelMessageCallbackNative>(Marshal::GetFunctionPointerForDelegate(onChannelMessage).ToPointer());
+
+				onChannelStateChange = gcnew _OnChannelStateCallback(this, &ManagedConductor::_OnChannelStateChange);
+				onChannelStateChangeHandle = GCHandle::Alloc(onChannelStateChange);
+				cd->onChannelStateChange = static_cast<Native::OnChannelStateCallbackNative>(Marshal::GetFunctionPointerForDelegate(onChannelStateChange).ToPointer());
+
+				onChannelWritable = gcnew _OnChannelWritableCallback(this, &ManagedConductor::_OnChannelWritable);
+				onChannelWritableHandle = GCHandle::Alloc(onChannelWritable);
+				cd->onChannelWritable = static_cast<Native::OnChannelWritableCallbackNative>(Marshal::GetFunctionPointerForDelegate(onChannelWritable).ToPointer());
+
+				onChannelBatch = gcnew _OnChannelBatchCallback(this, &ManagedConductor::_OnChannelBatch);
+				onChannelBatchHandle = GCHandle::Alloc(onChannelBatch);
+				cd->onChannelBatch = static_cast<Native::OnChannelBatchCallbackNative>(Marshal::GetFunctionPointerForDelegate(onChannelBatch).ToPointer());
+
+				onDataBuffer = gcnew _OnDataBufferCallback(this, &ManagedConductor::_OnDataBuffer);
+				onDataBufferHandle = GCHandle::Alloc(onDataBuffer);
+
+				onFileOffer = gcnew _OnFileOfferCallback(this, &ManagedConductor::_OnFileOffer);
+				onFileOfferHandle = GCHandle::Alloc(onFileOffer);
+				cd->onFileOffer = static_cast<Native::OnFileOfferCallbackNative>(Marshal::GetFunctionPointerForDelegate(onFileOffer).ToPointer());
+
+				onFileProgress = gcnew _OnFileProgressCallback(this, &ManagedConductor::_OnFileProgress);
+				onFileProgressHandle = GCHandle::Alloc(onFileProgress);
+				cd->onFileProgress = static_cast<Native::OnFileProgressCallbackNative>(Marshal::GetFunctionPointerForDelegate(onFileProgress).ToPointer());
+
+				onFileComplete = gcnew _OnFileCompleteCallback(this, &ManagedConductor::_OnFileComplete);
+				onFileCompleteHandle = GCHandle::Alloc(onFileComplete);
+				cd->onFileComplete = static_cast<Native::OnFileCompleteCallbackNative>(Marshal::GetFunctionPointerForDelegate(onFileComplete).ToPointer());
+
+				onRemoteAudio = gcnew _OnRemoteAudioCallback(this, &ManagedConductor::_OnRemoteAudio);
+				onRemoteAudioHandle = GCHandle::Alloc(onRemoteAudio);
+				cd->onRemoteAudio = static_cast<Native::OnRemoteAudioCallbackNative>(Marshal::GetFunctionPointerForDelegate(onRemoteAudio).ToPointer());
+
+				onStats = gcnew _OnStatsCallback(this, &ManagedConductor::_OnStats);
+				onStatsHandle = GCHandle::Alloc(onStats);
+				cd->onStats = static_cast<Native::OnStatsCallbackNative>(Marshal::GetFunctionPointerForDelegate(onStats).ToPointer());
 			}
 
 			~ManagedConductor()
@@ -211,6 +815,17 @@ namespace WebRtc
 				FreeGCHandle(onRenderLocalHandle);
 				FreeGCHandle(onRenderRemoteHandle);
 				FreeGCHandle(onDataMessageHandle);
+				FreeGCHandle(onStatsHandle);
+				FreeGCHandle(onDataBufferHandle);
+				FreeGCHandle(onDataChannelHandle);
+				FreeGCHandle(onChannelMessageHandle);
+				FreeGCHandle(onChannelStateChangeHandle);
+				FreeGCHandle(onChannelWritableHandle);
+				FreeGCHandle(onChannelBatchHandle);
+				FreeGCHandle(onFileOfferHandle);
+				FreeGCHandle(onFileProgressHandle);
+				FreeGCHandle(onFileCompleteHandle);
+				FreeGCHandle(onRemoteAudioHandle);
 
     			this->!ManagedConductor(); // call finalizer
 
@@ -227,6 +842,23 @@ namespace WebRtc
 				Native::CleanupSSL();
 			}
 
+			// per-stage frame pipeline events, process wide
+			static void TraceEnable(bool enable)
+			{
+				Native::TraceEnable(enable);
+			}
+
+			// Chrome trace JSON, open with chrome://tracing
+			static String ^ TraceDump()
+			{
+				return marshal_as<String^>(Native::TraceDumpJson());
+			}
+
+			static bool TraceDumpFile(String ^ path)
+			{
+				return Native::TraceDumpFile(marshal_as<std::string>(path));
+			}
+
 			bool InitializePeerConnection()
 			{
 				return cd->InitializePeerConnection();
@@ -282,9 +914,117 @@ namespace WebRtc
 				cd->AddServerConfig(marshal_as<std::string>(uri), marshal_as<std::string>(username), marshal_as<std::string>(password));
 			}
 
-			void CreateDataChannel(String ^ label)
+			// unordered, one retransmission, returns the channel handle or 0
+			Int32 CreateDataChannel(String ^ label)
 			{
-				cd->CreateDataChannel(marshal_as<std::string>(label));
+				return cd->CreateDataChannel(marshal_as<std::string>(label));
+			}
+
+			// maxRetransmits/maxRetransmitTime -1 for reliable, priority drains higher first
+			Int32 CreateDataChannel(String ^ label, bool ordered, Int32 maxRetransmits, Int32 maxRetransmitTime, Int32 priority)
+			{
+				Native::DataChannelConfig config;
+				config.ordered = ordered;
+				config.maxRetransmits = maxRetransmits;
+				config.maxRetransmitTime = maxRetransmitTime;
+				config.priority = priority;
+				return cd->CreateDataChannel(marshal_as<std::string>(label), config);
+			}
+
+			// watermarks in bytes for DataChannelSendAsync, high at most 16 MiB,
+			// |coalesce| packs small binary messages together, the remote must
+			// be a ManagedConductor too
+			Int32 CreateDataChannel(String ^ label, bool ordered, Int32 maxRetransmits, Int32 maxRetransmitTime, Int32 priority,
+				UInt64 highWatermark, UInt64 lowWatermark, bool coalesce)
+			{
+				if (highWatermark > Native::DataChannelConfig::kMaxBufferedAmountHigh)
+					throw gcnew ArgumentOutOfRangeException("highWatermark");
+				if (lowWatermark > highWatermark)
+					throw gcnew ArgumentOutOfRangeException("lowWatermark");
+
+				Native::DataChannelConfig config;
+				config.ordered = ordered;
+				config.maxRetransmits = maxRetransmits;
+				config.maxRetransmitTime = maxRetransmitTime;
+				config.priority = priority;
+				config.bufferedAmountHigh = highWatermark;
+				config.bufferedAmountLow = lowWatermark;
+				config.coalesce = coalesce;
+				return cd->CreateDataChannel(marshal_as<std::string>(label), config);
+			}
+
+			bool CloseDataChannel(Int32 channel)
+			{
+				return cd->CloseDataChannel(channel);
+			}
+
+			Int32 FindDataChannel(String ^ label)
+			{
+				return cd->FindDataChannel(marshal_as<std::string>(label));
+			}
+
+			bool DataChannelSendText(Int32 channel, String ^ text)
+			{
+				std::string s = marshal_as<std::string>(text);
+				return cd->DataChannelSendData(channel, reinterpret_cast<const uint8_t*>(s.data()), static_cast<uint32_t>(s.size()), false, nullptr, nullptr);
+			}
+
+			bool DataChannelSendData(Int32 channel, array<Byte>^ array_data, Int32 offset, Int32 count)
+			{
+				if (offset < 0 || count <= 0 || offset + count > array_data->Length)
+					throw gcnew ArgumentOutOfRangeException("count");
+
+				pin_ptr<uint8_t> thePtr = &array_data[offset];
+				return cd->DataChannelSendData(channel, thePtr, count, true, nullptr, nullptr);
+			}
+
+			bool DataChannelSendData(Int32 channel, IntPtr data, Int32 size)
+			{
+				if (size < 0)
+					throw gcnew ArgumentOutOfRangeException("size");
+
+				return cd->DataChannelSendData(channel, static_cast<uint8_t*>(data.ToPointer()), size, true, nullptr, nullptr);
+			}
+
+			// Queued, never dropped for a full channel buffer. False means the
+			// high watermark was reached, hold off until OnChannelWritable.
+			bool DataChannelSendTextAsync(Int32 channel, String ^ text)
+			{
+				std::string s = marshal_as<std::string>(text);
+				return cd->DataChannelSendAsync(channel, reinterpret_cast<const uint8_t*>(s.data()), static_cast<uint32_t>(s.size()), false);
+			}
+
+			bool DataChannelSendDataAsync(Int32 channel, array<Byte>^ array_data, Int32 offset, Int32 count)
+			{
+				if (offset < 0 || count <= 0 || offset + count > array_data->Length)
+					throw gcnew ArgumentOutOfRangeException("count");
+
+				pin_ptr<uint8_t> thePtr = &array_data[offset];
+				return cd->DataChannelSendAsync(channel, thePtr, count, true);
+			}
+
+			bool DataChannelSendDataAsync(Int32 channel, IntPtr data, Int32 size)
+			{
+				if (size < 0)
+					throw gcnew ArgumentOutOfRangeException("size");
+
+				return cd->DataChannelSendAsync(channel, static_cast<uint8_t*>(data.ToPointer()), size, true);
+			}
+
+			// Received messages go to OnChannelBatch, flushed at |maxBytes| or
+			// |maxMessages| or |delayMs| after the first one. 0 bytes turns it off.
+			bool SetReceiveBatching(Int32 channel, Int32 maxBytes, Int32 maxMessages, Int32 delayMs)
+			{
+				if (maxBytes < 0 || maxMessages <= 0 || delayMs < 0)
+					throw gcnew ArgumentOutOfRangeException("maxBytes");
+
+				return cd->SetDataChannelBatching(channel, maxBytes, maxMessages, delayMs);
+			}
+
+			// bytes in the channel buffer plus the send queue
+			UInt64 DataChannelBufferedAmount(Int32 channel)
+			{
+				return cd->DataChannelBufferedAmount(channel);
 			}
 
 			void DataChannelSendText(String ^ text)
@@ -294,10 +1034,95 @@ namespace WebRtc
 
 			void DataChannelSendData(array<Byte>^ array_data)
 			{
-				pin_ptr<uint8_t> thePtr = &array_data[0];
-				uint8_t * bPtr = thePtr;
-				rtc::CopyOnWriteBuffer writeBuffer(bPtr, array_data->Length);
-				cd->DataChannelSendData(webrtc::DataBuffer(writeBuffer, true));
+				DataChannelSendData(array_data, 0, array_data->Length);
+			}
+
+			bool DataChannelSendData(array<Byte>^ array_data, Int32 offset, Int32 count)
+			{
+				if (offset < 0 || count <= 0 || offset + count > array_data->Length)
+					throw gcnew ArgumentOutOfRangeException("count");
+
+				pin_ptr<uint8_t> thePtr = &array_data[offset];
+				return cd->DataChannelSendData(thePtr, count, nullptr, nullptr);
+			}
+
+			// unmanaged payload, owned by the caller again on return
+			bool DataChannelSendData(IntPtr data, Int32 size)
+			{
+				if (size < 0)
+					throw gcnew ArgumentOutOfRangeException("size");
+
+				return cd->DataChannelSendData(static_cast<uint8_t*>(data.ToPointer()), size, nullptr, nullptr);
+			}
+
+			// binary messages go to OnDataBuffer instead of OnDataBinaryMessage,
+			// without a managed array and copy per message
+			property bool ZeroCopyReceive
+			{
+				bool get()
+				{
+					return cd->onDataBuffer != nullptr;
+				}
+				void set(bool enable)
+				{
+					cd->onDataBuffer = enable ? static_cast<Native::OnChannelBufferCallbackNative>(Marshal::GetFunctionPointerForDelegate(onDataBuffer).ToPointer()) : nullptr;
+				}
+			}
+
+			static void ReleaseDataBuffer(IntPtr buffer)
+			{
+				Native::DataBufferRelease(static_cast<Native::DataBufferRef*>(buffer.ToPointer()));
+			}
+
+			// returns the transfer handle, 0 if the file cannot be opened
+			Int32 SendFile(String ^ path)
+			{
+				return cd->SendFile(rtc::ToUtf8(marshal_as<std::wstring>(path)));
+			}
+
+			// |window| chunks of |chunkSize| bytes are in flight at most
+			Int32 SendFile(String ^ path, Int32 chunkSize, Int32 window)
+			{
+				if (chunkSize <= 0 || static_cast<uint32_t>(chunkSize) > Native::FileTransfer::kMaxChunkSize)
+					throw gcnew ArgumentOutOfRangeException("chunkSize");
+				if (window <= 0)
+					throw gcnew ArgumentOutOfRangeException("window");
+
+				Native::FileTransferConfig config;
+				config.chunkSize = chunkSize;
+				config.window = window;
+				return cd->SendFile(rtc::ToUtf8(marshal_as<std::wstring>(path)), config);
+			}
+
+			bool CancelFile(Int32 transfer)
+			{
+				return cd->CancelFile(transfer);
+			}
+
+			// where offered files are written, incoming files are refused until set
+			void SetFileDirectory(String ^ directory)
+			{
+				cd->SetFileDirectory(rtc::ToUtf8(marshal_as<std::wstring>(directory)));
+			}
+
+			// raises OnStats every |intervalMs| on the thread calling ProcessMessages, 0 collects once
+			bool StartStats(Int32 intervalMs)
+			{
+				return cd->StartStats(intervalMs);
+			}
+
+			void StopStats()
+			{
+				cd->StopStats();
+			}
+
+			// latest snapshot, false until the first collection completed
+			bool GetStats(SessionStats % stats)
+			{
+				Native::SessionStats s;
+				bool ret = cd->LastStats(s);
+				stats = SessionStats::FromNative(s);
+				return ret;
 			}
 
 			void SetAudio(bool enable)
@@ -305,6 +1130,85 @@ namespace WebRtc
 				cd->audioEnabled = enable;
 			}
 
+			// OnRemoteAudio in |sampleRate| and |channels|, 0 keeps what is received,
+			// |batchFrames| 10 ms frames per call; before the remote stream arrives
+			void SetRemoteAudioFormat(Int32 sampleRate, Int32 channels, Int32 batchFrames)
+			{
+				cd->SetRemoteAudioFormat(sampleRate, channels, batchFrames);
+			}
+
+			// echo cancellation, gain control and noise suppression of the outgoing audio;
+			// before the streams are added
+			void SetAudioProcessing(AudioProcessingConfig config)
+			{
+				cd->SetAudioProcessing(config.ToNative());
+			}
+
+			AudioProcessingConfig GetAudioProcessing()
+			{
+				return AudioProcessingConfig::FromNative(cd->audioProcessing);
+			}
+
+			// NetEq of the remote audio, before InitializePeerConnection; fewer packets trade
+			// robustness for delay, fast accelerate drains a grown buffer sooner
+			void SetJitterBuffer(Int32 maxPackets, bool fastAccelerate)
+			{
+				cd->jitterBufferMaxPackets = maxPackets;
+				cd->jitterBufferFastAccelerate = fastAccelerate;
+			}
+
+			// order of the video codecs we send and receive, VP9 SVC layers and H.264
+			// parameters in both directions; before InitializePeerConnection
+			void SetVideoCodecPreference(VideoCodecPreference preference)
+			{
+				cd->SetVideoCodecPreference(preference.ToNative());
+			}
+
+			// bitrate, resolution and framerate of the video we send, any time; min and
+			// start bitrate apply from the next negotiation
+			bool SetVideoEncoding(VideoEncoding encoding)
+			{
+				return cd->SetVideoEncoding(encoding.ToNative());
+			}
+
+			// Opus frame size, bitrate, channels, DTX and FEC we send with; before the
+			// remote description arrives, the network adaptor before the streams are added
+			void SetOpusConfig(OpusConfig config)
+			{
+				cd->SetOpusConfig(config.ToNative());
+			}
+
+			// audio comes from PushAudio, no sound card needed; call before InitializePeerConnection
+			void EnablePushAudio(Int32 sampleRate, Int32 channels)
+			{
+				if (sampleRate < 8000 || sampleRate > 48000)
+					throw gcnew ArgumentOutOfRangeException("sampleRate");
+				if (channels < 1 || channels > 2)
+					throw gcnew ArgumentOutOfRangeException("channels");
+
+				cd->EnablePushAudio(sampleRate, channels);
+			}
+
+			// interleaved 16-bit PCM, whole frames; returns the frames taken, fewer when the buffer is full
+			Int32 PushAudio(array<Int16> ^ samples)
+			{
+				if (samples->Length == 0)
+					return 0;
+
+				pin_ptr<Int16> p = &samples[0];
+				return static_cast<Int32>(cd->PushAudio(p, samples->Length / cd->PushAudioChannels()));
+			}
+
+			Int32 PushAudio(IntPtr samples, Int32 frames)
+			{
+				if (frames < 0)
+					throw gcnew ArgumentOutOfRangeException("frames");
+				if (frames == 0)
+					return 0;
+
+				return static_cast<Int32>(cd->PushAudio(static_cast<const int16_t*>(samples.ToPointer()), frames));
+			}
+
 			void SetVideoCapturer(int width, int height, int caputureFps, bool barcodeEnabled)
 			{
 				cd->width_ = width;
@@ -318,11 +1222,23 @@ namespace WebRtc
 				return cd->VideoCapturerI420Buffer();
 			}
 
+			// the source changed size, the stream follows without renegotiation
+			System::Byte * VideoCapturerI420Buffer(Int32 width, Int32 height)
+			{
+				return cd->VideoCapturerI420Buffer(width, height);
+			}
+
 			void PushFrame()
 			{
 				cd->PushFrame();
 			}
 
+			// |captureTimeUs| when the frame was captured, on any steady clock of the host
+			void PushFrame(Int64 captureTimeUs)
+			{
+				cd->PushFrame(captureTimeUs);
+			}
+
 			System::Byte * DesktopCapturerRGBAbuffer()
 			{
 #if DESKTOP_CAPTURE
@@ -365,8 +1281,43 @@ namespace WebRtc
 			{
 				return cd->RunTurnServer(marshal_as<std::string>(bindIp), marshal_as<std::string>(ip), marshal_as<std::string>(realm), marshal_as<std::string>(authFile));
 			}
+
+			// relays on |workers| threads of its own, the calling thread is not used
+			bool RunTurnServer(String ^ bindIp, String ^ ip, String ^ realm, String ^ authFile, Int32 workers)
+			{
+				return cd->RunTurnServer(marshal_as<std::string>(bindIp), marshal_as<std::string>(ip), marshal_as<std::string>(realm), marshal_as<std::string>(authFile), workers);
+			}
+
+			// Accepts time-limited credentials too: username <expiry unix time>:<name>,
+			// password base64(HMAC-SHA1(secret, username)). Empty disables them.
+			// The auth file is reloaded when it changes.
+			void SetTurnSecret(String ^ secret)
+			{
+				cd->SetTurnSecret(marshal_as<std::string>(secret));
+			}
+
+			// STUN and TURN counters, per allocation and per user for billing
+			ServerStats GetServerStats()
+			{
+				Native::ServerStats s;
+				cd->GetServerStats(s);
+				return ServerStats::FromNative(s);
+			}
+
+			// logs GetServerStats every |intervalMs|, 0 stops
+			void DumpServerStats(Int32 intervalMs)
+			{
+				cd->DumpServerStats(intervalMs);
+			}
 #pragma endregion
 
+		internal:
+
+			Native::Conductor * GetNative()
+			{
+				return cd;
+			}
+
 		protected:
 
 			!ManagedConductor()
@@ -379,5 +1330,80 @@ namespace WebRtc
 				cd = NULL;
 			}
 		};
+
+		// Native::AudioConference, minus-one mixes of the remote audio of many
+		// conductors fed back as their outgoing audio
+		public ref class ManagedAudioConference
+		{
+		private:
+
+			bool m_isDisposed;
+			Native::AudioConference * ac;
+
+		public:
+
+			// mono at |sampleRate|, the loudest |speakers| are mixed
+			ManagedAudioConference(Int32 sampleRate, Int32 speakers)
+			{
+				m_isDisposed = false;
+				ac = new Native::AudioConference(sampleRate, speakers);
+			}
+
+			~ManagedAudioConference()
+			{
+				if (m_isDisposed)
+					return;
+
+				this->!ManagedAudioConference();
+
+				m_isDisposed = true;
+			}
+
+			bool Start()
+			{
+				return ac->Start();
+			}
+
+			void Stop()
+			{
+				ac->Stop();
+			}
+
+			// |conductor| needs EnablePushAudio at the conference rate; from the thread
+			// calling its ProcessMessages, returns the participant or -1
+			Int32 Join(ManagedConductor ^ conductor)
+			{
+				return ac->Join(conductor->GetNative());
+			}
+
+			// before the conductor is disposed, from the thread calling its ProcessMessages
+			void Leave(Int32 participant)
+			{
+				ac->Leave(participant);
+			}
+
+			// participants mixed in the last 10 ms
+			array<Int32> ^ Speakers()
+			{
+				std::vector<int> s = ac->Speakers();
+				array<Int32> ^ r = gcnew array<Int32>(static_cast<int>(s.size()));
+				for (int i = 0; i < r->Length; ++i)
+				{
+					r[i] = s[i];
+				}
+				return r;
+			}
+
+		protected:
+
+			!ManagedAudioConference()
+			{
+				if (ac != NULL)
+				{
+					delete ac;
+				}
+				ac = NULL;
+			}
+		};
 	}
 }
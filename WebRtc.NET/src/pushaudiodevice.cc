@@ -0,0 +1,824 @@
+
+#include "pushaudiodevice.h"
+
+#include <algorithm>
+#include <string.h>
+#include <thread>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/base/timeutils.h"
+
+namespace Native
+{
+	namespace
+	{
+		const uint32_t kMsgTick = 1;
+
+		// ticks missed by more than this are skipped rather than caught up
+		const int64_t kMaxLagMs = 100;
+
+		const char kDeviceName[] = "WebRtc.NET push audio";
+
+		// A 10 ms clock thread ticking the PushAudioDevices given to it.
+		class AudioClock : public rtc::MessageHandler
+		{
+		public:
+			AudioClock() :
+				thread_(rtc::Thread::Create()),
+				count_(0),
+				running_(false),
+				next_ms_(0)
+			{
+				thread_->SetName("audio_clock", this);
+				thread_->Start();
+			}
+
+			void Add(PushAudioDevice * device)
+			{
+				rtc::CritScope lock(&crit_);
+				devices_.push_back(device);
+				++count_;
+				if (!running_)
+				{
+					running_ = true;
+					next_ms_ = rtc::TimeMillis();
+					thread_->Post(RTC_FROM_HERE, this, kMsgTick);
+				}
+			}
+
+			// waits for a tick in progress, false if |device| isn't here
+			bool Remove(PushAudioDevice * device)
+			{
+				rtc::CritScope lock(&crit_);
+				auto it = std::find(devices_.begin(), devices_.end(), device);
+				if (it == devices_.end())
+					return false;
+
+				devices_.erase(it);
+				--count_;
+				return true;
+			}
+
+			// read without the lock, a hint for spreading devices
+			size_t count() const
+			{
+				return count_;
+			}
+
+		private:
+			void OnMessage(rtc::Message * msg) override
+			{
+				rtc::CritScope lock(&crit_);
+				if (devices_.empty())
+				{
+					// the next Add starts over
+					running_ = false;
+					return;
+				}
+
+				for (PushAudioDevice * d : devices_)
+				{
+					d->Tick();
+				}
+
+				// scheduled from the ideal time, so delays don't accumulate
+				const int64_t now = rtc::TimeMillis();
+				next_ms_ += PushAudioDevice::kFrameMs;
+				if (next_ms_ < now - kMaxLagMs)
+				{
+					LOG(LS_WARNING) << "Audio clock skipped " << (now - next_ms_) / PushAudioDevice::kFrameMs << " frames";
+					next_ms_ = now;
+				}
+				thread_->PostDelayed(RTC_FROM_HERE, static_cast<int>(std::max<int64_t>(0, next_ms_ - now)), this, kMsgTick);
+			}
+
+			std::unique_ptr<rtc::Thread> thread_;
+			rtc::CriticalSection crit_;
+			std::vector<PushAudioDevice*> devices_;
+			std::atomic<size_t> count_;
+			bool running_;
+			int64_t next_ms_;
+		};
+
+		// The clocks of every PushAudioDevice in the process, about one per
+		// core. A device goes to the clock with the fewest, another clock is
+		// started only once every running one has a device.
+		class AudioClocks
+		{
+		public:
+			// never deleted, devices may go away during process exit
+			static AudioClocks & Instance()
+			{
+				static AudioClocks * clocks = new AudioClocks();
+				return *clocks;
+			}
+
+			void Add(PushAudioDevice * device)
+			{
+				AudioClock * clock = nullptr;
+				{
+					rtc::CritScope lock(&crit_);
+					for (auto & c : clocks_)
+					{
+						if (!clock || c->count() < clock->count())
+						{
+							clock = c.get();
+						}
+					}
+					if (!clock || (clock->count() > 0 && clocks_.size() < max_))
+					{
+						clocks_.emplace_back(new AudioClock());
+						clock = clocks_.back().get();
+					}
+				}
+
+				// not under |crit_|, a tick may add or remove a device
+				clock->Add(device);
+			}
+
+			void Remove(PushAudioDevice * device)
+			{
+				std::vector<AudioClock*> clocks;
+				{
+					rtc::CritScope lock(&crit_);
+					for (auto & c : clocks_)
+					{
+						clocks.push_back(c.get());
+					}
+				}
+
+				for (AudioClock * c : clocks)
+				{
+					if (c->Remove(device))
+						break;
+				}
+			}
+
+		private:
+			AudioClocks() :
+				max_(std::max(1u, std::thread::hardware_concurrency()))
+			{
+			}
+
+			rtc::CriticalSection crit_;
+			std::vector<std::unique_ptr<AudioClock>> clocks_;
+			const size_t max_;
+		};
+
+		size_t RoundUpToPowerOfTwo(size_t n)
+		{
+			size_t p = 1;
+			while (p < n)
+			{
+				p <<= 1;
+			}
+			return p;
+		}
+	}
+
+	SampleRing::SampleRing(size_t capacity) :
+		buffer_(RoundUpToPowerOfTwo(capacity)),
+		mask_(buffer_.size() - 1),
+		head_(0),
+		tail_(0)
+	{
+	}
+
+	size_t SampleRing::Write(const int16_t * samples, size_t count)
+	{
+		const size_t head = head_.load(std::memory_order_relaxed);
+		const size_t tail = tail_.load(std::memory_order_acquire);
+		count = std::min(count, buffer_.size() - (head - tail));
+
+		const size_t start = head & mask_;
+		const size_t first = std::min(count, buffer_.size() - start);
+		memcpy(&buffer_[start], samples, first * sizeof(int16_t));
+		memcpy(&buffer_[0], samples + first, (count - first) * sizeof(int16_t));
+
+		head_.store(head + count, std::memory_order_release);
+		return count;
+	}
+
+	size_t SampleRing::Read(int16_t * samples, size_t count)
+	{
+		const size_t tail = tail_.load(std::memory_order_relaxed);
+		const size_t head = head_.load(std::memory_order_acquire);
+		count = std::min(count, head - tail);
+
+		const size_t start = tail & mask_;
+		const size_t first = std::min(count, buffer_.size() - start);
+		memcpy(samples, &buffer_[start], first * sizeof(int16_t));
+		memcpy(samples + first, &buffer_[0], (count - first) * sizeof(int16_t));
+
+		tail_.store(tail + count, std::memory_order_release);
+		return count;
+	}
+
+	size_t SampleRing::Available() const
+	{
+		return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+	}
+
+	PushAudioDevice::PushAudioDevice(int sample_rate, size_t channels) :
+		sample_rate_(sample_rate),
+		channels_(channels),
+		frame_samples_(sample_rate / (1000 / kFrameMs) * channels),
+		ring_(sample_rate / 1000 * kRingMs * channels),
+		record_buffer_(frame_samples_),
+		playout_buffer_(frame_samples_),
+		underruns_(0),
+		playout_ntp_ms_(0),
+		audio_callback_(nullptr),
+		initialized_(false),
+		play_initialized_(false),
+		rec_initialized_(false),
+		playing_(false),
+		recording_(false),
+		ticking_(false),
+		mic_level_(0)
+	{
+	}
+
+	PushAudioDevice::~PushAudioDevice()
+	{
+		if (ticking_)
+		{
+			AudioClocks::Instance().Remove(this);
+		}
+	}
+
+	size_t PushAudioDevice::Push(const int16_t * samples, size_t frames)
+	{
+		// whole frames, a partial one would swap the channels
+		const size_t free_frames = (ring_.capacity() - ring_.Available()) / channels_;
+		frames = std::min(frames, free_frames);
+		return ring_.Write(samples, frames * channels_) / channels_;
+	}
+
+	size_t PushAudioDevice::Buffered() const
+	{
+		return ring_.Available() / channels_;
+	}
+
+	void PushAudioDevice::Tick()
+	{
+		rtc::CritScope lock(&crit_);
+		if (audio_callback_ == nullptr)
+			return;
+
+		const size_t frames = frame_samples_ / channels_;
+		const size_t bytes_per_frame = sizeof(int16_t) * channels_;
+
+		if (recording_)
+		{
+			size_t n = ring_.Read(record_buffer_.data(), frame_samples_);
+			if (n < frame_samples_)
+			{
+				// keeps the send clock running, the host catches up later
+				std::fill(record_buffer_.begin() + n, record_buffer_.end(), 0);
+				++underruns_;
+			}
+
+			uint32_t new_mic_level = mic_level_;
+			audio_callback_->RecordedDataIsAvailable(record_buffer_.data(), frames, bytes_per_frame, channels_, sample_rate_,
+													 0, 0, mic_level_, false, new_mic_level);
+			mic_level_ = new_mic_level;
+		}
+
+		if (playing_)
+		{
+			size_t out = 0;
+			int64_t elapsed_time_ms = 0;
+			int64_t ntp_time_ms = 0;
+			audio_callback_->NeedMorePlayData(frames, bytes_per_frame, channels_, sample_rate_,
+											  playout_buffer_.data(), out, &elapsed_time_ms, &ntp_time_ms);
+			playout_ntp_ms_ = ntp_time_ms > 0 ? ntp_time_ms : 0;
+		}
+	}
+
+	void PushAudioDevice::UpdateClock()
+	{
+		// not under |crit_|, the clock holds its own lock around Tick
+		bool active;
+		{
+			rtc::CritScope lock(&crit_);
+			active = playing_ || recording_;
+		}
+
+		if (active == ticking_)
+			return;
+
+		ticking_ = active;
+		if (active)
+		{
+			AudioClocks::Instance().Add(this);
+		}
+		else
+		{
+			AudioClocks::Instance().Remove(this);
+		}
+	}
+
+	int64_t PushAudioDevice::TimeUntilNextProcess()
+	{
+		// driven by the clock thread
+		return 1000;
+	}
+
+	void PushAudioDevice::Process()
+	{
+	}
+
+	int32_t PushAudioDevice::ActiveAudioLayer(AudioLayer * audio_layer) const
+	{
+		*audio_layer = kDummyAudio;
+		return 0;
+	}
+
+	webrtc::AudioDeviceModule::ErrorCode PushAudioDevice::LastError() const
+	{
+		return kAdmErrNone;
+	}
+
+	int32_t PushAudioDevice::RegisterEventObserver(webrtc::AudioDeviceObserver * event_callback)
+	{
+		// no device events
+		return 0;
+	}
+
+	int32_t PushAudioDevice::RegisterAudioCallback(webrtc::AudioTransport * audio_callback)
+	{
+		rtc::CritScope lock(&crit_);
+		audio_callback_ = audio_callback;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::Init()
+	{
+		initialized_ = true;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::Terminate()
+	{
+		StopRecording();
+		StopPlayout();
+		initialized_ = false;
+		return 0;
+	}
+
+	bool PushAudioDevice::Initialized() const
+	{
+		return initialized_;
+	}
+
+	int16_t PushAudioDevice::PlayoutDevices()
+	{
+		return 1;
+	}
+
+	int16_t PushAudioDevice::RecordingDevices()
+	{
+		return 1;
+	}
+
+	int32_t PushAudioDevice::PlayoutDeviceName(uint16_t index, char name[webrtc::kAdmMaxDeviceNameSize], char guid[webrtc::kAdmMaxGuidSize])
+	{
+		return RecordingDeviceName(index, name, guid);
+	}
+
+	int32_t PushAudioDevice::RecordingDeviceName(uint16_t index, char name[webrtc::kAdmMaxDeviceNameSize], char guid[webrtc::kAdmMaxGuidSize])
+	{
+		if (index != 0)
+			return -1;
+
+		strncpy(name, kDeviceName, webrtc::kAdmMaxDeviceNameSize - 1);
+		name[webrtc::kAdmMaxDeviceNameSize - 1] = '\0';
+		if (guid)
+		{
+			guid[0] = '\0';
+		}
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetPlayoutDevice(uint16_t index)
+	{
+		return index == 0 ? 0 : -1;
+	}
+
+	int32_t PushAudioDevice::SetPlayoutDevice(WindowsDeviceType device)
+	{
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetRecordingDevice(uint16_t index)
+	{
+		return index == 0 ? 0 : -1;
+	}
+
+	int32_t PushAudioDevice::SetRecordingDevice(WindowsDeviceType device)
+	{
+		return 0;
+	}
+
+	int32_t PushAudioDevice::PlayoutIsAvailable(bool * available)
+	{
+		*available = true;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::InitPlayout()
+	{
+		play_initialized_ = true;
+		return 0;
+	}
+
+	bool PushAudioDevice::PlayoutIsInitialized() const
+	{
+		return play_initialized_;
+	}
+
+	int32_t PushAudioDevice::RecordingIsAvailable(bool * available)
+	{
+		*available = true;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::InitRecording()
+	{
+		rec_initialized_ = true;
+		return 0;
+	}
+
+	bool PushAudioDevice::RecordingIsInitialized() const
+	{
+		return rec_initialized_;
+	}
+
+	int32_t PushAudioDevice::StartPlayout()
+	{
+		if (!play_initialized_)
+			return -1;
+		{
+			rtc::CritScope lock(&crit_);
+			playing_ = true;
+		}
+		UpdateClock();
+		return 0;
+	}
+
+	int32_t PushAudioDevice::StopPlayout()
+	{
+		{
+			rtc::CritScope lock(&crit_);
+			playing_ = false;
+		}
+		UpdateClock();
+		return 0;
+	}
+
+	bool PushAudioDevice::Playing() const
+	{
+		return playing_;
+	}
+
+	int32_t PushAudioDevice::StartRecording()
+	{
+		if (!rec_initialized_)
+			return -1;
+		{
+			rtc::CritScope lock(&crit_);
+			recording_ = true;
+		}
+		UpdateClock();
+		return 0;
+	}
+
+	int32_t PushAudioDevice::StopRecording()
+	{
+		{
+			rtc::CritScope lock(&crit_);
+			recording_ = false;
+		}
+		UpdateClock();
+		return 0;
+	}
+
+	bool PushAudioDevice::Recording() const
+	{
+		return recording_;
+	}
+
+	int32_t PushAudioDevice::SetAGC(bool enable)
+	{
+		return -1;
+	}
+
+	bool PushAudioDevice::AGC() const
+	{
+		return false;
+	}
+
+	int32_t PushAudioDevice::SetWaveOutVolume(uint16_t volume_left, uint16_t volume_right)
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::WaveOutVolume(uint16_t * volume_left, uint16_t * volume_right) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::InitSpeaker()
+	{
+		return 0;
+	}
+
+	bool PushAudioDevice::SpeakerIsInitialized() const
+	{
+		return true;
+	}
+
+	int32_t PushAudioDevice::InitMicrophone()
+	{
+		return 0;
+	}
+
+	bool PushAudioDevice::MicrophoneIsInitialized() const
+	{
+		return true;
+	}
+
+	int32_t PushAudioDevice::SpeakerVolumeIsAvailable(bool * available)
+	{
+		*available = false;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetSpeakerVolume(uint32_t volume)
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::SpeakerVolume(uint32_t * volume) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MaxSpeakerVolume(uint32_t * max_volume) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MinSpeakerVolume(uint32_t * min_volume) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::SpeakerVolumeStepSize(uint16_t * step_size) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MicrophoneVolumeIsAvailable(bool * available)
+	{
+		*available = false;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetMicrophoneVolume(uint32_t volume)
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MicrophoneVolume(uint32_t * volume) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MaxMicrophoneVolume(uint32_t * max_volume) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MinMicrophoneVolume(uint32_t * min_volume) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MicrophoneVolumeStepSize(uint16_t * step_size) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::SpeakerMuteIsAvailable(bool * available)
+	{
+		*available = false;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetSpeakerMute(bool enable)
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::SpeakerMute(bool * enabled) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MicrophoneMuteIsAvailable(bool * available)
+	{
+		*available = false;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetMicrophoneMute(bool enable)
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MicrophoneMute(bool * enabled) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MicrophoneBoostIsAvailable(bool * available)
+	{
+		*available = false;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetMicrophoneBoost(bool enable)
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::MicrophoneBoost(bool * enabled) const
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::StereoPlayoutIsAvailable(bool * available) const
+	{
+		*available = channels_ == 2;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetStereoPlayout(bool enable)
+	{
+		return enable == (channels_ == 2) ? 0 : -1;
+	}
+
+	int32_t PushAudioDevice::StereoPlayout(bool * enabled) const
+	{
+		*enabled = channels_ == 2;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::StereoRecordingIsAvailable(bool * available) const
+	{
+		*available = channels_ == 2;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetStereoRecording(bool enable)
+	{
+		return enable == (channels_ == 2) ? 0 : -1;
+	}
+
+	int32_t PushAudioDevice::StereoRecording(bool * enabled) const
+	{
+		*enabled = channels_ == 2;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetRecordingChannel(const ChannelType channel)
+	{
+		return channel == kChannelBoth ? 0 : -1;
+	}
+
+	int32_t PushAudioDevice::RecordingChannel(ChannelType * channel) const
+	{
+		*channel = kChannelBoth;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetPlayoutBuffer(const BufferType type, uint16_t size_ms)
+	{
+		return 0;
+	}
+
+	int32_t PushAudioDevice::PlayoutBuffer(BufferType * type, uint16_t * size_ms) const
+	{
+		*type = kFixedBufferSize;
+		*size_ms = 0;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::PlayoutDelay(uint16_t * delay_ms) const
+	{
+		*delay_ms = 0;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::RecordingDelay(uint16_t * delay_ms) const
+	{
+		*delay_ms = 0;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::CPULoad(uint16_t * load) const
+	{
+		*load = 0;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::StartRawOutputFileRecording(const char pcm_file_name_utf8[webrtc::kAdmMaxFileNameSize])
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::StopRawOutputFileRecording()
+	{
+		return 0;
+	}
+
+	int32_t PushAudioDevice::StartRawInputFileRecording(const char pcm_file_name_utf8[webrtc::kAdmMaxFileNameSize])
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::StopRawInputFileRecording()
+	{
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetRecordingSampleRate(const uint32_t samples_per_sec)
+	{
+		return samples_per_sec == static_cast<uint32_t>(sample_rate_) ? 0 : -1;
+	}
+
+	int32_t PushAudioDevice::RecordingSampleRate(uint32_t * samples_per_sec) const
+	{
+		*samples_per_sec = sample_rate_;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetPlayoutSampleRate(const uint32_t samples_per_sec)
+	{
+		return samples_per_sec == static_cast<uint32_t>(sample_rate_) ? 0 : -1;
+	}
+
+	int32_t PushAudioDevice::PlayoutSampleRate(uint32_t * samples_per_sec) const
+	{
+		*samples_per_sec = sample_rate_;
+		return 0;
+	}
+
+	int32_t PushAudioDevice::ResetAudioDevice()
+	{
+		return 0;
+	}
+
+	int32_t PushAudioDevice::SetLoudspeakerStatus(bool enable)
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::GetLoudspeakerStatus(bool * enabled) const
+	{
+		return -1;
+	}
+
+	bool PushAudioDevice::BuiltInAECIsAvailable() const
+	{
+		return false;
+	}
+
+	bool PushAudioDevice::BuiltInAGCIsAvailable() const
+	{
+		return false;
+	}
+
+	bool PushAudioDevice::BuiltInNSIsAvailable() const
+	{
+		return false;
+	}
+
+	int32_t PushAudioDevice::EnableBuiltInAEC(bool enable)
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::EnableBuiltInAGC(bool enable)
+	{
+		return -1;
+	}
+
+	int32_t PushAudioDevice::EnableBuiltInNS(bool enable)
+	{
+		return -1;
+	}
+}
@@ -0,0 +1,225 @@
+
+#ifndef WEBRTC_NET_PUSHAUDIODEVICE_H_
+#define WEBRTC_NET_PUSHAUDIODEVICE_H_
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/modules/audio_device/include/audio_device.h"
+
+namespace Native
+{
+	// Single producer, single consumer ring of 16-bit samples, no locks.
+	class SampleRing
+	{
+	public:
+		// rounded up to a power of two
+		explicit SampleRing(size_t capacity);
+
+		// producer, returns how many were taken
+		size_t Write(const int16_t * samples, size_t count);
+
+		// consumer, returns how many were read
+		size_t Read(int16_t * samples, size_t count);
+
+		size_t Available() const;
+
+		size_t capacity() const
+		{
+			return buffer_.size();
+		}
+
+	private:
+		std::vector<int16_t> buffer_;
+		size_t mask_;
+
+		// free running, written by one side each
+		std::atomic<size_t> head_;
+		std::atomic<size_t> tail_;
+	};
+
+	// AudioDeviceModule with no sound card, after the dummy and file devices
+	// of modules/audio_device. The host pushes interleaved PCM from any one
+	// thread into a SampleRing; every 10 ms the device takes a frame from it
+	// for recording, silence if the host fell behind, and pulls one frame of
+	// playout, which is dropped but keeps the remote audio sinks fed. The
+	// devices share about one clock thread per core, so hundreds of
+	// sessions don't cost a thread each.
+	class PushAudioDevice : public webrtc::AudioDeviceModule
+	{
+	public:
+		PushAudioDevice(int sample_rate, size_t channels);
+
+		// any one thread, whole frames of |channels| samples; returns the
+		// number of frames taken, fewer when the ring is full
+		size_t Push(const int16_t * samples, size_t frames);
+
+		// frames waiting in the ring
+		size_t Buffered() const;
+
+		int sample_rate() const
+		{
+			return sample_rate_;
+		}
+
+		size_t channels() const
+		{
+			return channels_;
+		}
+
+		// when the sender captured the last 10 ms of playout, on its NTP
+		// clock; 0 until RTCP aligned the remote stream
+		int64_t playout_ntp_ms() const
+		{
+			return playout_ntp_ms_;
+		}
+
+		// 10 ms frames recorded with silence because the ring was empty
+		uint64_t underruns() const
+		{
+			return underruns_;
+		}
+
+		static const int kFrameMs = 10;
+		static const int kRingMs = 500;
+
+		// clock thread
+		void Tick();
+
+		// webrtc::Module
+		int64_t TimeUntilNextProcess() override;
+		void Process() override;
+
+		// webrtc::AudioDeviceModule
+		int32_t ActiveAudioLayer(AudioLayer * audio_layer) const override;
+		ErrorCode LastError() const override;
+		int32_t RegisterEventObserver(webrtc::AudioDeviceObserver * event_callback) override;
+		int32_t RegisterAudioCallback(webrtc::AudioTransport * audio_callback) override;
+
+		int32_t Init() override;
+		int32_t Terminate() override;
+		bool Initialized() const override;
+
+		int16_t PlayoutDevices() override;
+		int16_t RecordingDevices() override;
+		int32_t PlayoutDeviceName(uint16_t index, char name[webrtc::kAdmMaxDeviceNameSize], char guid[webrtc::kAdmMaxGuidSize]) override;
+		int32_t RecordingDeviceName(uint16_t index, char name[webrtc::kAdmMaxDeviceNameSize], char guid[webrtc::kAdmMaxGuidSize]) override;
+		int32_t SetPlayoutDevice(uint16_t index) override;
+		int32_t SetPlayoutDevice(WindowsDeviceType device) override;
+		int32_t SetRecordingDevice(uint16_t index) override;
+		int32_t SetRecordingDevice(WindowsDeviceType device) override;
+
+		int32_t PlayoutIsAvailable(bool * available) override;
+		int32_t InitPlayout() override;
+		bool PlayoutIsInitialized() const override;
+		int32_t RecordingIsAvailable(bool * available) override;
+		int32_t InitRecording() override;
+		bool RecordingIsInitialized() const override;
+
+		int32_t StartPlayout() override;
+		int32_t StopPlayout() override;
+		bool Playing() const override;
+		int32_t StartRecording() override;
+		int32_t StopRecording() override;
+		bool Recording() const override;
+
+		int32_t SetAGC(bool enable) override;
+		bool AGC() const override;
+		int32_t SetWaveOutVolume(uint16_t volume_left, uint16_t volume_right) override;
+		int32_t WaveOutVolume(uint16_t * volume_left, uint16_t * volume_right) const override;
+
+		int32_t InitSpeaker() override;
+		bool SpeakerIsInitialized() const override;
+		int32_t InitMicrophone() override;
+		bool MicrophoneIsInitialized() const override;
+
+		int32_t SpeakerVolumeIsAvailable(bool * available) override;
+		int32_t SetSpeakerVolume(uint32_t volume) override;
+		int32_t SpeakerVolume(uint32_t * volume) const override;
+		int32_t MaxSpeakerVolume(uint32_t * max_volume) const override;
+		int32_t MinSpeakerVolume(uint32_t * min_volume) const override;
+		int32_t SpeakerVolumeStepSize(uint16_t * step_size) const override;
+
+		int32_t MicrophoneVolumeIsAvailable(bool * available) override;
+		int32_t SetMicrophoneVolume(uint32_t volume) override;
+		int32_t MicrophoneVolume(uint32_t * volume) const override;
+		int32_t MaxMicrophoneVolume(uint32_t * max_volume) const override;
+		int32_t MinMicrophoneVolume(uint32_t * min_volume) const override;
+		int32_t MicrophoneVolumeStepSize(uint16_t * step_size) const override;
+
+		int32_t SpeakerMuteIsAvailable(bool * available) override;
+		int32_t SetSpeakerMute(bool enable) override;
+		int32_t SpeakerMute(bool * enabled) const override;
+		int32_t MicrophoneMuteIsAvailable(bool * available) override;
+		int32_t SetMicrophoneMute(bool enable) override;
+		int32_t MicrophoneMute(bool * enabled) const override;
+		int32_t MicrophoneBoostIsAvailable(bool * available) override;
+		int32_t SetMicrophoneBoost(bool enable) override;
+		int32_t MicrophoneBoost(bool * enabled) const override;
+
+		int32_t StereoPlayoutIsAvailable(bool * available) const override;
+		int32_t SetStereoPlayout(bool enable) override;
+		int32_t StereoPlayout(bool * enabled) const override;
+		int32_t StereoRecordingIsAvailable(bool * available) const override;
+		int32_t SetStereoRecording(bool enable) override;
+		int32_t StereoRecording(bool * enabled) const override;
+		int32_t SetRecordingChannel(const ChannelType channel) override;
+		int32_t RecordingChannel(ChannelType * channel) const override;
+
+		int32_t SetPlayoutBuffer(const BufferType type, uint16_t size_ms) override;
+		int32_t PlayoutBuffer(BufferType * type, uint16_t * size_ms) const override;
+		int32_t PlayoutDelay(uint16_t * delay_ms) const override;
+		int32_t RecordingDelay(uint16_t * delay_ms) const override;
+		int32_t CPULoad(uint16_t * load) const override;
+
+		int32_t StartRawOutputFileRecording(const char pcm_file_name_utf8[webrtc::kAdmMaxFileNameSize]) override;
+		int32_t StopRawOutputFileRecording() override;
+		int32_t StartRawInputFileRecording(const char pcm_file_name_utf8[webrtc::kAdmMaxFileNameSize]) override;
+		int32_t StopRawInputFileRecording() override;
+
+		int32_t SetRecordingSampleRate(const uint32_t samples_per_sec) override;
+		int32_t RecordingSampleRate(uint32_t * samples_per_sec) const override;
+		int32_t SetPlayoutSampleRate(const uint32_t samples_per_sec) override;
+		int32_t PlayoutSampleRate(uint32_t * samples_per_sec) const override;
+
+		int32_t ResetAudioDevice() override;
+		int32_t SetLoudspeakerStatus(bool enable) override;
+		int32_t GetLoudspeakerStatus(bool * enabled) const override;
+
+		bool BuiltInAECIsAvailable() const override;
+		bool BuiltInAGCIsAvailable() const override;
+		bool BuiltInNSIsAvailable() const override;
+		int32_t EnableBuiltInAEC(bool enable) override;
+		int32_t EnableBuiltInAGC(bool enable) override;
+		int32_t EnableBuiltInNS(bool enable) override;
+
+	protected:
+		~PushAudioDevice() override;
+
+	private:
+		void UpdateClock();
+
+		const int sample_rate_;
+		const size_t channels_;
+		const size_t frame_samples_;
+
+		SampleRing ring_;
+		std::vector<int16_t> record_buffer_;
+		std::vector<int16_t> playout_buffer_;
+		std::atomic<uint64_t> underruns_;
+		std::atomic<int64_t> playout_ntp_ms_;
+
+		rtc::CriticalSection crit_;
+		webrtc::AudioTransport * audio_callback_;
+		bool initialized_;
+		bool play_initialized_;
+		bool rec_initialized_;
+		bool playing_;
+		bool recording_;
+		bool ticking_;
+		uint32_t mic_level_;
+	};
+}
+#endif  // WEBRTC_NET_PUSHAUDIODEVICE_H_
@@ -0,0 +1,163 @@
+
+#include "servermetrics.h"
+
+#include <algorithm>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/base/timeutils.h"
+
+#include "turnfastpath.h"
+#include "turnrelay.h"
+
+namespace Native
+{
+	namespace
+	{
+		const uint32_t kMsgDump = 1;
+	}
+
+	void RelayCounters::Add(const RelayCounters & c)
+	{
+		packets_to_peer += c.packets_to_peer;
+		bytes_to_peer += c.bytes_to_peer;
+		packets_from_peer += c.packets_from_peer;
+		bytes_from_peer += c.bytes_from_peer;
+	}
+
+	void ResetServerStats(ServerStats & s)
+	{
+		s.timestamp_ms = 0;
+		s.stun = BatchedUdpSocket::Counters();
+		s.turn = BatchedUdpSocket::Counters();
+		s.allocations_created = 0;
+		s.allocations_active = 0;
+		s.auth_failures = 0;
+		s.permission_misses = 0;
+		s.relay_drops = 0;
+		s.relayed = RelayCounters();
+		s.allocations.clear();
+		s.users.clear();
+	}
+
+	ServerMetrics::ServerMetrics() :
+		stun_socket_(nullptr),
+		turn_socket_(nullptr),
+		relay_(nullptr),
+		dump_interval_ms_(0)
+	{
+	}
+
+	ServerMetrics::~ServerMetrics()
+	{
+		// MessageHandler clears the pending dump, from any thread
+	}
+
+	void ServerMetrics::SetStunSocket(BatchedUdpSocket * socket)
+	{
+		stun_socket_ = socket;
+	}
+
+	void ServerMetrics::SetTurnServer(BatchedUdpSocket * socket, TurnFastPath * fast_path)
+	{
+		turn_socket_ = socket;
+		fast_path_ = fast_path;
+	}
+
+	void ServerMetrics::SetTurnRelay(TurnRelay * relay)
+	{
+		relay_ = relay;
+	}
+
+	void ServerMetrics::Snapshot(ServerStats & stats)
+	{
+		ResetServerStats(stats);
+		stats.timestamp_ms = rtc::TimeMillis();
+
+		if (stun_socket_)
+		{
+			stats.stun = stun_socket_->counters();
+		}
+
+		if (turn_socket_)
+		{
+			stats.turn.Add(turn_socket_->counters());
+			fast_path_->Collect(stats);
+		}
+
+		if (relay_)
+		{
+			relay_->Collect(stats);
+		}
+
+		// one entry per user across TurnRelay workers
+		std::sort(stats.users.begin(), stats.users.end(), [](const UserStats & a, const UserStats & b)
+		{
+			return a.username < b.username;
+		});
+
+		size_t n = 0;
+		for (size_t i = 0; i < stats.users.size(); ++i)
+		{
+			if (n > 0 && stats.users[n - 1].username == stats.users[i].username)
+			{
+				UserStats & u = stats.users[n - 1];
+				u.allocations += stats.users[i].allocations;
+				u.active += stats.users[i].active;
+				u.relayed.Add(stats.users[i].relayed);
+			}
+			else
+			{
+				stats.users[n++] = stats.users[i];
+			}
+		}
+		stats.users.resize(n);
+	}
+
+	void ServerMetrics::SetDumpInterval(int interval_ms)
+	{
+		rtc::Thread::Current()->Clear(this, kMsgDump);
+
+		dump_interval_ms_ = interval_ms;
+		if (dump_interval_ms_ > 0)
+		{
+			rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, dump_interval_ms_, this, kMsgDump);
+		}
+	}
+
+	void ServerMetrics::OnMessage(rtc::Message * msg)
+	{
+		if (msg->message_id == kMsgDump)
+		{
+			Dump();
+			rtc::Thread::Current()->PostDelayed(RTC_FROM_HERE, dump_interval_ms_, this, kMsgDump);
+		}
+	}
+
+	void ServerMetrics::Dump()
+	{
+		ServerStats s;
+		Snapshot(s);
+
+		if (stun_socket_)
+		{
+			LOG(INFO) << "STUN: " << s.stun.packets_received << " packets in, "
+				<< s.stun.packets_sent << " out, " << s.stun.drops << " dropped";
+		}
+
+		if (turn_socket_ || relay_)
+		{
+			LOG(INFO) << "TURN: " << s.allocations_active << " allocations, " << s.allocations_created << " created, "
+				<< s.auth_failures << " auth failures, " << s.permission_misses << " permission misses, "
+				<< s.turn.drops + s.relay_drops << " dropped";
+			LOG(INFO) << "TURN relayed: " << s.relayed.bytes_to_peer << " bytes to peers, "
+				<< s.relayed.bytes_from_peer << " bytes from peers";
+
+			for (const UserStats & u : s.users)
+			{
+				LOG(INFO) << "TURN user " << u.username << ": " << u.active << "/" << u.allocations << " allocations, "
+					<< u.relayed.bytes_to_peer << " bytes to peers, " << u.relayed.bytes_from_peer << " bytes from peers";
+			}
+		}
+	}
+}
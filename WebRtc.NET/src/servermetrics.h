@@ -0,0 +1,105 @@
+
+#ifndef WEBRTC_NET_SERVERMETRICS_H_
+#define WEBRTC_NET_SERVERMETRICS_H_
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/scoped_ref_ptr.h"
+#include "webrtc/base/socketaddress.h"
+
+#include "batchedudpsocket.h"
+
+namespace Native
+{
+	class TurnFastPath;
+	class TurnRelay;
+
+	// Traffic through the relay sockets of TURN allocations.
+	struct RelayCounters
+	{
+		uint64_t packets_to_peer;
+		uint64_t bytes_to_peer;
+		uint64_t packets_from_peer;
+		uint64_t bytes_from_peer;
+
+		void Add(const RelayCounters & c);
+	};
+
+	struct AllocationStats
+	{
+		std::string username;
+		rtc::SocketAddress client;
+		rtc::SocketAddress relay;
+		int64_t created_ms;
+		RelayCounters relayed;
+	};
+
+	// REST usernames are accounted by the name after the expiry.
+	struct UserStats
+	{
+		std::string username;
+		uint64_t allocations;
+		uint32_t active;
+		RelayCounters relayed;
+	};
+
+	// Snapshot of the embedded STUN and TURN servers. Counters are
+	// cumulative since the servers started, user totals include closed
+	// allocations, |allocations| lists the live ones.
+	struct ServerStats
+	{
+		int64_t timestamp_ms;
+
+		BatchedUdpSocket::Counters stun;
+		BatchedUdpSocket::Counters turn;
+
+		uint64_t allocations_created;
+		uint64_t allocations_active;
+		uint64_t auth_failures;
+		uint64_t permission_misses;
+		uint64_t relay_drops;
+		RelayCounters relayed;
+
+		std::vector<AllocationStats> allocations;
+		std::vector<UserStats> users;
+	};
+
+	void ResetServerStats(ServerStats & s);
+
+	// Collects ServerStats from the servers a Conductor runs, on the thread
+	// calling ProcessMessages; TurnRelay workers are asked on their own
+	// threads. Nothing is counted here, the servers keep plain counters on
+	// their threads and this only reads them, so the data path pays no
+	// locking. Optionally logs a snapshot periodically.
+	class ServerMetrics : public rtc::MessageHandler
+	{
+	public:
+		ServerMetrics();
+		~ServerMetrics() override;
+
+		// owned by the servers, which must outlive this
+		void SetStunSocket(BatchedUdpSocket * socket);
+		void SetTurnServer(BatchedUdpSocket * socket, TurnFastPath * fast_path);
+		void SetTurnRelay(TurnRelay * relay);
+
+		void Snapshot(ServerStats & stats);
+
+		// 0 stops
+		void SetDumpInterval(int interval_ms);
+
+	private:
+		void OnMessage(rtc::Message * msg) override;
+		void Dump();
+
+		BatchedUdpSocket * stun_socket_;
+		BatchedUdpSocket * turn_socket_;
+		rtc::scoped_refptr<TurnFastPath> fast_path_;
+		TurnRelay * relay_;
+
+		int dump_interval_ms_;
+	};
+}
+#endif  // WEBRTC_NET_SERVERMETRICS_H_
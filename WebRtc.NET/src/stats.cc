@@ -0,0 +1,313 @@
+
+#include "stats.h"
+#include "conductor.h"
+
+#include <stdlib.h>
+
+#include "webrtc/api/stats/rtcstats_objects.h"
+#include "webrtc/api/stats/rtcstatsreport.h"
+#include "webrtc/base/common.h"
+#include "webrtc/base/timeutils.h"
+
+namespace Native
+{
+	namespace
+	{
+		const uint32_t kMsgCollect = 1;
+
+		template<typename T, typename V>
+		void Read(const webrtc::RTCStatsMember<T> & m, V & out, double scale = 1)
+		{
+			if (m.is_defined())
+			{
+				out = static_cast<V>(*m * scale);
+			}
+		}
+
+		bool IsVideo(const webrtc::RTCRTPStreamStats & s)
+		{
+			return s.media_type.is_defined() && *s.media_type == "video" &&
+				!(s.is_remote.is_defined() && *s.is_remote);
+		}
+
+		double LegacyValue(const webrtc::StatsReport * r, webrtc::StatsReport::StatsValueName name)
+		{
+			const webrtc::StatsReport::Value * v = r->FindValue(name);
+			return v ? atof(v->ToString().c_str()) : -1;
+		}
+	}
+
+	void ResetSessionStats(SessionStats & s)
+	{
+		s.timestamp_us = 0;
+		s.rtt_ms = -1;
+		s.available_send_bps = -1;
+		s.available_receive_bps = -1;
+		s.jitter_ms = -1;
+		s.fraction_lost = -1;
+		s.packets_received = -1;
+		s.packets_lost = -1;
+		s.bytes_received = -1;
+		s.frames_decoded = -1;
+		s.frames_dropped = -1;
+		s.decode_fps = -1;
+		s.packets_sent = -1;
+		s.bytes_sent = -1;
+		s.frames_encoded = -1;
+		s.encode_fps = -1;
+		s.encode_ms = -1;
+		s.qp = -1;
+		s.audio_delay_ms = -1;
+		s.jitter_buffer_ms = -1;
+		s.preferred_buffer_ms = -1;
+		s.expand_rate = -1;
+		s.speech_expand_rate = -1;
+		s.accelerate_rate = -1;
+		s.preemptive_expand_rate = -1;
+		s.secondary_decoded_rate = -1;
+		s.decoding_normal = -1;
+		s.decoding_plc = -1;
+		s.decoding_cng = -1;
+		s.decoding_plc_cng = -1;
+		s.decoding_muted = -1;
+	}
+
+	class StatsCollector::LegacyObserver : public webrtc::StatsObserver
+	{
+	public:
+		explicit LegacyObserver(StatsCollector * collector) :
+			collector_(collector)
+		{
+		}
+
+		virtual void OnComplete(const webrtc::StatsReports & reports) override
+		{
+			collector_->OnLegacyStats(reports);
+		}
+
+	private:
+		rtc::scoped_refptr<StatsCollector> collector_;
+	};
+
+	StatsCollector::StatsCollector(Conductor & c, webrtc::PeerConnectionInterface * pc) :
+		con(&c), pc_(pc), thread_(rtc::Thread::Current()), interval_ms_(0), pending_(0), valid_(false),
+		qp_sum_(0), last_qp_sum_(0)
+	{
+		ResetSessionStats(current_);
+		ResetSessionStats(last_);
+	}
+
+	StatsCollector::~StatsCollector()
+	{
+	}
+
+	void StatsCollector::Start(int interval_ms)
+	{
+		ASSERT(thread_->IsCurrent());
+
+		thread_->Clear(this);
+		interval_ms_ = interval_ms;
+		if (pending_ == 0)
+		{
+			Collect();
+		}
+	}
+
+	void StatsCollector::Stop()
+	{
+		ASSERT(thread_->IsCurrent());
+
+		// collections in flight still complete, they just go nowhere
+		thread_->Clear(this);
+		interval_ms_ = 0;
+		con = nullptr;
+		pc_ = nullptr;
+	}
+
+	bool StatsCollector::Last(SessionStats & s) const
+	{
+		s = last_;
+		return valid_;
+	}
+
+	void StatsCollector::OnMessage(rtc::Message * msg)
+	{
+		if (msg->message_id == kMsgCollect && pending_ == 0)
+		{
+			Collect();
+		}
+	}
+
+	void StatsCollector::Collect()
+	{
+		if (!pc_)
+			return;
+
+		ResetSessionStats(current_);
+		qp_sum_ = 0;
+
+		pending_ = 2;
+		pc_->GetStats(this);
+
+		rtc::scoped_refptr<webrtc::StatsObserver> legacy(new rtc::RefCountedObject<LegacyObserver>(this));
+		if (!pc_->GetStats(legacy, nullptr, webrtc::PeerConnectionInterface::kStatsOutputLevelStandard))
+		{
+			pending_--;
+		}
+	}
+
+	void StatsCollector::OnStatsDelivered(const rtc::scoped_refptr<const webrtc::RTCStatsReport> & report)
+	{
+		SessionStats & s = current_;
+		s.timestamp_us = report->timestamp_us();
+
+		for (const webrtc::RTCTransportStats * t : report->GetStatsOfType<webrtc::RTCTransportStats>())
+		{
+			if (!t->selected_candidate_pair_id.is_defined())
+				continue;
+
+			const webrtc::RTCStats * pair = report->Get(*t->selected_candidate_pair_id);
+			if (pair && pair->type() == webrtc::RTCIceCandidatePairStats::kType)
+			{
+				const webrtc::RTCIceCandidatePairStats & p = pair->cast_to<webrtc::RTCIceCandidatePairStats>();
+				Read(p.current_round_trip_time, s.rtt_ms, 1000);
+				Read(p.available_outgoing_bitrate, s.available_send_bps);
+				Read(p.available_incoming_bitrate, s.available_receive_bps);
+			}
+		}
+
+		for (const webrtc::RTCInboundRTPStreamStats * in : report->GetStatsOfType<webrtc::RTCInboundRTPStreamStats>())
+		{
+			if (!IsVideo(*in))
+				continue;
+
+			Read(in->jitter, s.jitter_ms, 1000);
+			Read(in->fraction_lost, s.fraction_lost);
+			Read(in->packets_received, s.packets_received);
+			Read(in->packets_lost, s.packets_lost);
+			Read(in->bytes_received, s.bytes_received);
+			Read(in->frames_decoded, s.frames_decoded);
+		}
+
+		for (const webrtc::RTCOutboundRTPStreamStats * out : report->GetStatsOfType<webrtc::RTCOutboundRTPStreamStats>())
+		{
+			if (!IsVideo(*out))
+				continue;
+
+			Read(out->packets_sent, s.packets_sent);
+			Read(out->bytes_sent, s.bytes_sent);
+			Read(out->frames_encoded, s.frames_encoded);
+			Read(out->qp_sum, qp_sum_);
+			if (s.rtt_ms < 0)
+			{
+				Read(out->round_trip_time, s.rtt_ms, 1000);
+			}
+		}
+
+		for (const webrtc::RTCMediaStreamTrackStats * track : report->GetStatsOfType<webrtc::RTCMediaStreamTrackStats>())
+		{
+			if (track->kind.is_defined() && *track->kind == "video" &&
+				track->remote_source.is_defined() && *track->remote_source)
+			{
+				Read(track->frames_dropped, s.frames_dropped);
+			}
+		}
+
+		if (--pending_ == 0)
+		{
+			Deliver();
+		}
+	}
+
+	void StatsCollector::OnLegacyStats(const webrtc::StatsReports & reports)
+	{
+		SessionStats & s = current_;
+		for (const webrtc::StatsReport * r : reports)
+		{
+			if (r->type() == webrtc::StatsReport::kStatsReportTypeSsrc)
+			{
+				double encode_ms = LegacyValue(r, webrtc::StatsReport::kStatsValueNameAvgEncodeMs);
+				if (encode_ms >= 0)
+				{
+					s.encode_ms = encode_ms;
+				}
+
+				// only audio receivers have NetEq
+				if (r->FindValue(webrtc::StatsReport::kStatsValueNameExpandRate))
+				{
+					s.audio_delay_ms = LegacyValue(r, webrtc::StatsReport::kStatsValueNameCurrentDelayMs);
+					s.jitter_buffer_ms = LegacyValue(r, webrtc::StatsReport::kStatsValueNameJitterBufferMs);
+					s.preferred_buffer_ms = LegacyValue(r, webrtc::StatsReport::kStatsValueNamePreferredJitterBufferMs);
+					s.expand_rate = LegacyValue(r, webrtc::StatsReport::kStatsValueNameExpandRate);
+					s.speech_expand_rate = LegacyValue(r, webrtc::StatsReport::kStatsValueNameSpeechExpandRate);
+					s.accelerate_rate = LegacyValue(r, webrtc::StatsReport::kStatsValueNameAccelerateRate);
+					s.preemptive_expand_rate = LegacyValue(r, webrtc::StatsReport::kStatsValueNamePreemptiveExpandRate);
+					s.secondary_decoded_rate = LegacyValue(r, webrtc::StatsReport::kStatsValueNameSecondaryDecodedRate);
+					s.decoding_normal = static_cast<int64_t>(LegacyValue(r, webrtc::StatsReport::kStatsValueNameDecodingNormal));
+					s.decoding_plc = static_cast<int64_t>(LegacyValue(r, webrtc::StatsReport::kStatsValueNameDecodingPLC));
+					s.decoding_cng = static_cast<int64_t>(LegacyValue(r, webrtc::StatsReport::kStatsValueNameDecodingCNG));
+					s.decoding_plc_cng = static_cast<int64_t>(LegacyValue(r, webrtc::StatsReport::kStatsValueNameDecodingPLCCNG));
+					s.decoding_muted = static_cast<int64_t>(LegacyValue(r, webrtc::StatsReport::kStatsValueNameDecodingMutedOutput));
+				}
+			}
+			else if (r->type() == webrtc::StatsReport::kStatsReportTypeBwe)
+			{
+				// the candidate pair bitrates are not always populated yet
+				if (s.available_send_bps < 0)
+				{
+					s.available_send_bps = LegacyValue(r, webrtc::StatsReport::kStatsValueNameAvailableSendBandwidth);
+				}
+				if (s.available_receive_bps < 0)
+				{
+					s.available_receive_bps = LegacyValue(r, webrtc::StatsReport::kStatsValueNameAvailableReceiveBandwidth);
+				}
+			}
+		}
+
+		if (--pending_ == 0)
+		{
+			Deliver();
+		}
+	}
+
+	void StatsCollector::Deliver()
+	{
+		SessionStats & s = current_;
+		if (s.timestamp_us == 0)
+		{
+			s.timestamp_us = rtc::TimeMicros();
+		}
+
+		if (valid_ && s.timestamp_us > last_.timestamp_us)
+		{
+			const double seconds = (s.timestamp_us - last_.timestamp_us) / 1e6;
+			if (s.frames_encoded >= 0 && last_.frames_encoded >= 0)
+			{
+				const int64_t frames = s.frames_encoded - last_.frames_encoded;
+				s.encode_fps = frames / seconds;
+				if (frames > 0 && qp_sum_ >= last_qp_sum_)
+				{
+					s.qp = static_cast<double>(qp_sum_ - last_qp_sum_) / frames;
+				}
+			}
+			if (s.frames_decoded >= 0 && last_.frames_decoded >= 0)
+			{
+				s.decode_fps = (s.frames_decoded - last_.frames_decoded) / seconds;
+			}
+		}
+
+		last_ = s;
+		last_qp_sum_ = qp_sum_;
+		valid_ = true;
+
+		if (con && con->onStats)
+		{
+			con->onStats(&last_);
+		}
+
+		if (con && interval_ms_ > 0)
+		{
+			thread_->PostDelayed(RTC_FROM_HERE, interval_ms_, this, kMsgCollect);
+		}
+	}
+}
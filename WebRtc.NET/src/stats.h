@@ -0,0 +1,109 @@
+
+#ifndef WEBRTC_NET_STATS_H_
+#define WEBRTC_NET_STATS_H_
+#pragma once
+
+#include "webrtc/api/peerconnectioninterface.h"
+#include "webrtc/api/rtcstatscollector.h"
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/thread.h"
+
+namespace Native
+{
+	// Flat per-session snapshot, safe to copy across the interop boundary.
+	// Rates are computed over the interval since the previous snapshot,
+	// counters are cumulative. Values that are not known yet are -1.
+	struct SessionStats
+	{
+		int64_t timestamp_us;
+
+		double rtt_ms;
+		double available_send_bps;
+		double available_receive_bps;
+
+		// inbound video
+		double jitter_ms;
+		double fraction_lost;
+		int64_t packets_received;
+		int64_t packets_lost;
+		int64_t bytes_received;
+		int64_t frames_decoded;
+		int64_t frames_dropped;
+		double decode_fps;
+
+		// outbound video
+		int64_t packets_sent;
+		int64_t bytes_sent;
+		int64_t frames_encoded;
+		double encode_fps;
+		double encode_ms;
+		double qp;
+
+		// inbound audio, NetEq; buffer sizes in ms, rates are the fraction
+		// of output samples since the last report, decodings count calls
+		double audio_delay_ms;
+		double jitter_buffer_ms;
+		double preferred_buffer_ms;
+		double expand_rate;
+		double speech_expand_rate;
+		double accelerate_rate;
+		double preemptive_expand_rate;
+		double secondary_decoded_rate;
+		int64_t decoding_normal;
+		int64_t decoding_plc;
+		int64_t decoding_cng;
+		int64_t decoding_plc_cng;
+		int64_t decoding_muted;
+	};
+
+	void ResetSessionStats(SessionStats & s);
+
+	class Conductor;
+
+	// Polls PeerConnection stats on the signaling thread every |interval_ms|
+	// and folds them into a SessionStats snapshot. Everything except the
+	// average encode time and NetEq come from the RTCStatsCollector, which
+	// does not report them at this revision, so those are taken from the
+	// ssrc reports of the legacy collector in the same round.
+	class StatsCollector : public webrtc::RTCStatsCollectorCallback,
+		public rtc::MessageHandler
+	{
+	public:
+		StatsCollector(Conductor & c, webrtc::PeerConnectionInterface * pc);
+
+		void Start(int interval_ms);
+		void Stop();
+
+		// latest complete snapshot, false until the first round finished
+		bool Last(SessionStats & s) const;
+
+	protected:
+		virtual ~StatsCollector();
+
+		virtual void OnStatsDelivered(const rtc::scoped_refptr<const webrtc::RTCStatsReport> & report) override;
+		virtual void OnMessage(rtc::Message * msg) override;
+
+	private:
+		// StatsObserver is ref counted on its own, not virtually like the
+		// RTCStatsCollectorCallback, so it can't be a second base
+		class LegacyObserver;
+
+		void OnLegacyStats(const webrtc::StatsReports & reports);
+		void Collect();
+		void Deliver();
+
+		Conductor * con;
+		rtc::scoped_refptr<webrtc::PeerConnectionInterface> pc_;
+		rtc::Thread * thread_;
+
+		int interval_ms_;
+		int pending_;
+		bool valid_;
+
+		SessionStats current_;
+		SessionStats last_;
+		uint64_t qp_sum_;
+		uint64_t last_qp_sum_;
+	};
+}
+#endif  // WEBRTC_NET_STATS_H_
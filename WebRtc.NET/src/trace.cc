@@ -0,0 +1,200 @@
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/platform_thread.h"
+#include "webrtc/base/timeutils.h"
+
+namespace Native
+{
+	namespace
+	{
+		const uint32_t kRingSize = 8192;  // events per thread, power of 2
+
+		const char * const kStageNames[kTraceStageCount] =
+		{
+			"capture",
+			"adapt",
+			"encode",
+			"packetize",
+			"receive",
+			"decode",
+			"render",
+		};
+
+		struct Event
+		{
+			int64_t ts_us;
+			int64_t capture_ms;
+			uint32_t rtp;
+			uint8_t stage;
+			char phase;
+		};
+
+		// Written by its thread only, |head| is published after the slot.
+		struct Ring
+		{
+			Ring() : head(0), tid(0)
+			{
+			}
+
+			std::atomic<uint32_t> head;
+			rtc::PlatformThreadId tid;
+			Event events[kRingSize];
+		};
+
+		std::atomic<bool> g_enabled(false);
+
+		// Rings outlive their threads, a later dump still shows what they did.
+		class Registry
+		{
+		public:
+			Ring * Add()
+			{
+				Ring * r = new Ring();
+				r->tid = rtc::CurrentThreadId();
+
+				rtc::CritScope lock(&crit_);
+				rings_.push_back(std::unique_ptr<Ring>(r));
+				return r;
+			}
+
+			void Snapshot(std::vector<Ring*> & rings)
+			{
+				rtc::CritScope lock(&crit_);
+				for (auto & r : rings_)
+				{
+					rings.push_back(r.get());
+				}
+			}
+
+		private:
+			rtc::CriticalSection crit_;
+			std::vector<std::unique_ptr<Ring>> rings_;
+		};
+
+		Registry & GetRegistry()
+		{
+			static Registry registry;
+			return registry;
+		}
+
+		thread_local Ring * t_ring = nullptr;
+	}
+
+	void TraceEnable(bool enable)
+	{
+		g_enabled.store(enable, std::memory_order_relaxed);
+	}
+
+	bool TraceEnabled()
+	{
+		return g_enabled.load(std::memory_order_relaxed);
+	}
+
+	void TraceEvent(TraceStage stage, char phase, uint32_t rtp, int64_t capture_ms)
+	{
+		if (!TraceEnabled())
+			return;
+
+		TraceEvent(stage, phase, rtp, capture_ms, rtc::TimeMicros());
+	}
+
+	void TraceEvent(TraceStage stage, char phase, uint32_t rtp, int64_t capture_ms, int64_t ts_us)
+	{
+		if (!TraceEnabled())
+			return;
+
+		Ring * r = t_ring;
+		if (r == nullptr)
+		{
+			r = t_ring = GetRegistry().Add();
+		}
+
+		const uint32_t head = r->head.load(std::memory_order_relaxed);
+		Event & e = r->events[head & (kRingSize - 1)];
+		e.ts_us = ts_us;
+		e.capture_ms = capture_ms;
+		e.rtp = rtp;
+		e.stage = static_cast<uint8_t>(stage);
+		e.phase = phase;
+		r->head.store(head + 1, std::memory_order_release);
+	}
+
+	std::string TraceDumpJson()
+	{
+		std::vector<Ring*> rings;
+		GetRegistry().Snapshot(rings);
+
+		const unsigned long pid = ::GetCurrentProcessId();
+
+		std::string json;
+		json.reserve(rings.size() * kRingSize * 64);
+		json += "{\"traceEvents\":[";
+
+		bool first = true;
+		char line[256];
+		std::vector<Event> events;
+		for (Ring * r : rings)
+		{
+			const uint32_t end = r->head.load(std::memory_order_acquire);
+			uint32_t begin = end > kRingSize ? end - kRingSize : 0;
+
+			events.clear();
+			for (uint32_t i = begin; i != end; i++)
+			{
+				events.push_back(r->events[i & (kRingSize - 1)]);
+			}
+
+			// anything the writer lapped while we were copying is torn, the
+			// slot of event |now| - kRingSize too, it is the one written next
+			const uint32_t now = r->head.load(std::memory_order_acquire);
+			const uint32_t valid = now >= kRingSize ? now - kRingSize + 1 : 0;
+			if (valid > begin)
+			{
+				size_t skip = std::min<size_t>(valid - begin, events.size());
+				events.erase(events.begin(), events.begin() + skip);
+			}
+
+			for (const Event & e : events)
+			{
+				if (e.stage >= kTraceStageCount)
+					continue;
+
+				int n = snprintf(line, sizeof(line),
+								 "%s\n{\"name\":\"%s\",\"cat\":\"video\",\"ph\":\"%c\",\"ts\":%lld,\"pid\":%lu,\"tid\":%lu,"
+								 "\"args\":{\"rtp\":%u,\"capture_ms\":%lld}}",
+								 first ? "" : ",",
+								 kStageNames[e.stage], e.phase,
+								 static_cast<long long>(e.ts_us), pid, static_cast<unsigned long>(r->tid),
+								 e.rtp, static_cast<long long>(e.capture_ms));
+				if (n > 0)
+				{
+					json.append(line, std::min<size_t>(n, sizeof(line) - 1));
+					first = false;
+				}
+			}
+		}
+
+		json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+		return json;
+	}
+
+	bool TraceDumpFile(const std::string & path)
+	{
+		FILE * f = fopen(path.c_str(), "wb");
+		if (!f)
+			return false;
+
+		std::string json = TraceDumpJson();
+		bool ret = fwrite(json.data(), 1, json.size(), f) == json.size();
+		fclose(f);
+		return ret;
+	}
+}
@@ -0,0 +1,72 @@
+
+#ifndef WEBRTC_NET_TRACE_H_
+#define WEBRTC_NET_TRACE_H_
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+namespace Native
+{
+	// Video pipeline stages, in frame order.
+	enum TraceStage
+	{
+		kTraceCapture,		// YuvFramesCapturer2::PushFrame
+		kTraceAdapt,		// cricket::VideoCapturer::AdaptFrame
+		kTraceEncode,		// VP8EncoderImpl::Encode, including GetEncodedPartitions
+		kTracePacketize,	// EncodedImageCallback, RTP packetization of one layer
+		kTraceReceive,		// complete frame handed to the decoder by the jitter buffer
+		kTraceDecode,		// VP8DecoderImpl::Decode
+		kTraceRender,		// VideoRenderer::OnFrame
+		kTraceStageCount
+	};
+
+	// Frame pipeline tracing. Events go to a fixed size ring owned by the
+	// calling thread, so recording is a relaxed load when disabled and a
+	// few stores when enabled, no locks and no allocation after the first
+	// event of a thread. Old events are overwritten.
+	//
+	// |rtp| is the RTP timestamp and identifies a frame on both ends of the
+	// call, |capture_ms| is the sender capture time, 0 where not known.
+	void TraceEnable(bool enable);
+	bool TraceEnabled();
+	void TraceEvent(TraceStage stage, char phase, uint32_t rtp, int64_t capture_ms);
+
+	// at |ts_us| on the rtc::TimeMicros clock, for a stage that learns which
+	// frame it handled only when done
+	void TraceEvent(TraceStage stage, char phase, uint32_t rtp, int64_t capture_ms, int64_t ts_us);
+
+	// Chrome trace event format, open with chrome://tracing.
+	// Threads may still be writing, the oldest events of a ring that wraps
+	// while dumping are dropped.
+	std::string TraceDumpJson();
+	bool TraceDumpFile(const std::string & path);
+
+	class TraceScope
+	{
+	public:
+		TraceScope(TraceStage stage, uint32_t rtp, int64_t capture_ms) :
+			stage_(stage), rtp_(rtp), capture_ms_(capture_ms), enabled_(TraceEnabled())
+		{
+			if (enabled_)
+			{
+				TraceEvent(stage_, 'B', rtp_, capture_ms_);
+			}
+		}
+
+		~TraceScope()
+		{
+			if (enabled_)
+			{
+				TraceEvent(stage_, 'E', rtp_, capture_ms_);
+			}
+		}
+
+	private:
+		TraceStage stage_;
+		uint32_t rtp_;
+		int64_t capture_ms_;
+		bool enabled_;
+	};
+}
+#endif  // WEBRTC_NET_TRACE_H_
@@ -0,0 +1,224 @@
+
+#include "turnauth.h"
+
+#include <stdlib.h>
+
+#include "webrtc/base/base64.h"
+#include "webrtc/base/fileutils.h"
+#include "webrtc/base/logging.h"
+#include "webrtc/base/messagedigest.h"
+#include "webrtc/base/pathutils.h"
+#include "webrtc/base/stream.h"
+#include "webrtc/base/stringencode.h"
+#include "webrtc/base/stringutils.h"
+#include "webrtc/p2p/base/stun.h"
+
+namespace Native
+{
+	namespace
+	{
+		const uint32_t kMsgCheck = 1;
+
+		// SHA-1
+		const size_t kHmacSize = 20;
+	}
+
+	TurnCredentials::TurnCredentials() :
+		keys_(std::make_shared<KeyMap>()),
+		modified_(0),
+		size_(0)
+	{
+	}
+
+	TurnCredentials::~TurnCredentials()
+	{
+		if (watcher_)
+		{
+			watcher_->Stop();
+		}
+	}
+
+	bool TurnCredentials::Watch(const std::string & path)
+	{
+		if (watcher_)
+		{
+			watcher_->Stop();
+			watcher_.reset();
+		}
+
+		path_ = path;
+		Changed();
+		if (!Reload())
+			return false;
+
+		watcher_ = rtc::Thread::Create();
+		watcher_->SetName("turn_auth", this);
+		watcher_->Start();
+		watcher_->PostDelayed(RTC_FROM_HERE, kCheckIntervalMs, this, kMsgCheck);
+		return true;
+	}
+
+	bool TurnCredentials::Reload()
+	{
+		// parsed outside the lock, GetKey goes on with the old keys
+		std::shared_ptr<KeyMap> keys = std::make_shared<KeyMap>();
+		if (!Parse(path_, keys.get()))
+		{
+			LOG(LS_WARNING) << "Failed to load TURN auth file " << path_;
+			return false;
+		}
+
+		LOG(INFO) << "Loaded " << keys->size() << " TURN users from " << path_;
+
+		rtc::CritScope lock(&crit_);
+		keys_ = keys;
+		return true;
+	}
+
+	void TurnCredentials::SetSecret(const std::string & secret)
+	{
+		rtc::CritScope lock(&crit_);
+		secret_ = secret;
+		cache_.clear();
+	}
+
+	bool TurnCredentials::GetKey(const std::string & username, const std::string & realm, std::string * key)
+	{
+		std::shared_ptr<const KeyMap> keys;
+		{
+			rtc::CritScope lock(&crit_);
+			keys = keys_;
+		}
+
+		auto it = keys->find(username);
+		if (it != keys->end())
+		{
+			*key = it->second;
+			return true;
+		}
+		return GetRestKey(username, realm, key);
+	}
+
+	bool TurnCredentials::GetRestKey(const std::string & username, const std::string & realm, std::string * key)
+	{
+		char * end = nullptr;
+		const long long expires = strtoll(username.c_str(), &end, 10);
+		if (end == username.c_str() || (*end != '\0' && *end != ':'))
+			return false;
+
+		const time_t now = time(nullptr);
+		if (expires < now)
+			return false;
+
+		const std::string id = username + '\n' + realm;
+		std::string secret;
+		{
+			rtc::CritScope lock(&crit_);
+			if (secret_.empty())
+				return false;
+
+			auto it = cache_.find(id);
+			if (it != cache_.end())
+			{
+				*key = it->second.key;
+				return true;
+			}
+			secret = secret_;
+		}
+
+		char hmac[kHmacSize];
+		if (rtc::ComputeHmac(rtc::DIGEST_SHA_1, secret.data(), secret.size(), username.data(), username.size(), hmac, sizeof(hmac)) != sizeof(hmac))
+			return false;
+
+		std::string password;
+		rtc::Base64::EncodeFromArray(hmac, sizeof(hmac), &password);
+		if (!cricket::ComputeStunCredentialHash(username, realm, password, key))
+			return false;
+
+		rtc::CritScope lock(&crit_);
+		if (secret != secret_)
+			return true;
+
+		if (cache_.size() >= kMaxCached)
+		{
+			for (auto it = cache_.begin(); it != cache_.end();)
+			{
+				if (it->second.expires < now)
+					it = cache_.erase(it);
+				else
+					++it;
+			}
+
+			// all live, start over rather than grow
+			if (cache_.size() >= kMaxCached)
+			{
+				cache_.clear();
+			}
+		}
+		cache_[id] = CachedKey{ *key, static_cast<time_t>(expires) };
+		return true;
+	}
+
+	void TurnCredentials::OnMessage(rtc::Message * msg)
+	{
+		if (msg->message_id == kMsgCheck)
+		{
+			if (Changed())
+			{
+				Reload();
+			}
+			watcher_->PostDelayed(RTC_FROM_HERE, kCheckIntervalMs, this, kMsgCheck);
+		}
+	}
+
+	bool TurnCredentials::Changed()
+	{
+		rtc::Pathname path(path_);
+		time_t modified = 0;
+		size_t size = 0;
+		if (!rtc::Filesystem::GetFileTime(path, rtc::FTT_MODIFIED, &modified) ||
+			!rtc::Filesystem::GetFileSize(path, &size))
+		{
+			// being replaced, try again next time
+			return false;
+		}
+
+		if (modified == modified_ && size == size_)
+			return false;
+
+		modified_ = modified;
+		size_ = size;
+		return true;
+	}
+
+	bool TurnCredentials::Parse(const std::string & path, KeyMap * keys)
+	{
+		rtc::FileStream stream;
+		if (!stream.Open(path, "r", nullptr))
+			return false;
+
+		std::string line;
+		rtc::StreamResult res;
+		while ((res = stream.ReadLine(&line)) == rtc::SR_SUCCESS)
+		{
+			size_t eq = line.find('=');
+			if (eq == std::string::npos)
+				continue;
+
+			std::string name = rtc::string_trim(line.substr(0, eq));
+			std::string hex = rtc::string_trim(line.substr(eq + 1));
+			if (name.empty() || hex.empty())
+				continue;
+
+			char buf[32];
+			size_t len = rtc::hex_decode(buf, sizeof(buf), hex);
+			if (len == 0)
+			{
+				LOG(LS_WARNING) << "Bad HA1 for TURN user " << name;
+				continue;
+			}
+			(*keys)[name] = std::string(buf, len);
+		}
+		return res == rtc::SR_EOS;
+	}
+}
@@ -0,0 +1,82 @@
+
+#ifndef WEBRTC_NET_TURNAUTH_H_
+#define WEBRTC_NET_TURNAUTH_H_
+#pragma once
+
+#include <ctime>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/base/messagehandler.h"
+#include "webrtc/base/thread.h"
+#include "webrtc/p2p/base/turnserver.h"
+
+namespace Native
+{
+	// Credentials for the TURN servers, safe to share between TurnRelay
+	// workers. Two kinds:
+	//
+	// The auth file, lines of <username>=<HA1> with HA1 generated via
+	// "echo -n "<username>:<realm>:<password>" | md5sum". Keys are decoded
+	// once into a hash map; when the file changes it is parsed again on a
+	// thread of its own and swapped in whole, lookups never wait on it.
+	//
+	// Time-limited REST credentials, enabled by a shared secret: the
+	// username is <expiry unix time>[:<name>] and the password
+	// base64(HMAC-SHA1(secret, username)). The derived keys are cached until
+	// they expire, so a reconnect storm does the HMAC once per username.
+	class TurnCredentials : public cricket::TurnAuthInterface,
+		public rtc::MessageHandler
+	{
+	public:
+		TurnCredentials();
+		~TurnCredentials() override;
+
+		// Loads |path| and reloads it whenever it changes. False if it can't
+		// be loaded now, nothing is watched then.
+		bool Watch(const std::string & path);
+
+		// Reloads the watched file now, keeps the current keys on failure.
+		bool Reload();
+
+		// Empty disables REST credentials.
+		void SetSecret(const std::string & secret);
+
+		// any thread
+		bool GetKey(const std::string & username, const std::string & realm, std::string * key) override;
+
+		static const int kCheckIntervalMs = 2000;
+		static const size_t kMaxCached = 64 * 1024;
+
+	private:
+		typedef std::unordered_map<std::string, std::string> KeyMap;
+
+		struct CachedKey
+		{
+			std::string key;
+			time_t expires;
+		};
+
+		void OnMessage(rtc::Message * msg) override;
+		bool Changed();
+		bool GetRestKey(const std::string & username, const std::string & realm, std::string * key);
+
+		static bool Parse(const std::string & path, KeyMap * keys);
+
+		rtc::CriticalSection crit_;
+
+		// replaced, never modified, under |crit_|
+		std::shared_ptr<const KeyMap> keys_;
+		std::string secret_;
+		std::unordered_map<std::string, CachedKey> cache_;
+
+		// watcher thread
+		std::unique_ptr<rtc::Thread> watcher_;
+		std::string path_;
+		time_t modified_;
+		size_t size_;
+	};
+}
+#endif  // WEBRTC_NET_TURNAUTH_H_
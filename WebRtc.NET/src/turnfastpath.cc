@@ -0,0 +1,536 @@
+
+#include "turnfastpath.h"
+
+#include <string.h>
+
+#include "webrtc/base/bytebuffer.h"
+#include "webrtc/base/logging.h"
+#include "webrtc/base/timeutils.h"
+#include "webrtc/p2p/base/stun.h"
+
+namespace Native
+{
+	namespace
+	{
+		const size_t kChannelHeaderSize = 4;
+		const uint16_t kMinChannel = 0x4000;
+		const uint16_t kMaxChannel = 0x7FFF;
+
+		uint16_t ReadUInt16(const char * p)
+		{
+			return static_cast<uint16_t>((static_cast<uint8_t>(p[0]) << 8) | static_cast<uint8_t>(p[1]));
+		}
+
+		bool IsChannelData(const char * data, size_t size)
+		{
+			// the two top bits are 01, STUN has 00
+			return size >= kChannelHeaderSize && (static_cast<uint8_t>(data[0]) & 0xC0) == 0x40;
+		}
+
+		bool IsStun(const char * data, size_t size)
+		{
+			return size >= cricket::kStunHeaderSize && (static_cast<uint8_t>(data[0]) & 0xC0) == 0;
+		}
+
+		// class bits of the message type
+		const uint16_t kStunClassMask = 0x0110;
+		const uint16_t kStunErrorResponse = 0x0110;
+
+		// accounted by the name after the expiry of REST usernames
+		std::string BillingName(const std::string & username)
+		{
+			size_t digits = 0;
+			while (digits < username.size() && username[digits] >= '0' && username[digits] <= '9')
+			{
+				++digits;
+			}
+			if (digits > 0 && digits < username.size() && username[digits] == ':')
+				return username.substr(digits + 1);
+
+			return username;
+		}
+	}
+
+	size_t SocketAddressHash::operator()(const rtc::SocketAddress & addr) const
+	{
+		// spread all the bits, TurnRelay shards on a cheaper hash of the same
+		uint64_t h = (static_cast<uint64_t>(rtc::HashIP(addr.ipaddr())) << 16) ^ addr.port();
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return static_cast<size_t>(h);
+	}
+
+	struct TurnFastPath::Allocation
+	{
+		rtc::AsyncPacketSocket * relay;
+		rtc::SocketAddress client;
+		std::string username;
+		int64_t created_ms;
+		RelayCounters relayed;
+
+		// by channel number - kMinChannel
+		std::vector<Channel> channels;
+		std::unordered_map<rtc::SocketAddress, uint16_t, SocketAddressHash> peers;
+	};
+
+	TurnFastPath::TurnFastPath() :
+		internal_(nullptr),
+		current_client_(nullptr),
+		request_signed_(false),
+		client_sends_(0),
+		allocations_created_(0),
+		auth_failures_(0),
+		permission_misses_(0),
+		relay_drops_(0),
+		closed_()
+	{
+	}
+
+	TurnFastPath::~TurnFastPath()
+	{
+	}
+
+	bool TurnFastPath::FromClient(const char * data, size_t size, const rtc::SocketAddress & client)
+	{
+		if (!IsChannelData(data, size))
+			return false;
+
+		auto a = allocations_.find(client);
+		if (a == allocations_.end())
+			return false;
+
+		const size_t index = ReadUInt16(data) - kMinChannel;
+		const size_t length = ReadUInt16(data + 2);
+		if (index >= a->second->channels.size() || size < kChannelHeaderSize + length)
+			return false;
+
+		const Channel & c = a->second->channels[index];
+		if (c.expires < rtc::TimeMillis())
+			return false;
+
+		// TurnServer does not check the permission for ChannelData either
+		rtc::PacketOptions options;
+		int ret = a->second->relay->SendTo(data + kChannelHeaderSize, length, c.peer, options);
+		OnPeerSent(a->second.get(), length, ret);
+		return true;
+	}
+
+	void TurnFastPath::BeginRequest(const char * data, size_t size, const rtc::SocketAddress & client)
+	{
+		current_client_ = &client;
+
+		// requests only, indications carry data
+		if (!IsStun(data, size) || (ReadUInt16(data) & kStunClassMask) != 0)
+			return;
+
+		cricket::TurnMessage msg;
+		rtc::ByteBufferReader buf(data, size);
+		if (!msg.Read(&buf))
+			return;
+
+		// whose allocation, or auth failure if it is refused
+		const cricket::StunByteStringAttribute * username = msg.GetByteString(cricket::STUN_ATTR_USERNAME);
+		if (username)
+		{
+			request_signed_ = true;
+			request_username_ = username->GetString();
+		}
+
+		if (msg.type() != cricket::TURN_CHANNEL_BIND_REQUEST)
+			return;
+
+		const cricket::StunUInt32Attribute * channel = msg.GetUInt32(cricket::STUN_ATTR_CHANNEL_NUMBER);
+		const cricket::StunAddressAttribute * peer = msg.GetAddress(cricket::STUN_ATTR_XOR_PEER_ADDRESS);
+		if (!channel || !peer)
+			return;
+
+		// committed if TurnServer answers with success
+		pending_.reset(new Pending());
+		pending_->client = client;
+		pending_->peer = peer->GetAddress();
+		pending_->channel = static_cast<uint16_t>(channel->value() >> 16);
+		pending_->transaction_id = msg.transaction_id();
+	}
+
+	void TurnFastPath::EndRequest()
+	{
+		current_client_ = nullptr;
+		request_signed_ = false;
+		pending_.reset();
+	}
+
+	void TurnFastPath::OnClientSend(const char * data, size_t size, const rtc::SocketAddress & client)
+	{
+		++client_sends_;
+		if (!IsStun(data, size))
+			return;
+
+		const uint16_t type = ReadUInt16(data);
+		if ((type & kStunClassMask) == kStunErrorResponse)
+		{
+			CountError(data, size);
+			return;
+		}
+
+		if (!pending_ || type != cricket::TURN_CHANNEL_BIND_RESPONSE)
+			return;
+
+		// the id ends the header, 12 bytes after the magic cookie or 16
+		const std::string & id = pending_->transaction_id;
+		if (client != pending_->client || id.size() > cricket::kStunHeaderSize - 4 ||
+			memcmp(data + cricket::kStunHeaderSize - id.size(), id.data(), id.size()) != 0)
+			return;
+
+		auto a = allocations_.find(client);
+		if (a != allocations_.end())
+		{
+			Bind(a->second.get(), pending_->channel, pending_->peer);
+		}
+		pending_.reset();
+	}
+
+	void TurnFastPath::CountError(const char * data, size_t size)
+	{
+		// the first unauthenticated request of a client is always refused
+		if (!request_signed_)
+			return;
+
+		cricket::TurnMessage msg;
+		rtc::ByteBufferReader buf(data, size);
+		if (!msg.Read(&buf))
+			return;
+
+		const cricket::StunErrorCodeAttribute * error = msg.GetErrorCode();
+		if (error && error->code() == cricket::STUN_ERROR_UNAUTHORIZED)
+		{
+			++auth_failures_;
+		}
+	}
+
+	void TurnFastPath::Bind(Allocation * allocation, uint16_t channel, const rtc::SocketAddress & peer)
+	{
+		if (channel < kMinChannel || channel > kMaxChannel)
+			return;
+
+		const size_t index = channel - kMinChannel;
+		if (index >= allocation->channels.size())
+		{
+			allocation->channels.resize(index + 1, Channel{ rtc::SocketAddress(), 0, 0 });
+		}
+
+		// TurnServer refuses to rebind a live one, so a change means
+		// the old binding expired there
+		Channel & c = allocation->channels[index];
+		if (!c.peer.IsNil() && c.peer != peer)
+		{
+			allocation->peers.erase(c.peer);
+		}
+
+		auto p = allocation->peers.find(peer);
+		if (p != allocation->peers.end() && p->second != channel)
+		{
+			allocation->channels[p->second - kMinChannel] = Channel{ rtc::SocketAddress(), 0, 0 };
+		}
+
+		// a ChannelBind refreshes the permission too
+		const int64_t now = rtc::TimeMillis();
+		c.peer = peer;
+		c.expires = now + kChannelLifetimeMs;
+		c.permitted = now + kPermissionLifetimeMs;
+		allocation->peers[peer] = channel;
+	}
+
+	TurnFastPath::Allocation * TurnFastPath::AddAllocation(rtc::AsyncPacketSocket * relay)
+	{
+		if (current_client_ == nullptr)
+			return nullptr;
+
+		std::unique_ptr<Allocation> & a = allocations_[*current_client_];
+		if (a)
+		{
+			// TurnServer keeps one per client, the previous socket is not ours
+			return nullptr;
+		}
+
+		a.reset(new Allocation());
+		a->relay = relay;
+		a->client = *current_client_;
+		a->username = request_username_;
+		a->created_ms = rtc::TimeMillis();
+		a->relayed = RelayCounters();
+
+		++allocations_created_;
+		++users_[BillingName(a->username)].allocations;
+		return a.get();
+	}
+
+	void TurnFastPath::RemoveAllocation(Allocation * allocation)
+	{
+		auto a = allocations_.find(allocation->client);
+		if (a != allocations_.end() && a->second.get() == allocation)
+		{
+			closed_.Add(allocation->relayed);
+			users_[BillingName(allocation->username)].relayed.Add(allocation->relayed);
+			allocations_.erase(a);
+		}
+	}
+
+	bool TurnFastPath::FromPeer(Allocation * allocation, const char * data, size_t size, const rtc::SocketAddress & peer)
+	{
+		if (internal_ == nullptr || size > 0xFFFF)
+			return false;
+
+		auto p = allocation->peers.find(peer);
+		if (p == allocation->peers.end())
+			return false;
+
+		// TurnServer drops these without a permission, let it
+		const Channel & c = allocation->channels[p->second - kMinChannel];
+		if (c.permitted < rtc::TimeMillis())
+			return false;
+
+		send_buffer_.resize(kChannelHeaderSize + size);
+		char * out = send_buffer_.data();
+		out[0] = static_cast<char>(p->second >> 8);
+		out[1] = static_cast<char>(p->second);
+		out[2] = static_cast<char>(size >> 8);
+		out[3] = static_cast<char>(size);
+		memcpy(out + kChannelHeaderSize, data, size);
+
+		internal_->SendToClient(out, send_buffer_.size(), allocation->client);
+		OnPeerReceived(allocation, size, true);
+		return true;
+	}
+
+	void TurnFastPath::OnPeerSent(Allocation * allocation, size_t size, int result)
+	{
+		if (result < 0)
+		{
+			++relay_drops_;
+			return;
+		}
+
+		++allocation->relayed.packets_to_peer;
+		allocation->relayed.bytes_to_peer += size;
+	}
+
+	void TurnFastPath::OnPeerReceived(Allocation * allocation, size_t size, bool relayed)
+	{
+		// TurnServer sends nothing for a peer without a permission
+		if (!relayed)
+		{
+			++permission_misses_;
+			return;
+		}
+
+		++allocation->relayed.packets_from_peer;
+		allocation->relayed.bytes_from_peer += size;
+	}
+
+	void TurnFastPath::Collect(ServerStats & stats) const
+	{
+		stats.allocations_created += allocations_created_;
+		stats.allocations_active += allocations_.size();
+		stats.auth_failures += auth_failures_;
+		stats.permission_misses += permission_misses_;
+		stats.relay_drops += relay_drops_;
+		stats.relayed.Add(closed_);
+
+		std::unordered_map<std::string, UserStats> users(users_);
+		for (auto & it : allocations_)
+		{
+			const Allocation & a = *it.second;
+			stats.relayed.Add(a.relayed);
+
+			AllocationStats s;
+			s.username = a.username;
+			s.client = a.client;
+			s.relay = a.relay->GetLocalAddress();
+			s.created_ms = a.created_ms;
+			s.relayed = a.relayed;
+			stats.allocations.push_back(s);
+
+			UserStats & u = users[BillingName(a.username)];
+			++u.active;
+			u.relayed.Add(a.relayed);
+		}
+
+		for (auto & it : users)
+		{
+			it.second.username = it.first;
+			stats.users.push_back(it.second);
+		}
+	}
+
+	ForwardingPacketSocket::ForwardingPacketSocket(rtc::AsyncPacketSocket * socket) : socket_(socket)
+	{
+		socket_->SignalSentPacket.connect(this, &ForwardingPacketSocket::OnSentPacket);
+		socket_->SignalReadyToSend.connect(this, &ForwardingPacketSocket::OnReadyToSend);
+	}
+
+	rtc::SocketAddress ForwardingPacketSocket::GetLocalAddress() const
+	{
+		return socket_->GetLocalAddress();
+	}
+
+	rtc::SocketAddress ForwardingPacketSocket::GetRemoteAddress() const
+	{
+		return socket_->GetRemoteAddress();
+	}
+
+	int ForwardingPacketSocket::Send(const void * pv, size_t cb, const rtc::PacketOptions & options)
+	{
+		return socket_->Send(pv, cb, options);
+	}
+
+	int ForwardingPacketSocket::SendTo(const void * pv, size_t cb, const rtc::SocketAddress & addr, const rtc::PacketOptions & options)
+	{
+		return socket_->SendTo(pv, cb, addr, options);
+	}
+
+	int ForwardingPacketSocket::Close()
+	{
+		return socket_->Close();
+	}
+
+	rtc::AsyncPacketSocket::State ForwardingPacketSocket::GetState() const
+	{
+		return socket_->GetState();
+	}
+
+	int ForwardingPacketSocket::GetOption(rtc::Socket::Option opt, int * value)
+	{
+		return socket_->GetOption(opt, value);
+	}
+
+	int ForwardingPacketSocket::SetOption(rtc::Socket::Option opt, int value)
+	{
+		return socket_->SetOption(opt, value);
+	}
+
+	int ForwardingPacketSocket::GetError() const
+	{
+		return socket_->GetError();
+	}
+
+	void ForwardingPacketSocket::SetError(int error)
+	{
+		socket_->SetError(error);
+	}
+
+	void ForwardingPacketSocket::OnSentPacket(rtc::AsyncPacketSocket * socket, const rtc::SentPacket & packet)
+	{
+		SignalSentPacket(this, packet);
+	}
+
+	void ForwardingPacketSocket::OnReadyToSend(rtc::AsyncPacketSocket * socket)
+	{
+		SignalReadyToSend(this);
+	}
+
+	TurnInternalSocket::TurnInternalSocket(rtc::AsyncPacketSocket * socket, TurnFastPath * fast_path) :
+		ForwardingPacketSocket(socket),
+		fast_path_(fast_path)
+	{
+		fast_path_->set_internal(this);
+	}
+
+	TurnInternalSocket::~TurnInternalSocket()
+	{
+		// the allocations go after this one
+		fast_path_->set_internal(nullptr);
+	}
+
+	int TurnInternalSocket::SendTo(const void * pv, size_t cb, const rtc::SocketAddress & addr, const rtc::PacketOptions & options)
+	{
+		fast_path_->OnClientSend(static_cast<const char*>(pv), cb, addr);
+		return socket_->SendTo(pv, cb, addr, options);
+	}
+
+	int TurnInternalSocket::SendToClient(const void * pv, size_t cb, const rtc::SocketAddress & addr)
+	{
+		rtc::PacketOptions options;
+		return socket_->SendTo(pv, cb, addr, options);
+	}
+
+	void TurnInternalSocket::OnReadPacket(rtc::AsyncPacketSocket * socket, const char * data, size_t size,
+										  const rtc::SocketAddress & remote, const rtc::PacketTime & time)
+	{
+		if (fast_path_->FromClient(data, size, remote))
+			return;
+
+		fast_path_->BeginRequest(data, size, remote);
+		SignalReadPacket(this, data, size, remote, time);
+		fast_path_->EndRequest();
+	}
+
+	TurnRelaySocket::TurnRelaySocket(rtc::AsyncPacketSocket * socket, TurnFastPath * fast_path, TurnFastPath::Allocation * allocation) :
+		ForwardingPacketSocket(socket),
+		fast_path_(fast_path),
+		allocation_(allocation)
+	{
+		socket_->SignalReadPacket.connect(this, &TurnRelaySocket::OnReadPacket);
+	}
+
+	TurnRelaySocket::~TurnRelaySocket()
+	{
+		fast_path_->RemoveAllocation(allocation_);
+	}
+
+	void TurnRelaySocket::OnReadPacket(rtc::AsyncPacketSocket * socket, const char * data, size_t size,
+									   const rtc::SocketAddress & remote, const rtc::PacketTime & time)
+	{
+		if (fast_path_->FromPeer(allocation_, data, size, remote))
+			return;
+
+		// relayed if TurnServer sent anything to the client
+		const uint64_t sends = fast_path_->client_sends();
+		SignalReadPacket(this, data, size, remote, time);
+		fast_path_->OnPeerReceived(allocation_, size, fast_path_->client_sends() != sends);
+	}
+
+	int TurnRelaySocket::SendTo(const void * pv, size_t cb, const rtc::SocketAddress & addr, const rtc::PacketOptions & options)
+	{
+		int ret = ForwardingPacketSocket::SendTo(pv, cb, addr, options);
+		fast_path_->OnPeerSent(allocation_, cb, ret);
+		return ret;
+	}
+
+	TurnRelaySocketFactory::TurnRelaySocketFactory(rtc::Thread * thread, TurnFastPath * fast_path) :
+		factory_(thread),
+		fast_path_(fast_path)
+	{
+	}
+
+	rtc::AsyncPacketSocket * TurnRelaySocketFactory::CreateUdpSocket(const rtc::SocketAddress & address, uint16_t min_port, uint16_t max_port)
+	{
+		rtc::AsyncPacketSocket * socket = factory_.CreateUdpSocket(address, min_port, max_port);
+		if (socket == nullptr)
+			return nullptr;
+
+		TurnFastPath::Allocation * allocation = fast_path_->AddAllocation(socket);
+		if (allocation == nullptr)
+			return socket;
+
+		return new TurnRelaySocket(socket, fast_path_, allocation);
+	}
+
+	rtc::AsyncPacketSocket * TurnRelaySocketFactory::CreateServerTcpSocket(const rtc::SocketAddress & local_address, uint16_t min_port, uint16_t max_port, int opts)
+	{
+		return factory_.CreateServerTcpSocket(local_address, min_port, max_port, opts);
+	}
+
+	rtc::AsyncPacketSocket * TurnRelaySocketFactory::CreateClientTcpSocket(const rtc::SocketAddress & local_address, const rtc::SocketAddress & remote_address,
+																			const rtc::ProxyInfo & proxy_info, const std::string & user_agent, int opts)
+	{
+		return factory_.CreateClientTcpSocket(local_address, remote_address, proxy_info, user_agent, opts);
+	}
+
+	rtc::AsyncResolverInterface * TurnRelaySocketFactory::CreateAsyncResolver()
+	{
+		return factory_.CreateAsyncResolver();
+	}
+}
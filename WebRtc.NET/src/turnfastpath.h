@@ -0,0 +1,215 @@
+
+#ifndef WEBRTC_NET_TURNFASTPATH_H_
+#define WEBRTC_NET_TURNFASTPATH_H_
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "webrtc/base/asyncpacketsocket.h"
+#include "webrtc/base/refcount.h"
+#include "webrtc/base/scoped_ref_ptr.h"
+#include "webrtc/base/socketaddress.h"
+#include "webrtc/p2p/base/basicpacketsocketfactory.h"
+
+#include "servermetrics.h"
+
+namespace Native
+{
+	class TurnInternalSocket;
+
+	struct SocketAddressHash
+	{
+		size_t operator()(const rtc::SocketAddress & addr) const;
+	};
+
+	// Hash-indexed mirror of the channel bindings of one cricket::TurnServer.
+	// TurnServer finds allocations, permissions and channels with std::map and
+	// std::list searches on every packet; ChannelData in both directions is
+	// relayed from here instead, with O(1) lookups by client, channel number
+	// and peer. Bindings are learnt from the ChannelBind responses TurnServer
+	// sends, so it stays the authority: anything not found here, expired or
+	// not ChannelData goes to it unchanged. One thread, the TurnServer's.
+	//
+	// Also keeps the allocation and user accounting of ServerStats, as it
+	// sees every relayed packet and every response TurnServer sends.
+	class TurnFastPath : public rtc::RefCountInterface
+	{
+	public:
+		struct Allocation;
+
+		TurnFastPath();
+
+		// TurnInternalSocket, true if |data| was ChannelData of a bound channel
+		// and has been relayed
+		bool FromClient(const char * data, size_t size, const rtc::SocketAddress & client);
+
+		// TurnInternalSocket, around handing a packet to TurnServer and
+		// for everything it sends to a client
+		void BeginRequest(const char * data, size_t size, const rtc::SocketAddress & client);
+		void EndRequest();
+		void OnClientSend(const char * data, size_t size, const rtc::SocketAddress & client);
+
+		// TurnRelaySocketFactory, the allocation of the client being served;
+		// nullptr outside an Allocate request
+		Allocation * AddAllocation(rtc::AsyncPacketSocket * relay);
+		void RemoveAllocation(Allocation * allocation);
+
+		// TurnRelaySocket, true if |data| came from a bound peer and has been
+		// relayed as ChannelData
+		bool FromPeer(Allocation * allocation, const char * data, size_t size, const rtc::SocketAddress & peer);
+
+		// TurnRelaySocket, for what TurnServer relays itself
+		void OnPeerSent(Allocation * allocation, size_t size, int result);
+		void OnPeerReceived(Allocation * allocation, size_t size, bool relayed);
+
+		uint64_t client_sends() const
+		{
+			return client_sends_;
+		}
+
+		// adds the counters and allocations to |stats|, users unmerged
+		void Collect(ServerStats & stats) const;
+
+		void set_internal(TurnInternalSocket * socket)
+		{
+			internal_ = socket;
+		}
+
+		size_t allocations() const
+		{
+			return allocations_.size();
+		}
+
+		// TurnServer's lifetimes, less a second so this never outlives it
+		static const int kChannelLifetimeMs = 10 * 60 * 1000 - 1000;
+		static const int kPermissionLifetimeMs = 5 * 60 * 1000 - 1000;
+
+	protected:
+		~TurnFastPath() override;
+
+	private:
+		struct Channel
+		{
+			rtc::SocketAddress peer;
+			int64_t expires;
+			int64_t permitted;
+		};
+
+		struct Pending
+		{
+			rtc::SocketAddress client;
+			rtc::SocketAddress peer;
+			uint16_t channel;
+			std::string transaction_id;
+		};
+
+		void Bind(Allocation * allocation, uint16_t channel, const rtc::SocketAddress & peer);
+		void CountError(const char * data, size_t size);
+
+		std::unordered_map<rtc::SocketAddress, std::unique_ptr<Allocation>, SocketAddressHash> allocations_;
+		TurnInternalSocket * internal_;
+
+		// set while TurnServer handles a packet of |current_client_|
+		const rtc::SocketAddress * current_client_;
+		std::string request_username_;
+		bool request_signed_;
+		std::unique_ptr<Pending> pending_;
+		std::vector<char> send_buffer_;
+
+		uint64_t client_sends_;
+		uint64_t allocations_created_;
+		uint64_t auth_failures_;
+		uint64_t permission_misses_;
+		uint64_t relay_drops_;
+
+		// of closed allocations
+		RelayCounters closed_;
+		std::unordered_map<std::string, UserStats> users_;
+	};
+
+	// AsyncPacketSocket passing everything through to the one it owns,
+	// reads are left to the subclass.
+	class ForwardingPacketSocket : public rtc::AsyncPacketSocket
+	{
+	public:
+		explicit ForwardingPacketSocket(rtc::AsyncPacketSocket * socket);
+
+		rtc::SocketAddress GetLocalAddress() const override;
+		rtc::SocketAddress GetRemoteAddress() const override;
+		int Send(const void * pv, size_t cb, const rtc::PacketOptions & options) override;
+		int SendTo(const void * pv, size_t cb, const rtc::SocketAddress & addr, const rtc::PacketOptions & options) override;
+		int Close() override;
+		State GetState() const override;
+		int GetOption(rtc::Socket::Option opt, int * value) override;
+		int SetOption(rtc::Socket::Option opt, int value) override;
+		int GetError() const override;
+		void SetError(int error) override;
+
+	protected:
+		std::unique_ptr<rtc::AsyncPacketSocket> socket_;
+
+	private:
+		void OnSentPacket(rtc::AsyncPacketSocket * socket, const rtc::SentPacket & packet);
+		void OnReadyToSend(rtc::AsyncPacketSocket * socket);
+	};
+
+	// What TurnServer gets as its internal socket. Packets are fed through
+	// OnReadPacket, by connecting it to |socket| or by hand as TurnRelay does
+	// after sharding. Owns |socket|, TurnServer deletes this one.
+	class TurnInternalSocket : public ForwardingPacketSocket
+	{
+	public:
+		TurnInternalSocket(rtc::AsyncPacketSocket * socket, TurnFastPath * fast_path);
+		~TurnInternalSocket() override;
+
+		int SendTo(const void * pv, size_t cb, const rtc::SocketAddress & addr, const rtc::PacketOptions & options) override;
+
+		void OnReadPacket(rtc::AsyncPacketSocket * socket, const char * data, size_t size,
+						  const rtc::SocketAddress & remote, const rtc::PacketTime & time);
+
+		// the fast path, skips OnClientSend
+		int SendToClient(const void * pv, size_t cb, const rtc::SocketAddress & addr);
+
+	private:
+		rtc::scoped_refptr<TurnFastPath> fast_path_;
+	};
+
+	// External socket of one allocation.
+	class TurnRelaySocket : public ForwardingPacketSocket
+	{
+	public:
+		TurnRelaySocket(rtc::AsyncPacketSocket * socket, TurnFastPath * fast_path, TurnFastPath::Allocation * allocation);
+		~TurnRelaySocket() override;
+
+		int SendTo(const void * pv, size_t cb, const rtc::SocketAddress & addr, const rtc::PacketOptions & options) override;
+
+	private:
+		void OnReadPacket(rtc::AsyncPacketSocket * socket, const char * data, size_t size,
+						  const rtc::SocketAddress & remote, const rtc::PacketTime & time);
+
+		rtc::scoped_refptr<TurnFastPath> fast_path_;
+		TurnFastPath::Allocation * allocation_;
+	};
+
+	// External socket factory for TurnServer, registers every relay socket
+	// with the fast path of the client it is allocated for.
+	class TurnRelaySocketFactory : public rtc::PacketSocketFactory
+	{
+	public:
+		TurnRelaySocketFactory(rtc::Thread * thread, TurnFastPath * fast_path);
+
+		rtc::AsyncPacketSocket * CreateUdpSocket(const rtc::SocketAddress & address, uint16_t min_port, uint16_t max_port) override;
+		rtc::AsyncPacketSocket * CreateServerTcpSocket(const rtc::SocketAddress & local_address, uint16_t min_port, uint16_t max_port, int opts) override;
+		rtc::AsyncPacketSocket * CreateClientTcpSocket(const rtc::SocketAddress & local_address, const rtc::SocketAddress & remote_address,
+													   const rtc::ProxyInfo & proxy_info, const std::string & user_agent, int opts) override;
+		rtc::AsyncResolverInterface * CreateAsyncResolver() override;
+
+	private:
+		rtc::BasicPacketSocketFactory factory_;
+		rtc::scoped_refptr<TurnFastPath> fast_path_;
+	};
+}
+#endif  // WEBRTC_NET_TURNFASTPATH_H_
@@ -0,0 +1,256 @@
+
+#include "turnrelay.h"
+
+#include "batchedudpsocket.h"
+#include "turnfastpath.h"
+
+#include "webrtc/base/copyonwritebuffer.h"
+#include "webrtc/base/logging.h"
+#include "webrtc/base/thread.h"
+
+namespace Native
+{
+	namespace
+	{
+		const uint32_t kMsgForward = 1;
+
+		struct ForwardedPacket
+		{
+			rtc::CopyOnWriteBuffer data;
+			rtc::SocketAddress remote;
+			rtc::PacketTime time;
+		};
+	}
+
+	class TurnRelay::Worker : public sigslot::has_slots<>,
+		public rtc::MessageHandler
+	{
+	public:
+		Worker(TurnRelay & relay, size_t index) :
+			relay_(relay),
+			index_(index),
+			thread_(rtc::Thread::CreateWithSocketServer()),
+			socket_(nullptr),
+			sender_(nullptr),
+			shard_(nullptr)
+		{
+			thread_->SetName("turn_relay", this);
+			thread_->Start();
+		}
+
+		~Worker()
+		{
+			Shutdown();
+			thread_->Stop();
+		}
+
+		// Stops reading, other workers may still forward here until
+		// they are shut down too.
+		void Shutdown()
+		{
+			thread_->Invoke<void>(RTC_FROM_HERE, [this]()
+			{
+				// deletes the socket too, after the allocations
+				server_.reset();
+				fast_path_ = nullptr;
+				shard_ = nullptr;
+				socket_ = nullptr;
+				sender_ = nullptr;
+				thread_->Clear(this);
+			});
+		}
+
+		// worker thread, binds a reader when |reader| is null, otherwise
+		// only sends through the reader's descriptor
+		bool Init(const rtc::SocketAddress & int_addr, const rtc::IPAddress & ext_addr,
+				  const std::string & realm, const std::string & software, cricket::TurnAuthInterface * auth,
+				  const Worker * reader)
+		{
+			rtc::AsyncPacketSocket * socket;
+			if (reader == nullptr)
+			{
+				socket_ = BatchedUdpSocket::Create(thread_.get(), int_addr, true);
+				if (!socket_)
+					return false;
+
+				// sends go out the worker socket, batched with the replies
+				// to the rest of its read
+				socket_->SignalReadPacket.connect(this, &Worker::OnPacket);
+				socket = socket_;
+			}
+			else
+			{
+				sender_ = new UdpSendSocket(reader->socket_->fd(), int_addr);
+				socket = sender_;
+			}
+			fast_path_ = new rtc::RefCountedObject<TurnFastPath>();
+			shard_ = new TurnInternalSocket(socket, fast_path_);
+
+			server_.reset(new cricket::TurnServer(thread_.get()));
+			server_->set_realm(realm);
+			server_->set_software(software);
+			server_->set_auth_hook(auth);
+			server_->AddInternalSocket(shard_, cricket::PROTO_UDP);
+			server_->SetExternalSocketFactory(new TurnRelaySocketFactory(thread_.get(), fast_path_),
+											  rtc::SocketAddress(ext_addr, 0));
+			return true;
+		}
+
+		rtc::Thread * thread() const
+		{
+			return thread_.get();
+		}
+
+		rtc::SocketAddress local() const
+		{
+			return socket_ ? socket_->GetLocalAddress() : sender_->GetLocalAddress();
+		}
+
+		// worker thread
+		void Collect(ServerStats & stats) const
+		{
+			if (!server_)
+				return;
+
+			stats.turn.Add(socket_ ? socket_->counters() : sender_->counters());
+			fast_path_->Collect(stats);
+		}
+
+		// any worker thread, takes a copy
+		void Forward(const char * data, size_t size, const rtc::SocketAddress & remote, const rtc::PacketTime & time)
+		{
+			ForwardedPacket p;
+			p.data.SetData(data, size);
+			p.remote = remote;
+			p.time = time;
+			thread_->Post(RTC_FROM_HERE, this, kMsgForward, rtc::WrapMessageData(p));
+		}
+
+	private:
+		void OnPacket(rtc::AsyncPacketSocket * socket, const char * data, size_t size,
+					  const rtc::SocketAddress & remote, const rtc::PacketTime & time)
+		{
+			const size_t shard = relay_.ShardOf(remote);
+			if (shard == index_)
+			{
+				Deliver(data, size, remote, time);
+			}
+			else
+			{
+				relay_.workers_[shard]->Forward(data, size, remote, time);
+			}
+		}
+
+		void OnMessage(rtc::Message * msg) override
+		{
+			if (msg->message_id == kMsgForward)
+			{
+				std::unique_ptr<rtc::TypedMessageData<ForwardedPacket>> data(static_cast<rtc::TypedMessageData<ForwardedPacket>*>(msg->pdata));
+				const ForwardedPacket & p = data->data();
+				Deliver(p.data.data<char>(), p.data.size(), p.remote, p.time);
+			}
+		}
+
+		void Deliver(const char * data, size_t size, const rtc::SocketAddress & remote, const rtc::PacketTime & time)
+		{
+			if (shard_ == nullptr)
+				return;
+
+			shard_->OnReadPacket(shard_, data, size, remote, time);
+		}
+
+		TurnRelay & relay_;
+		const size_t index_;
+		std::unique_ptr<rtc::Thread> thread_;
+		std::unique_ptr<cricket::TurnServer> server_;
+		rtc::scoped_refptr<TurnFastPath> fast_path_;
+
+		// owned by |server_|, one of |socket_| and |sender_|
+		BatchedUdpSocket * socket_;
+		UdpSendSocket * sender_;
+		TurnInternalSocket * shard_;
+	};
+
+	TurnRelay::TurnRelay()
+	{
+	}
+
+	TurnRelay::~TurnRelay()
+	{
+		Stop();
+	}
+
+	bool TurnRelay::Start(const rtc::SocketAddress & int_addr, const rtc::IPAddress & ext_addr,
+						  const std::string & realm, const std::string & software,
+						  cricket::TurnAuthInterface * auth, int workers)
+	{
+		if (!workers_.empty() || workers < 1)
+			return false;
+
+		// all workers exist before the first packet can be forwarded
+		for (int i = 0; i < workers; ++i)
+		{
+			workers_.emplace_back(new Worker(*this, i));
+		}
+
+#if defined(WEBRTC_WIN)
+		// no SO_REUSEPORT, the first worker reads for all of them
+		const bool single_reader = true;
+#else
+		const bool single_reader = false;
+#endif
+
+		local_ = int_addr;
+		for (auto & w : workers_)
+		{
+			const Worker * reader = single_reader && w != workers_.front() ? workers_.front().get() : nullptr;
+			bool ok = w->thread()->Invoke<bool>(RTC_FROM_HERE, [&]()
+			{
+				return w->Init(local_, ext_addr, realm, software, auth, reader);
+			});
+			if (!ok)
+			{
+				LOG(LERROR) << "TURN relay failed to bind " << local_.ToString();
+				Stop();
+				return false;
+			}
+
+			// port 0 picks one for the first worker, the rest share it
+			local_ = w->local();
+		}
+
+		LOG(INFO) << "TURN relay listening at " << local_.ToString() << ", " << workers << " threads";
+		return true;
+	}
+
+	void TurnRelay::Stop()
+	{
+		// no socket left to forward from before any worker goes away,
+		// the reader last since the senders use its descriptor
+		for (auto w = workers_.rbegin(); w != workers_.rend(); ++w)
+		{
+			(*w)->Shutdown();
+		}
+		workers_.clear();
+	}
+
+	void TurnRelay::Collect(ServerStats & stats)
+	{
+		for (auto & w : workers_)
+		{
+			w->thread()->Invoke<void>(RTC_FROM_HERE, [&]()
+			{
+				w->Collect(stats);
+			});
+		}
+	}
+
+	size_t TurnRelay::ShardOf(const rtc::SocketAddress & remote) const
+	{
+		// local address and protocol are the same for every client, the
+		// remote address and port decide
+		size_t h = rtc::HashIP(remote.ipaddr());
+		h ^= remote.port() + 0x9e3779b9 + (h << 6) + (h >> 2);
+		return h % workers_.size();
+	}
+}
@@ -0,0 +1,58 @@
+
+#ifndef WEBRTC_NET_TURNRELAY_H_
+#define WEBRTC_NET_TURNRELAY_H_
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "webrtc/base/ipaddress.h"
+#include "webrtc/base/socketaddress.h"
+#include "webrtc/p2p/base/turnserver.h"
+
+#include "servermetrics.h"
+
+namespace Native
+{
+	// TURN over UDP on several threads. Every worker runs its own
+	// cricket::TurnServer, so allocations are sharded with no shared
+	// table, and its own socket bound to the same address with
+	// SO_REUSEPORT. A client belongs to the worker its 5-tuple hashes to;
+	// a packet the OS handed to another worker's socket is forwarded
+	// there, so allocation state is only touched by one thread. Relayed
+	// (external) sockets live on the owning worker. Windows has nothing
+	// that spreads datagrams over sockets, so there the first worker
+	// binds exclusively and forwards everything, and the others send
+	// through its descriptor.
+	class TurnRelay
+	{
+	public:
+		TurnRelay();
+		~TurnRelay();
+
+		// |auth| is shared by the workers and must outlive the relay,
+		// GetKey is called concurrently.
+		bool Start(const rtc::SocketAddress & int_addr, const rtc::IPAddress & ext_addr,
+				   const std::string & realm, const std::string & software,
+				   cricket::TurnAuthInterface * auth, int workers);
+		void Stop();
+
+		// adds every worker's counters and allocations, users unmerged
+		void Collect(ServerStats & stats);
+
+		int workers() const
+		{
+			return static_cast<int>(workers_.size());
+		}
+
+	private:
+		class Worker;
+
+		size_t ShardOf(const rtc::SocketAddress & remote) const;
+
+		std::vector<std::unique_ptr<Worker>> workers_;
+		rtc::SocketAddress local_;
+	};
+}
+#endif  // WEBRTC_NET_TURNRELAY_H_
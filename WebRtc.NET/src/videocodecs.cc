@@ -0,0 +1,301 @@
+
+#include "videocodecs.h"
+
+#include <algorithm>
+
+#include "webrtc/base/logging.h"
+#include "webrtc/media/base/mediaconstants.h"
+#include "webrtc/modules/video_coding/codecs/vp8/include/vp8.h"
+#include "webrtc/modules/video_coding/codecs/vp9/include/vp9.h"
+#include "webrtc/pc/mediasession.h"
+
+#include "internals.h"
+
+namespace Native
+{
+	namespace
+	{
+		// VP8 or VP9 encoder of a session, the VP9 layers overridden and the
+		// quality scaler gated, everything else as the engine configured it
+		class SessionEncoder : public webrtc::VideoEncoder
+		{
+		public:
+			SessionEncoder(webrtc::VideoEncoder * encoder, SessionEncoderFactory * factory, size_t stream, int spatial_layers, int temporal_layers,
+						   bool resizes_in_place) :
+				encoder_(encoder),
+				factory_(factory),
+				stream_(stream),
+				spatial_layers_(spatial_layers),
+				temporal_layers_(temporal_layers),
+				resizes_in_place_(resizes_in_place),
+				encoding_(false)
+			{
+			}
+
+			size_t stream() const
+			{
+				return stream_;
+			}
+
+			bool resizes_in_place() const
+			{
+				return resizes_in_place_;
+			}
+
+			int32_t InitEncode(const webrtc::VideoCodec * codec_settings, int32_t number_of_cores, size_t max_payload_size) override
+			{
+				encoding_ = false;
+
+				webrtc::VideoCodec codec = *codec_settings;
+				if (codec.codecType == webrtc::kVideoCodecVP9 && (spatial_layers_ > 1 || temporal_layers_ > 1))
+				{
+					codec.VP9()->numberOfSpatialLayers = static_cast<unsigned char>(spatial_layers_);
+					codec.VP9()->numberOfTemporalLayers = static_cast<unsigned char>(temporal_layers_);
+				}
+				return encoder_->InitEncode(&codec, number_of_cores, max_payload_size);
+			}
+
+			int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback * callback) override
+			{
+				return encoder_->RegisterEncodeCompleteCallback(callback);
+			}
+
+			int32_t Release() override
+			{
+				// the send pipeline releases before every InitEncode, a resize
+				// included; VP8EncoderImpl::InitEncode releases by itself
+				// unless only the frame size changed, and so does its
+				// destructor
+				if (resizes_in_place_)
+					return WEBRTC_VIDEO_CODEC_OK;
+
+				return encoder_->Release();
+			}
+
+			int32_t Encode(const webrtc::VideoFrame & frame, const webrtc::CodecSpecificInfo * codec_specific_info,
+						   const std::vector<webrtc::FrameType> * frame_types) override
+			{
+				// every stream is set up before the first frame
+				if (!encoding_)
+				{
+					encoding_ = true;
+					factory_->ReleaseUnclaimed();
+				}
+				return encoder_->Encode(frame, codec_specific_info, frame_types);
+			}
+
+			int32_t SetChannelParameters(uint32_t packet_loss, int64_t rtt) override
+			{
+				return encoder_->SetChannelParameters(packet_loss, rtt);
+			}
+
+			int32_t SetRates(uint32_t bitrate, uint32_t framerate) override
+			{
+				return encoder_->SetRates(bitrate, framerate);
+			}
+
+			int32_t SetRateAllocation(const webrtc::BitrateAllocation & allocation, uint32_t framerate) override
+			{
+				return encoder_->SetRateAllocation(allocation, framerate);
+			}
+
+			ScalingSettings GetScalingSettings() const override
+			{
+				if (!factory_->quality_scaler())
+					return ScalingSettings(false);
+
+				return encoder_->GetScalingSettings();
+			}
+
+			const char * ImplementationName() const override
+			{
+				return encoder_->ImplementationName();
+			}
+
+		private:
+			std::unique_ptr<webrtc::VideoEncoder> encoder_;
+			SessionEncoderFactory * factory_;
+			const size_t stream_;
+			const int spatial_layers_;
+			const int temporal_layers_;
+			const bool resizes_in_place_;
+			bool encoding_;
+		};
+
+		size_t Rank(const std::vector<std::string> & order, const std::string & name)
+		{
+			for (size_t i = 0; i < order.size(); ++i)
+			{
+				if (cricket::CodecNamesEq(order[i], name))
+					return i;
+			}
+			return order.size();
+		}
+	}
+
+	VideoCodecPreference::VideoCodecPreference() :
+		vp9_spatial_layers(1),
+		vp9_temporal_layers(1),
+		h264_packetization_mode(-1)
+	{
+	}
+
+	void VideoCodecPreference::Apply(cricket::SessionDescription * desc) const
+	{
+		if (!desc)
+			return;
+
+		cricket::ContentInfo * content = cricket::GetFirstVideoContent(desc->contents());
+		if (!content || !content->description)
+			return;
+
+		auto video = static_cast<cricket::VideoContentDescription*>(content->description);
+		cricket::VideoCodecs codecs = video->codecs();
+
+		// RTX, RED and FEC are not named, they keep their place at the end
+		std::stable_sort(codecs.begin(), codecs.end(), [this](const cricket::VideoCodec & a, const cricket::VideoCodec & b)
+		{
+			return Rank(order, a.name) < Rank(order, b.name);
+		});
+
+		for (auto & codec : codecs)
+		{
+			if (!cricket::CodecNamesEq(codec.name, cricket::kH264CodecName))
+				continue;
+
+			if (!h264_profile_level_id.empty())
+			{
+				codec.SetParam(cricket::kH264FmtpProfileLevelId, h264_profile_level_id);
+			}
+			if (h264_packetization_mode >= 0)
+			{
+				codec.SetParam(cricket::kH264FmtpPacketizationMode, h264_packetization_mode);
+			}
+		}
+		video->set_codecs(codecs);
+	}
+
+	VideoEncoding::VideoEncoding() :
+		min_bitrate_bps(0),
+		start_bitrate_bps(0),
+		max_bitrate_bps(0),
+		max_width(0),
+		max_height(0),
+		max_fps(0),
+		degradation(kMaintainFramerate),
+		quality_scaler(CFG_quality_scaler_enabled_)
+	{
+	}
+
+	void VideoEncoding::ApplyBitrates(cricket::SessionDescription * desc) const
+	{
+		if (!desc || (min_bitrate_bps <= 0 && start_bitrate_bps <= 0 && max_bitrate_bps <= 0))
+			return;
+
+		cricket::ContentInfo * content = cricket::GetFirstVideoContent(desc->contents());
+		if (!content || !content->description)
+			return;
+
+		auto video = static_cast<cricket::VideoContentDescription*>(content->description);
+		cricket::VideoCodecs codecs = video->codecs();
+		for (auto & codec : codecs)
+		{
+			// kbps
+			if (min_bitrate_bps > 0)
+			{
+				codec.SetParam(cricket::kCodecParamMinBitrate, min_bitrate_bps / 1000);
+			}
+			if (start_bitrate_bps > 0)
+			{
+				codec.SetParam(cricket::kCodecParamStartBitrate, start_bitrate_bps / 1000);
+			}
+			if (max_bitrate_bps > 0)
+			{
+				codec.SetParam(cricket::kCodecParamMaxBitrate, max_bitrate_bps / 1000);
+			}
+		}
+		video->set_codecs(codecs);
+	}
+
+	SessionEncoderFactory::SessionEncoderFactory(const VideoCodecPreference & preference, bool quality_scaler) :
+		spatial_layers_(std::min(std::max(preference.vp9_spatial_layers, 1), 3)),
+		temporal_layers_(std::min(std::max(preference.vp9_temporal_layers, 1), 3)),
+		quality_scaler_(quality_scaler),
+		live_(0)
+	{
+		codecs_.push_back(cricket::VideoCodec(cricket::kVp8CodecName));
+		if (webrtc::VP9Encoder::IsSupported())
+		{
+			codecs_.push_back(cricket::VideoCodec(cricket::kVp9CodecName));
+		}
+	}
+
+	webrtc::VideoEncoder * SessionEncoderFactory::CreateVideoEncoder(const cricket::VideoCodec & codec)
+	{
+		const bool vp8 = cricket::CodecNamesEq(codec.name, cricket::kVp8CodecName);
+		if (!vp8 && (!cricket::CodecNamesEq(codec.name, cricket::kVp9CodecName) || !webrtc::VP9Encoder::IsSupported()))
+			return nullptr;
+
+		// the simulcast adapter destroys all of its encoders, highest
+		// stream first, and creates them again from stream 0 up
+		rtc::CritScope lock(&crit_);
+		const size_t stream = live_++;
+		if (vp8)
+		{
+			if (stream < parked_vp8_.size() && parked_vp8_[stream])
+				return parked_vp8_[stream].release();
+
+			return new SessionEncoder(webrtc::VP8Encoder::Create(), this, stream, 1, 1, true);
+		}
+
+		if (spatial_layers_ > 1 || temporal_layers_ > 1)
+		{
+			LOG(INFO) << "VP9 with " << spatial_layers_ << " spatial and " << temporal_layers_ << " temporal layers";
+		}
+		return new SessionEncoder(webrtc::VP9Encoder::Create(), this, stream, spatial_layers_, temporal_layers_, false);
+	}
+
+	const std::vector<cricket::VideoCodec> & SessionEncoderFactory::supported_codecs() const
+	{
+		return codecs_;
+	}
+
+	void SessionEncoderFactory::DestroyVideoEncoder(webrtc::VideoEncoder * encoder)
+	{
+		if (!encoder)
+			return;
+
+		SessionEncoder * session_encoder = static_cast<SessionEncoder*>(encoder);
+		std::unique_ptr<webrtc::VideoEncoder> replaced;
+		{
+			rtc::CritScope lock(&crit_);
+			--live_;
+
+			// the simulcast adapter the engine puts around VP8 destroys and
+			// creates its encoders on every reconfiguration, the next
+			// encoder of the same stream is this one with its libvpx state
+			if (session_encoder->resizes_in_place())
+			{
+				const size_t stream = session_encoder->stream();
+				if (parked_vp8_.size() <= stream)
+				{
+					parked_vp8_.resize(stream + 1);
+				}
+				replaced = std::move(parked_vp8_[stream]);
+				parked_vp8_[stream].reset(encoder);
+				return;
+			}
+		}
+		delete encoder;
+	}
+
+	void SessionEncoderFactory::ReleaseUnclaimed()
+	{
+		// streams the adapter no longer runs, deleting releases libvpx
+		std::vector<std::unique_ptr<webrtc::VideoEncoder>> unclaimed;
+		{
+			rtc::CritScope lock(&crit_);
+			unclaimed.swap(parked_vp8_);
+		}
+	}
+}
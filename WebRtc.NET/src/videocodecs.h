@@ -0,0 +1,128 @@
+
+#ifndef WEBRTC_NET_VIDEOCODECS_H_
+#define WEBRTC_NET_VIDEOCODECS_H_
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "webrtc/base/criticalsection.h"
+#include "webrtc/media/engine/webrtcvideoencoderfactory.h"
+#include "webrtc/p2p/base/sessiondescription.h"
+
+namespace Native
+{
+	// Which video codecs a session prefers, in order, and how they are set
+	// up. Applied to both descriptions, each controls one direction:
+	// - the remote one, before SetRemoteDescription, decides what we send:
+	//   we answer with and send the first codec of the remote's list, and
+	//   its H.264 parameters are what our encoder is set up for;
+	// - the local one decides what the remote sends: it ranks our offer
+	//   or answer, and the H.264 parameters are what we accept.
+	struct VideoCodecPreference
+	{
+		VideoCodecPreference();
+
+		// names like "VP9", "H264", "VP8"; the others follow as offered
+		std::vector<std::string> order;
+
+		// more than 1 sets up SVC
+		int vp9_spatial_layers;
+		int vp9_temporal_layers;
+
+		// empty, or -1, keeps what the engine offers
+		std::string h264_profile_level_id;
+		int h264_packetization_mode;
+
+		bool UsesSvc() const
+		{
+			return vp9_spatial_layers > 1 || vp9_temporal_layers > 1;
+		}
+
+		void Apply(cricket::SessionDescription * desc) const;
+	};
+
+	enum DegradationPreference
+	{
+		// lower the resolution first
+		kMaintainFramerate,
+
+		// drop frames, never scale
+		kMaintainResolution
+	};
+
+	// Encoder settings of a session's video sender, changed at runtime
+	// without renegotiation: the max bitrate through the RtpSender, the
+	// resolution and framerate limits through the capturer's VideoAdapter.
+	// The engine takes min and start bitrate only from the negotiated
+	// codec, so those go into the remote description and apply from the
+	// next negotiation. 0 lifts a limit.
+	struct VideoEncoding
+	{
+		VideoEncoding();
+
+		int min_bitrate_bps;
+		int start_bitrate_bps;
+		int max_bitrate_bps;
+
+		int max_width;
+		int max_height;
+		int max_fps;
+
+		DegradationPreference degradation;
+
+		// lets QP lower the resolution, CFG_quality_scaler_enabled_ by default
+		bool quality_scaler;
+
+		bool ScalesResolution() const
+		{
+			return degradation == kMaintainFramerate;
+		}
+
+		// x-google-*-bitrate of the video codecs the remote offers
+		void ApplyBitrates(cricket::SessionDescription * desc) const;
+	};
+
+	// External encoder factory of one session: VP8 and VP9 with its quality
+	// scaler switch, VP9 with the SVC layers of its VideoCodecPreference.
+	// H.264 is left to the engine's internal factory.
+	class SessionEncoderFactory : public cricket::WebRtcVideoEncoderFactory
+	{
+	public:
+		SessionEncoderFactory(const VideoCodecPreference & preference, bool quality_scaler);
+
+		// any thread, read when an encoder is (re)configured
+		void set_quality_scaler(bool enable)
+		{
+			quality_scaler_ = enable;
+		}
+
+		bool quality_scaler() const
+		{
+			return quality_scaler_;
+		}
+
+		webrtc::VideoEncoder * CreateVideoEncoder(const cricket::VideoCodec & codec) override;
+		const std::vector<cricket::VideoCodec> & supported_codecs() const override;
+		void DestroyVideoEncoder(webrtc::VideoEncoder * encoder) override;
+
+		// encoder thread, once the encoders of a new configuration are set
+		// up: releases the parked ones none of them took back
+		void ReleaseUnclaimed();
+
+	private:
+		const int spatial_layers_;
+		const int temporal_layers_;
+		std::atomic<bool> quality_scaler_;
+		std::vector<cricket::VideoCodec> codecs_;
+
+		// encoders alive, the next one created is for that stream, and the
+		// destroyed VP8 encoders kept by stream for the next CreateVideoEncoder
+		rtc::CriticalSection crit_;
+		size_t live_;
+		std::vector<std::unique_ptr<webrtc::VideoEncoder>> parked_vp8_;
+	};
+}
+#endif  // WEBRTC_NET_VIDEOCODECS_H_
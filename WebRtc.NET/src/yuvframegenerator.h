@@ -0,0 +1,103 @@
+
+#ifndef WEBRTC_NET_YUVFRAMEGENERATOR_H_
+#define WEBRTC_NET_YUVFRAMEGENERATOR_H_
+#pragma once
+
+#include <memory>
+
+#include "webrtc/api/video/i420_buffer.h"
+#include "webrtc/base/constructormagic.h"
+
+namespace Native
+{
+	// Same picture as cricket::YuvFrameGenerator (landscape, gradients,
+	// bouncing cube, moving lines and an optional EAN barcode), but tuned
+	// for synthetic load generation:
+	//  - the static background is rendered once and cached,
+	//  - frames are written straight into the target I420Buffer (any stride),
+	//  - a buffer the generator drew into before only gets the regions of
+	//    that frame restored, a new one is a plain SIMD plane copy (libyuv).
+	//    Nothing else may write into the buffers in between.
+	class YuvFrameGenerator
+	{
+	public:
+		// If |enable_barcode| is true |width|x|height| should be at least 160x100.
+		YuvFrameGenerator(int width, int height, bool enable_barcode);
+		~YuvFrameGenerator();
+
+		// Renders the next frame into |buffer|, which must be |width|x|height|.
+		// A negative |barcode_value| skips the barcode, otherwise the value is
+		// encoded modulo 10,000,000.
+		void GenerateNextFrame(webrtc::I420Buffer * buffer, int32_t barcode_value);
+
+		int GetWidth() const
+		{
+			return width_;
+		}
+		int GetHeight() const
+		{
+			return height_;
+		}
+
+		void GetBarcodeBounds(int * top, int * left, int * width, int * height) const;
+
+	private:
+
+		struct Rect
+		{
+			int x, y, w, h;
+		};
+
+		// regions drawn over the background, moving parts and barcode
+		struct Dirty
+		{
+			Rect y[2];
+			Rect u[2];
+			Rect v[2];
+		};
+
+		// a buffer and what the last frame drawn into it left there
+		struct Drawn
+		{
+			const webrtc::I420Buffer * buffer;
+			uint32_t frame;
+			Dirty dirty;
+		};
+
+		void DrawBackground();
+		Drawn * Find(const webrtc::I420Buffer * buffer);
+		void Restore(webrtc::I420Buffer * buffer, const Dirty & dirty);
+		void DrawBarcode(webrtc::I420Buffer * buffer, uint32_t value, Dirty & dirty);
+		int DrawBars(uint8_t * p, int stride, int x, int y, int count, int height);
+
+		static void Fill(uint8_t * p, int stride, const Rect & r, uint8_t value);
+		static void Copy(const uint8_t * src, int src_stride, uint8_t * dst, int dst_stride, const Rect & r);
+		static Rect Clip(const Rect & r, int w, int h);
+
+		int width_;
+		int height_;
+		int chroma_width_;
+		int chroma_height_;
+		int frame_index_;
+
+		// cached static background, tightly packed
+		std::unique_ptr<uint8_t[]> y_data_;
+		std::unique_ptr<uint8_t[]> u_data_;
+		std::unique_ptr<uint8_t[]> v_data_;
+
+		// Buffers are told apart by address without holding them, the pool
+		// keeps them as long as the size doesn't change and the generator
+		// is replaced along with the size. More buffers in rotation than
+		// kTracked evict the least recently drawn one.
+		static const size_t kTracked = 16;
+		Drawn drawn_[kTracked];
+		uint32_t frames_;
+
+		int barcode_start_x_;
+		int barcode_start_y_;
+
+		RTC_DISALLOW_COPY_AND_ASSIGN(YuvFrameGenerator);
+	};
+}
+
+#endif  // WEBRTC_NET_YUVFRAMEGENERATOR_H_